@@ -15,89 +15,230 @@ portable to other projects maybe
 
 // Defines:
 #define CHIP8_MEM_SIZE 4096u
+#define CHIP8_MAX_ROM_SIZE (CHIP8_MEM_SIZE - 0x200u) // What fits above 0x200
 #define CHIP8_STACK_SIZE 16u
 #define CHIP8_DISPLAY_WIDTH 64u
 #define CHIP8_DISPLAY_HEIGHT 32u
 #define CHIP8_FONT_DATA_START 0x50u
 
+// Cache line size, chip8_t is aligned to it so an instance never shares a line
+// with another one (see chip8_arena.h for allocating them)
+#define CHIP8_CACHE_LINE 64u
+#define CHIP8_CACHE_ALIGNED __attribute__((aligned(CHIP8_CACHE_LINE)))
+
+// Rate of the timers, chip8_timer_tick is meant to be called this many times
+// per second (once per frame)
+#define CHIP8_TIMER_HZ 60u
+
 // Use callback draw function
 // #define CHIP8_USE_DRAW_CALLBACK
 
 // Release detection for FX0A
 #define CHIP8_FX0A_RELEASE
 
-// If defined, 8xy1, 8xy2, and 8xy3 reset VF to 0 before/after the operation
-// #ifndef CHIP8_VF_RESET
-// #define CHIP8_VF_RESET
-// #endif
+// Quirks, picked at runtime with chip8_set_quirks(), every combination gets its
+// own specialized interpreter so there are no quirk checks per instruction
 
-// If defined, Fx55 and Fx65 increment I after each register store/load
-// #ifndef CHIP8_MEM_INCR
-// #define CHIP8_MEM_INCR
-// #endif
+// If set, 8xy1, 8xy2, and 8xy3 reset VF to 0 before/after the operation
+#define CHIP8_QUIRK_VF_RESET (1u << 0)
 
-// If defined, sprites that go off-screen are clipped instead of wrapped
-// #ifndef CHIP8_CLIP
-// #define CHIP8_CLIP
-// #endif
+// If set, Fx55 and Fx65 increment I after each register store/load
+#define CHIP8_QUIRK_MEM_INCR (1u << 1)
 
-// If defined, Dxyn waits for VBlank before drawing
-// #ifndef CHIP8_WAIT_VBLANK
-// #define CHIP8_WAIT_VBLANK
-// #endif
+// If set, sprites that go off-screen are clipped instead of wrapped
+#define CHIP8_QUIRK_CLIP (1u << 2)
 
-// If defined, 8xy6 and 8xyE only operate on Vx
-// If undefined, Vy is shifted and result is stored into Vx (Vx = Vy >> 1)
-// #ifndef CHIP8_SHIFT_VX_ONLY
-// #define CHIP8_SHIFT_VX_ONLY
-// #endif
+// If set, Dxyn waits for VBlank before drawing
+#define CHIP8_QUIRK_WAIT_VBLANK (1u << 3)
 
-// If defined, Bnnn uses Vx where X is the high nibble of nnn
-// If undefined, always uses V0
-// #ifndef CHIP8_JUMP_USE_VX
-// #undef CHIP8_JUMP_USE_VX
-// #endif
+// If set, 8xy6 and 8xyE only operate on Vx
+// If unset, Vy is shifted and result is stored into Vx (Vx = Vy >> 1)
+#define CHIP8_QUIRK_SHIFT_VX_ONLY (1u << 4)
 
+// If set, Bnnn uses Vx where X is the high nibble of nnn
+// If unset, always uses V0
+#define CHIP8_QUIRK_JUMP_USE_VX (1u << 5)
 
+#define CHIP8_QUIRK_COUNT 6u
+#define CHIP8_QUIRK_MASK ((1u << CHIP8_QUIRK_COUNT) - 1u)
+
+// Quirk profiles (May be innacurate)
+#define CHIP8_PROFILE_VIP                                                      \
+  (CHIP8_QUIRK_VF_RESET | CHIP8_QUIRK_MEM_INCR | CHIP8_QUIRK_CLIP |            \
+   CHIP8_QUIRK_WAIT_VBLANK | CHIP8_QUIRK_JUMP_USE_VX)
+#define CHIP8_PROFILE_MODERN (CHIP8_QUIRK_SHIFT_VX_ONLY)
+#define CHIP8_PROFILE_TIMENDOUS                                                \
+  (CHIP8_QUIRK_VF_RESET | CHIP8_QUIRK_MEM_INCR | CHIP8_QUIRK_CLIP |            \
+   CHIP8_QUIRK_WAIT_VBLANK)
+
+// Profile set by chip8_initialize
+#ifndef CHIP8_DEFAULT_PROFILE
+#define CHIP8_DEFAULT_PROFILE CHIP8_PROFILE_TIMENDOUS
+#endif
 
 // Chip8 framebuffer (bit-packed version)
 typedef uint8_t chip8_display_t[CHIP8_DISPLAY_HEIGHT][CHIP8_DISPLAY_WIDTH / 8];
 
+// Every row in a dirty row bitmap (bit n is row n)
+#define CHIP8_DISPLAY_ALL_ROWS UINT32_MAX
+
 // Chip8 external functions
 typedef struct {
   uint8_t (*rand)(void);
 #ifdef CHIP8_USE_DRAW_CALLBACK
+  // Called by every instruction that changes the display, frontends that
+  // present once per frame should use chip8_display_changes instead
   void (*draw_display)(const chip8_display_t *display, void *user_data);
   void *user_data; // So, this void pointer allows the backend to store stuff
 #else 
   uint8_t display_update_flag; // Alternative to the callback, will just get set when necessary
 #endif // CHIP8_USE_DRAW_CALLBACK
-#ifdef CHIP8_WAIT_VBLANK
-  uint8_t vblank_ready;
-#endif // CHIP8_WAIT_VBLANK
+  uint8_t vblank_ready; // Used by CHIP8_QUIRK_WAIT_VBLANK
 } chip8_interface_t;
 
-// Chip8 Structure
+// Fused idioms (superinstructions) of the predecoded engine
+typedef enum {
+  CHIP8_FUSION_NONE,
+  CHIP8_FUSION_TIMER_POLL,   // Fx07; 3xkk; 1nnn
+  CHIP8_FUSION_SPRITE,       // Annn; Dxyn
+  CHIP8_FUSION_LOAD_PAIR,    // 6xkk; 6ykk
+  CHIP8_FUSION_COUNTED_LOOP, // 7xkk; 3xkk; 1nnn
+  CHIP8_FUSION_COUNT
+} chip8_fusion_t;
+
+// Predecoded instruction (handler plus unpacked operands)
+struct chip8;
+struct chip8_op;
+typedef void (*chip8_op_handler_t)(struct chip8 *chip8,
+                                   const struct chip8_op *op);
+// Fused handler, runs the whole idiom and returns the instructions executed
+typedef uint8_t (*chip8_fused_handler_t)(struct chip8 *chip8,
+                                         const struct chip8_op *op);
+typedef struct chip8_op {
+  chip8_op_handler_t handler;
+  chip8_fused_handler_t fused; // Idiom starting here (NULL if none)
+  uint16_t instruction;
+  uint16_t nnn;
+  uint8_t x;
+  uint8_t y;
+  uint8_t kk;
+  uint8_t n;
+  uint8_t fusion;        // chip8_fusion_t of fused
+  uint8_t fused_length;  // Max instructions run by fused
+} chip8_op_t;
+
+// Predecoded instruction cache, one entry per memory address (filled lazily)
 typedef struct {
+  chip8_op_t ops[CHIP8_MEM_SIZE];
+  uint8_t decoded[CHIP8_MEM_SIZE / 8];         // Entries filled (bitmap)
+  uint8_t fuse;                                // Fuse idioms while decoding
+  uint64_t fusion_hits[CHIP8_FUSION_COUNT];    // Times each fused idiom ran
+} chip8_predecode_t;
+
+struct chip8_jit;     // See chip8_jit.h
+struct chip8_trace;   // See chip8_trace.h
+struct chip8_profile; // See chip8_profile.h
+
+// Events, raised by instructions and queued in the event ring, chip8_run
+// returns early after an instruction that raised any of them
+#define CHIP8_EVENT_DISPLAY (1u << 0)        // Display changed (00E0, Dxyn that flipped a pixel)
+#define CHIP8_EVENT_SOUND_START (1u << 1)    // ST went from 0 to non-zero
+#define CHIP8_EVENT_SOUND_STOP (1u << 2)     // ST went back to 0
+#define CHIP8_EVENT_KEY_WAIT (1u << 3)       // Fx0A is blocked waiting for a key
+#define CHIP8_EVENT_VBLANK_WAIT (1u << 4)    // Dxyn is blocked waiting for VBlank
+#define CHIP8_EVENT_UNKNOWN_OPCODE (1u << 5) // Unknown instruction found
+
+// Events that block the instruction until the host does something (key press
+// or next frame), the rest of the batch would just spin on them
+#define CHIP8_EVENT_BLOCKED (CHIP8_EVENT_KEY_WAIT | CHIP8_EVENT_VBLANK_WAIT)
+
+// Number of events the ring holds, when full the oldest event gets dropped
+#define CHIP8_EVENT_RING_SIZE 16u
+
+// Event queued in the ring
+typedef struct {
+  uint64_t cycle; // Instructions executed when it was raised (chip8->cycles)
+  uint16_t pc;    // Address of the instruction (or idiom) that raised it, in memory
+  uint8_t type;   // One CHIP8_EVENT_*
+} chip8_event_t;
+
+// Memory image, the font and a ROM, shared read-only by every instance that
+// loads it with chip8_load_image (an instance only gets its own copy of memory
+// when Fx33 or Fx55 first write to it)
+typedef struct {
+  uint8_t memory[CHIP8_MEM_SIZE];
+} chip8_image_t;
+
+// Chip8 Structure, the state used by every instruction comes first and fits
+// in the first cache line, the stack, display and RAM come after it
+typedef struct chip8 {
   uint16_t PC;                      // Program Counter
+  uint16_t I;                       // I 16bit Register
   uint8_t SP;                       // Stack Pointer
-  uint16_t stack[CHIP8_STACK_SIZE]; // Stack (should it be in memory(??))
+  uint8_t DT;                       // Delay Timer register
+  uint8_t ST;                       // Sound Timer Register
+  uint8_t quirks;                   // CHIP8_QUIRK_* bitmask
   uint8_t V[16];                    // V Registers
-  uint16_t I;                       // I 16bit Register
-  uint8_t DT;                       // Sound Timer Register
-  uint8_t ST;                       // Delay Timer register
-  uint8_t memory[CHIP8_MEM_SIZE];   // 4K RAM
-  chip8_display_t display;
-  chip8_interface_t interface;
-  uint8_t keys[16];                 // Keys
+  uint16_t keys;                    // Keys pressed, bit n is key n
 #ifdef CHIP8_FX0A_RELEASE
-  uint8_t previous_keys[16];        // Keys that were pressed before for CHIP8_FX0A_RELEASE
+  uint16_t previous_keys;           // Keys pressed before or during this frame for CHIP8_FX0A_RELEASE
 #endif // CHIP8_FX0A_RELEASE
-} chip8_t;
+  uint8_t pending_events;           // CHIP8_EVENT_* raised by the running instruction
+  uint8_t last_events;              // CHIP8_EVENT_* raised by the last instruction that raised any
+  uint32_t rand_state;              // Built-in RNG, used when interface.rand is NULL
+  uint64_t cycles;                  // Instructions executed
+  const uint8_t *memory;            // 4K memory as read, a shared image until the first store, then ram
+  chip8_predecode_t *predecode;     // Predecoded engine cache (NULL runs the plain interpreter)
+  // End of the first cache line
+  struct chip8_jit *jit;            // JIT used by chip8_run (NULL if not used)
+  struct chip8_trace *trace;        // Tracer, overrides the engines (NULL if not tracing)
+  struct chip8_profile *profile;    // Profiler, runs the sampled batches (NULL if not profiling)
+  uint16_t stack[CHIP8_STACK_SIZE]; // Stack (should it be in memory(??))
+  uint64_t idle_cycles;             // Instructions skipped by idle loop detection (included in cycles)
+  uint32_t dirty_rows;              // Display rows written since chip8_display_changes (bit n is row n)
+  uint32_t display_generation;      // Incremented every time the display changes
+  uint8_t event_head;               // Next event to write
+  uint8_t event_tail;               // Next event to read
+  chip8_event_t events[CHIP8_EVENT_RING_SIZE]; // Event ring, drained by the host
+  chip8_interface_t interface;
+  chip8_display_t display;
+  uint8_t *ram;                     // Private copy of memory (NULL until the first store or chip8_set_ram)
+  uint8_t ram_allocated;            // ram came from malloc, chip8_destroy frees it
+} CHIP8_CACHE_ALIGNED chip8_t;
 
-// Initialize CHIP8 struct
+// Initialize CHIP8 struct, memory starts as a font only image shared by every
+// instance
 void chip8_initialize(chip8_t *chip8, const chip8_interface_t chip8_interface);
 
+// Free the RAM chip8 allocated itself (if it was not given one with
+// chip8_set_ram), call it before initializing the instance again
+void chip8_destroy(chip8_t *chip8);
+
+// Use ram (CHIP8_MEM_SIZE bytes, owned by the caller) for the private copy of
+// memory instead of allocating it on the first store, call it after
+// chip8_initialize. Nothing is written to ram until then, so untouched RAM
+// handed out in bulk (see chip8_arena_ram) never becomes resident
+void chip8_set_ram(chip8_t *chip8, uint8_t *ram);
+
+// Memory for writing from outside of the core, makes the private copy if
+// memory is still shared (flush the engines after writing code, see
+// chip8_predecode_flush)
+uint8_t *chip8_memory_writable(chip8_t *chip8);
+
+// Set the quirks (CHIP8_QUIRK_* bitmask or a CHIP8_PROFILE_*)
+void chip8_set_quirks(chip8_t *chip8, uint8_t quirks);
+
+// Parse a profile name (vip, modern, timendous) or a quirk bitmask, returns -1
+// if str is neither
+int chip8_parse_profile(const char *str, uint8_t *quirks);
+
+// Seed the built-in RNG (Cxkk uses it when interface.rand is NULL), the same
+// seed gives the same numbers
+void chip8_seed_rand(chip8_t *chip8, uint32_t seed);
+
+// Next byte of the built-in RNG (xorshift32) with its state
+uint8_t chip8_rand(uint32_t *state);
+
 // Print flags
 #define PRINT_PC (1 << 0)
 #define PRINT_SP (1 << 1)
@@ -114,24 +255,95 @@ void chip8_print_registers(chip8_t *chip8, int flags);
 // Print Display
 void chip8_print_display(chip8_t *chip8, char on_char, char off_char);
 
+// Read the instruction at addr (to report events)
+uint16_t chip8_opcode_at(const chip8_t *chip8, uint16_t addr);
+
+// Hash of the display (64-bit FNV-1a), to compare runs
+uint64_t chip8_display_hash(const chip8_display_t *display);
+
+// Rows that differ between the display and shown (bit n is row n), only the
+// dirty rows are compared, copies them into shown and clears the dirty rows.
+// A frontend keeps shown as what it presented last and presents once per frame
+// only if this is not 0, so sprites drawn and erased in the same frame cost
+// nothing
+uint32_t chip8_display_changes(chip8_t *chip8, chip8_display_t *shown);
+
+// Mark every row dirty, needed after writing the display from outside of the
+// core (chip8_display_changes still skips the rows that did not change)
+void chip8_display_invalidate(chip8_t *chip8);
+
 // Hexdump memory region
 void chip8_mem_hexdump(chip8_t *chip8, uint16_t start_addr, uint16_t end_addr);
 
-// Execute an instruction
-void chip8_step(chip8_t *chip8);
+// Execute an instruction, returns the CHIP8_EVENT_* it raised (also queued)
+uint8_t chip8_step(chip8_t *chip8);
+
+// Execute up to max_cycles instructions (with the JIT if attached, or the
+// plain interpreter writing every instruction to the tracer if tracing or
+// counting them if the profiler samples this batch), returns
+// the number of instructions executed (idle loops are skipped, see
+// chip8_idle_skip). Returns early after an instruction that
+// raised an event, unless it got blocked (CHIP8_EVENT_BLOCKED), then the rest
+// of the batch is skipped as it would have spun on it, and max_cycles is
+// returned
+uint32_t chip8_run(chip8_t *chip8, uint32_t max_cycles);
+
+// Pop the oldest event from the ring, returns 0 if there are none
+int chip8_poll_event(chip8_t *chip8, chip8_event_t *event);
 
-// Load ROM into the memory starting at address 0x200
+// Skip the rest of the batch if PC is at the start of an idle loop (one that
+// only DT, the keys or VBlank can end), returns the instructions skipped (0 if
+// not idle) (used by the execution engines)
+uint32_t chip8_idle_skip(chip8_t *chip8, uint32_t remaining);
+
+// Queue the pending events raised by the instruction at pc, returns them (used
+// by the execution engines)
+uint8_t chip8_commit_events(chip8_t *chip8, uint16_t pc);
+
+// Attach a predecoded instruction cache to run the predecoded engine, NULL
+// detaches it and goes back to the plain interpreter
+void chip8_predecode_attach(chip8_t *chip8, chip8_predecode_t *predecode);
+
+// Drop every predecoded instruction, needed after writing memory from outside
+// of the core (chip8_load_rom already does it)
+void chip8_predecode_flush(chip8_t *chip8);
+
+// Enable or disable idiom fusion in the predecoded engine, fused idioms only
+// run from chip8_run (chip8_step always runs a single instruction)
+void chip8_predecode_set_fusion(chip8_t *chip8, uint8_t enable);
+
+// Print how many times each fused idiom ran
+void chip8_predecode_print_fusion(chip8_t *chip8);
+
+// Load ROM into the memory starting at address 0x200 (into the private copy,
+// chip8_load_image shares it instead)
 void chip8_load_rom(chip8_t *chip8, const uint8_t *rom, uint16_t size);
 
+// Build the image of the font and ROM (starting at address 0x200)
+void chip8_image_initialize(chip8_image_t *image, const uint8_t *rom,
+                            uint16_t size);
+
+// Load an image without copying it, image has to stay unchanged and outlive
+// the instance (or the next load)
+void chip8_load_image(chip8_t *chip8, const chip8_image_t *image);
+
+// Read a ROM file (up to what fits above 0x200) into rom, returns -1 on error
+int chip8_read_rom_file(const char *filename, uint8_t *rom, uint16_t *size);
+
 // Load ROM from a file into memory starting at address 0x200
 int chip8_load_rom_from_file(chip8_t *chip8, const char *filename);
 
-// Set key
+// Set key, it can be called between chip8_run calls in the middle of a frame
 void chip8_set_key(chip8_t *chip8, uint8_t key);
 
 // Reset key
 void chip8_reset_key(chip8_t *chip8, uint8_t key);
 
+// Whether key is pressed
+static inline uint8_t chip8_key_pressed(const chip8_t *chip8, uint8_t key) {
+  return (uint8_t)((chip8->keys >> (key & 0xFu)) & 1u);
+}
+
 // Save previous keys state
 #ifdef CHIP8_FX0A_RELEASE
 void chip8_save_key(chip8_t *chip8);
@@ -140,6 +352,10 @@ void chip8_save_key(chip8_t *chip8);
 // Tick Timers
 void chip8_timer_tick(chip8_t *chip8);
 
+// End of a frame: VBlank, save the keys for Fx0A and tick the timers (once per
+// CHIP8_TIMER_HZ frame, after its chip8_run calls)
+void chip8_frame_end(chip8_t *chip8);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,56 @@
+#ifndef CHIP8_ARENA
+#define CHIP8_ARENA
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <chip8.h>
+#include <stdint.h>
+
+/*
+Instance arena, one block holding up to capacity chip8_t back to back, every
+one cache line aligned, handed out as contiguous arrays. Meant for hosts
+running many instances at once: they share no cache lines, walking them is
+sequential and there is a single allocation to free.
+Instances are not initialized (chip8_initialize each of them), they are only
+given back all at once with chip8_arena_reset or chip8_arena_destroy.
+malloc does not align to cache lines, instances should come from here (or be
+static or on the stack).
+Every instance also gets a RAM slot (chip8_arena_ram, for chip8_set_ram) in a
+second block, page aligned and never written by the arena, so only the slots
+of instances that wrote to memory become resident. Instances that load the
+same chip8_image_t and never store to it cost little more than sizeof(chip8_t).
+*/
+
+// Arena struct type thing
+typedef struct {
+  void *block;        // What malloc returned
+  chip8_t *instances; // First instance, aligned to CHIP8_CACHE_LINE
+  void *ram_block;    // What malloc returned for the RAM slots
+  uint8_t *ram;       // First RAM slot, aligned to CHIP8_MEM_SIZE
+  uint32_t capacity;  // Instances the block holds
+  uint32_t used;      // Instances handed out
+} chip8_arena_t;
+
+// Allocate room for capacity instances, returns 1 on error
+int chip8_arena_initialize(chip8_arena_t *arena, uint32_t capacity);
+
+// Free the block, every instance handed out goes with it
+void chip8_arena_destroy(chip8_arena_t *arena);
+
+// Hand out count contiguous instances, NULL if they do not fit
+chip8_t *chip8_arena_alloc(chip8_arena_t *arena, uint32_t count);
+
+// RAM slot of an instance handed out by the arena, give it to chip8_set_ram
+// after chip8_initialize
+uint8_t *chip8_arena_ram(const chip8_arena_t *arena, const chip8_t *chip8);
+
+// Take every instance back (detach their engines before reusing them)
+void chip8_arena_reset(chip8_arena_t *arena);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // !CHIP8_ARENA
@@ -0,0 +1,43 @@
+#ifndef CHIP8_HEADLESS
+#define CHIP8_HEADLESS
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <chip8.h>
+#include <chip8_movie.h>
+#include <stdint.h>
+
+/*
+Headless backend, runs the same frame loop as the SDL backend (cycles, VBlank,
+keys and timers) but without any window or delay, as fast as possible.
+Meant for measuring throughput and checking for regressions with the display
+hash, it does not need SDL at all.
+*/
+
+// Headless struct type thing
+typedef struct {
+  uint32_t frames;             // Frames to run
+  uint32_t cycles_per_frame;   // Instructions per frame
+  const uint32_t *hash_frames; // Frames to print the display hash at (ascending)
+  uint32_t hash_frame_count;   // Number of hash_frames, 0 prints it at exit
+  chip8_movie_t *movie;        // Movie to record or replay (NULL if none)
+  uint8_t movie_replay;        // Replay movie instead of recording it
+  uint64_t instructions;       // Instructions executed by the last run
+  double seconds;              // Time taken by the last run
+} chip8_headless_t;
+
+// Initialize the headless backend
+void chip8_headless_initialize(chip8_headless_t *chip8_headless, uint32_t frames,
+                               uint32_t cycles_per_frame);
+
+// Run the headless loop, prints the display hashes and the instructions per
+// second
+void chip8_headless_run(chip8_t *chip8, chip8_headless_t *chip8_headless);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // !CHIP8_HEADLESS
@@ -0,0 +1,70 @@
+#ifndef CHIP8_JIT
+#define CHIP8_JIT
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <chip8.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Dynamic recompiler for x86-64, translates basic blocks starting at PC into
+native code. Compiled code works straight on the chip8_t registers, so the
+rest of the emulator does not notice it. Instructions that are not worth
+compiling (Dxyn, Fx0A...) end the block and are run by the interpreter, which
+also keeps being used when a block does not fit in the cycles left, so results
+are the same as the interpreter. Fx33 and Fx55 end their block too, the
+translated code they wrote over is dropped once it returns.
+On other architectures chip8_jit_initialize just fails.
+*/
+
+// Size of the buffer holding translated code
+#define CHIP8_JIT_CODE_SIZE (1u << 20)
+
+// Max number of instructions in a block
+#define CHIP8_JIT_MAX_BLOCK 32u
+
+// Translated block, code is NULL until the address gets translated
+typedef struct {
+  uint8_t *code;   // Native code
+  uint16_t length; // Number of instructions (0 when the interpreter runs it)
+  uint16_t store;  // Fx33 or Fx55 ending the block (0 if it does not store)
+} chip8_jit_block_t;
+
+// JIT struct type thing
+typedef struct chip8_jit {
+  uint8_t *code;                                   // Code buffer (mmap)
+  size_t code_used;                                // Bytes used in code
+  uint8_t quirks;                                  // Quirks the code was compiled for
+  chip8_jit_block_t blocks[CHIP8_MEM_SIZE];        // Code cache, by address
+  uint8_t translated[CHIP8_MEM_SIZE / 8];          // Bytes with translated code (bitmap)
+} chip8_jit_t;
+
+// Initialize the JIT, returns 1 on error (or when not supported)
+int chip8_jit_initialize(chip8_jit_t *jit);
+
+// Destroy the JIT
+void chip8_jit_destroy(chip8_jit_t *jit);
+
+// Attach the JIT to a chip8, chip8_run will use it, NULL detaches it
+void chip8_jit_attach(chip8_t *chip8, chip8_jit_t *jit);
+
+// Drop all translated code
+void chip8_jit_flush(chip8_jit_t *jit);
+
+// Drop all translated code if any of the len bytes at addr were translated,
+// needed after the interpreter wrote memory while the JIT is attached
+void chip8_jit_invalidate(chip8_jit_t *jit, uint16_t addr, uint16_t len);
+
+// Run up to max_cycles instructions, returns the number of instructions run,
+// stops after an instruction that raised an event (see chip8_run). The JIT has
+// to be attached to chip8, chip8_step keeps it coherent with the stores it runs
+uint32_t chip8_jit_run(chip8_jit_t *jit, chip8_t *chip8, uint32_t max_cycles);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // !CHIP8_JIT
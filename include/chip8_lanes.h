@@ -0,0 +1,77 @@
+#ifndef CHIP8_LANES
+#define CHIP8_LANES
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <chip8.h>
+#include <stdint.h>
+
+/*
+Lockstep engine, runs 16, 32 or 64 instances (lanes) of a ROM together, with
+the registers stored as structure of arrays so the ALU instructions, timers
+and Dxyn run over every lane at once (GCC vector extensions, 16 lanes at a
+time with SSE2 by default and 32 with AVX2, make AVX2=1). Each step takes the
+lanes sitting on the same instruction as the lane furthest behind and runs it
+for all of them, lanes that diverged just wait for their own group, so every
+lane ends up exactly like a chip8_t stepped on its own.
+Lanes are set up from (and copied back to) chip8_t, every lane needs the same
+quirks, and the built-in RNG or its own rand function if the ROM uses Cxkk
+(lanes call rand in lane order). Events, the predecoded cache and the JIT are not used here.
+*/
+
+// Max number of lanes
+#define CHIP8_LANES_MAX 64u
+
+// Lanes struct type thing (big, allocate it statically or on the heap)
+typedef struct {
+  uint8_t V[16][CHIP8_LANES_MAX];                      // V registers, by lane
+  uint16_t I[CHIP8_LANES_MAX];
+  uint16_t PC[CHIP8_LANES_MAX];
+  uint8_t SP[CHIP8_LANES_MAX];
+  uint16_t stack[CHIP8_STACK_SIZE][CHIP8_LANES_MAX];
+  uint8_t DT[CHIP8_LANES_MAX];
+  uint8_t ST[CHIP8_LANES_MAX];
+  uint16_t keys[CHIP8_LANES_MAX]; // Bit n is key n
+#ifdef CHIP8_FX0A_RELEASE
+  uint16_t previous_keys[CHIP8_LANES_MAX];
+#endif // CHIP8_FX0A_RELEASE
+  uint8_t vblank_ready[CHIP8_LANES_MAX];
+  uint8_t (*rand[CHIP8_LANES_MAX])(void);
+  uint32_t rand_state[CHIP8_LANES_MAX]; // Built-in RNG, when rand is NULL
+  uint64_t cycles[CHIP8_LANES_MAX];
+  uint64_t display[CHIP8_LANES_MAX][CHIP8_DISPLAY_HEIGHT]; // Rows, MSB is x 0
+  uint8_t memory[CHIP8_LANES_MAX][CHIP8_MEM_SIZE];
+  uint8_t shared[CHIP8_LANES_MAX]; // Memory is the same as other shared lanes
+  uint8_t count;  // Number of lanes (16, 32 or 64)
+  uint8_t quirks; // CHIP8_QUIRK_* bitmask of every lane
+  uint64_t steps;      // Instructions run for a group of lanes
+  uint64_t lane_steps; // Instructions run counting every lane
+} chip8_lanes_t;
+
+// Initialize count (16, 32 or 64) lanes with the quirks, returns 1 on error
+int chip8_lanes_initialize(chip8_lanes_t *lanes, uint8_t count, uint8_t quirks);
+
+// Copy a chip8 into a lane, returns 1 on error (bad lane or other quirks)
+int chip8_lanes_load(chip8_lanes_t *lanes, uint8_t lane, const chip8_t *chip8);
+
+// Copy a lane back into a chip8 (its interface is kept, but vblank_ready)
+void chip8_lanes_store(const chip8_lanes_t *lanes, uint8_t lane, chip8_t *chip8);
+
+// Run max_cycles instructions on every lane
+void chip8_lanes_run(chip8_lanes_t *lanes, uint32_t max_cycles);
+
+// End of frame for every lane: VBlank, save keys and tick timers, as the
+// frontends do after running a frame
+void chip8_lanes_frame_end(chip8_lanes_t *lanes);
+
+// Set or reset a key of a lane
+void chip8_lanes_set_key(chip8_lanes_t *lanes, uint8_t lane, uint8_t key,
+                         uint8_t pressed);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // !CHIP8_LANES
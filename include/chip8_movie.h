@@ -0,0 +1,97 @@
+#ifndef CHIP8_MOVIE
+#define CHIP8_MOVIE
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <chip8.h>
+#include <stdint.h>
+
+/*
+Movies, the key presses and releases of a run by frame and instruction within
+the frame, plus everything else it depends on (ROM, quirks, cycles per frame
+and the seed of the built-in RNG), so replaying one from a fresh boot gives the
+same run. The display hash after the last frame is stored to check the replay
+against.
+
+File format, version 2 (little-endian):
+  offset  size  field
+  0       4     magic "CH8M"
+  4       2     version
+  6       1     quirks
+  7       1     0
+  8       4     RNG seed
+  12      4     cycles per frame
+  16      8     boot image hash (chip8_snapshot_boot_hash)
+  24      4     frames
+  28      8     display hash after the last frame
+  36      4     number of key events
+  40      ...   key events: frames since the previous event (LEB128), the
+                cycle within the frame (LEB128), then the key, plus 0x80 if
+                pressed
+Version 1 had no cycle, its events are applied at the start of the frame.
+*/
+
+// File format version
+#define CHIP8_MOVIE_VERSION 2u
+
+// Key event
+typedef struct {
+  uint32_t frame;  // Frame it is applied in (the first frame is 1)
+  uint32_t cycle;  // Instructions of the frame run before it is applied
+  uint8_t key;     // 0 to F
+  uint8_t pressed; // 1 pressed, 0 released
+} chip8_movie_event_t;
+
+// Movie struct type thing
+typedef struct {
+  uint8_t quirks;
+  uint32_t seed;
+  uint32_t cycles_per_frame;
+  uint64_t boot_hash;
+  uint32_t frames;     // Frames recorded
+  uint64_t final_hash; // Display hash after the last frame
+  chip8_movie_event_t *events;
+  uint32_t event_count;
+  uint32_t event_capacity;
+  uint32_t next_event; // Next event to replay
+} chip8_movie_t;
+
+// Start recording a movie, returns 1 on error
+int chip8_movie_initialize(chip8_movie_t *chip8_movie, uint32_t seed,
+                           uint8_t quirks, uint32_t cycles_per_frame,
+                           uint64_t boot_hash);
+
+// Free the movie
+void chip8_movie_destroy(chip8_movie_t *chip8_movie);
+
+// Record a key press or release after cycle instructions of frame (events
+// have to be recorded in order), returns 1 on error
+int chip8_movie_record_key(chip8_movie_t *chip8_movie, uint32_t frame,
+                           uint32_t cycle, uint8_t key, uint8_t pressed);
+
+// Stop recording after frames frames, keeps the display hash of chip8
+void chip8_movie_end(chip8_movie_t *chip8_movie, uint32_t frames,
+                     const chip8_t *chip8);
+
+// Run the cycles_per_frame instructions of frame, applying its key events at
+// their cycle (VBlank and the timers are left to the caller)
+void chip8_movie_run_frame(chip8_movie_t *chip8_movie, chip8_t *chip8,
+                           uint32_t frame, uint32_t cycles_per_frame);
+
+// Compare the display hash of chip8 with the recorded one and print it,
+// returns 1 if they differ
+int chip8_movie_check(const chip8_movie_t *chip8_movie, const chip8_t *chip8);
+
+// Save the movie to a file, returns 1 on error
+int chip8_movie_save(const chip8_movie_t *chip8_movie, const char *filename);
+
+// Load (and initialize) a movie from a file, returns 1 on error
+int chip8_movie_load(chip8_movie_t *chip8_movie, const char *filename);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // !CHIP8_MOVIE
@@ -0,0 +1,103 @@
+#ifndef CHIP8_PAK
+#define CHIP8_PAK
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <chip8.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ROM archives (.c8pak), many ROMs in a single file that is mmap'ed once, with
+an index sorted by name in front. Every ROM is stored as its whole memory image
+(font and ROM, what chip8_image_initialize builds) on its own 4K page, so
+chip8_load_image runs it straight from the mapping: nothing is copied, a page
+is only read from disk when an instance runs it and it stays shared until
+Fx33 or Fx55 write to it. Opening one costs a few syscalls however many ROMs
+it holds. Built with the ch8pak tool.
+
+Format, version 1, little-endian:
+  offset  size  field
+  0       4     magic "C8PK"
+  4       2     version
+  6       2     reserved (0)
+  8       4     number of ROMs
+  12      4     reserved (0)
+  16      ...   index, an entry per ROM sorted by name (strcmp):
+    0     32    name, NUL padded (up to 31 bytes)
+    32    8     boot image hash (chip8_snapshot_boot_hash of the ROM)
+    40    4     offset of the image, a multiple of CHIP8_MEM_SIZE
+    44    2     ROM size
+    46    1     flags (CHIP8_PAK_HAS_PROFILE)
+    47    1     suggested quirks
+  ...           images, CHIP8_MEM_SIZE bytes each
+*/
+
+// Format version
+#define CHIP8_PAK_VERSION 1u
+
+// Size of the header and of an index entry
+#define CHIP8_PAK_HEADER_SIZE 16u
+#define CHIP8_PAK_ENTRY_SIZE 48u
+
+// Room for a name, NUL included
+#define CHIP8_PAK_NAME_SIZE 32u
+
+// Biggest ROM, what fits above 0x200
+#define CHIP8_PAK_MAX_ROM_SIZE CHIP8_MAX_ROM_SIZE
+
+// The ROM has a suggested profile (in quirks)
+#define CHIP8_PAK_HAS_PROFILE (1u << 0)
+
+// ROM in an archive, name and image point into the mapping (or into the
+// caller's memory for chip8_pak_save)
+typedef struct {
+  const char *name;
+  const chip8_image_t *image; // The ROM is at image->memory[0x200]
+  uint64_t hash;              // Boot image hash
+  uint16_t size;              // ROM size
+  uint8_t flags;              // CHIP8_PAK_HAS_PROFILE
+  uint8_t quirks;             // Suggested profile if flags has it
+} chip8_pak_entry_t;
+
+// Archive struct type thing
+typedef struct {
+  const uint8_t *map; // Whole file, read-only
+  size_t size;
+  uint32_t count;     // ROMs in the index
+} chip8_pak_t;
+
+// Map an archive and check its index, returns 1 on error
+int chip8_pak_open(chip8_pak_t *pak, const char *filename);
+
+// Unmap it, the images of its entries go with it
+void chip8_pak_close(chip8_pak_t *pak);
+
+// Entry number index (in name order)
+void chip8_pak_entry(const chip8_pak_t *pak, uint32_t index,
+                     chip8_pak_entry_t *entry);
+
+// Find a ROM by name (binary search of the index), returns 1 if not there
+int chip8_pak_find(const chip8_pak_t *pak, const char *name,
+                   chip8_pak_entry_t *entry);
+
+// Whether an entry's image is the font and its ROM with nothing else (the
+// index is checked when opening, the images are not read until used)
+int chip8_pak_entry_valid(const chip8_pak_entry_t *entry);
+
+// Write an archive of count ROMs (their hash is computed here), entries gets
+// sorted by name. Returns 1 on error (names too long or repeated too)
+int chip8_pak_save(const char *filename, chip8_pak_entry_t *entries,
+                   uint32_t count);
+
+// Split "ARCHIVE.c8pak:NAME" into the archive file name (into filename, size
+// bytes) and the ROM name, returns NULL if path is not one
+const char *chip8_pak_split(const char *path, char *filename, size_t size);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // !CHIP8_PAK
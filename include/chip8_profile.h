@@ -0,0 +1,118 @@
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <chip8.h>
+#include <stdint.h>
+
+/*
+Guest code profiler, counts the instructions run by opcode class and by
+address, plus the cycles spent blocked in Fx0A or the VBlank wait and the ones
+skipped in idle loops, to find the ROM idioms worth optimizing.
+While a profiler is attached (chip8_profile_attach) every sample_period-th
+chip8_run batch runs on the plain interpreter counting every instruction, the
+rest run on the attached engine as usual, so with a big enough period it can
+be left on. The counts are of the sampled batches only.
+*/
+
+// Opcode classes, the cases of chip8_decode_execute
+typedef enum {
+  CHIP8_OPCLASS_CLS,         // 00E0
+  CHIP8_OPCLASS_RET,         // 00EE
+  CHIP8_OPCLASS_SYS,         // 0nnn
+  CHIP8_OPCLASS_JP,          // 1nnn
+  CHIP8_OPCLASS_CALL,        // 2nnn
+  CHIP8_OPCLASS_SE_VX_BYTE,  // 3xkk
+  CHIP8_OPCLASS_SNE_VX_BYTE, // 4xkk
+  CHIP8_OPCLASS_SE_VX_VY,    // 5xy0
+  CHIP8_OPCLASS_LD_VX_BYTE,  // 6xkk
+  CHIP8_OPCLASS_ADD_VX_BYTE, // 7xkk
+  CHIP8_OPCLASS_LD_VX_VY,    // 8xy0
+  CHIP8_OPCLASS_OR,          // 8xy1
+  CHIP8_OPCLASS_AND,         // 8xy2
+  CHIP8_OPCLASS_XOR,         // 8xy3
+  CHIP8_OPCLASS_ADD_VX_VY,   // 8xy4
+  CHIP8_OPCLASS_SUB,         // 8xy5
+  CHIP8_OPCLASS_SHR,         // 8xy6
+  CHIP8_OPCLASS_SUBN,        // 8xy7
+  CHIP8_OPCLASS_SHL,         // 8xyE
+  CHIP8_OPCLASS_SNE_VX_VY,   // 9xy0
+  CHIP8_OPCLASS_LD_I_ADDR,   // Annn
+  CHIP8_OPCLASS_JP_V0,       // Bnnn
+  CHIP8_OPCLASS_RND,         // Cxkk
+  CHIP8_OPCLASS_DRW,         // Dxyn
+  CHIP8_OPCLASS_SKP,         // Ex9E
+  CHIP8_OPCLASS_SKNP,        // ExA1
+  CHIP8_OPCLASS_LD_VX_DT,    // Fx07
+  CHIP8_OPCLASS_LD_VX_K,     // Fx0A
+  CHIP8_OPCLASS_LD_DT_VX,    // Fx15
+  CHIP8_OPCLASS_LD_ST_VX,    // Fx18
+  CHIP8_OPCLASS_ADD_I_VX,    // Fx1E
+  CHIP8_OPCLASS_LD_F_VX,     // Fx29
+  CHIP8_OPCLASS_LD_B_VX,     // Fx33
+  CHIP8_OPCLASS_LD_I_VX,     // Fx55
+  CHIP8_OPCLASS_LD_VX_I,     // Fx65
+  CHIP8_OPCLASS_UNKNOWN,
+  CHIP8_OPCLASS_COUNT
+} chip8_opclass_t;
+
+// Profile struct type thing
+typedef struct chip8_profile {
+  uint8_t classes[UINT16_MAX + 1u];              // chip8_opclass_t of every opcode
+  uint64_t class_counts[CHIP8_OPCLASS_COUNT];    // Instructions run by class
+  uint64_t pc_counts[CHIP8_MEM_SIZE];            // Instructions run by address
+  uint64_t blocked_key;    // Cycles blocked in Fx0A
+  uint64_t blocked_vblank; // Cycles blocked in the VBlank wait of Dxyn
+  uint64_t idle;           // Cycles skipped in idle loops
+  uint32_t sample_period;  // Batches per sampled batch
+  uint32_t countdown;      // Batches left until the next sampled one
+  uint64_t batches;        // chip8_run batches while attached
+  uint64_t sampled;        // Batches sampled
+} chip8_profile_t;
+
+// Clear the counts, one of every sample_period batches gets profiled (1 for
+// all of them)
+void chip8_profile_initialize(chip8_profile_t *chip8_profile,
+                              uint32_t sample_period);
+
+// Start profiling chip8, NULL stops it, can be called between chip8_run calls
+void chip8_profile_attach(chip8_t *chip8, chip8_profile_t *chip8_profile);
+
+// Class of an opcode
+chip8_opclass_t chip8_profile_classify(uint16_t opcode);
+
+// Print the classes and the top addresses (with the opcodes in chip8 now) by
+// instructions run, sorted
+void chip8_profile_print(const chip8_profile_t *chip8_profile,
+                         const chip8_t *chip8, uint32_t top);
+
+// Save every count as tab separated "kind key count" lines (class NAME,
+// pc ADDRESS, blocked key|vblank, idle -), returns 1 on error
+int chip8_profile_save(const chip8_profile_t *chip8_profile,
+                       const char *filename);
+
+// Whether the next batch gets profiled (used by chip8_run)
+static inline int chip8_profile_sample(chip8_profile_t *chip8_profile) {
+  chip8_profile->batches++;
+  if (--chip8_profile->countdown)
+    return 0;
+  chip8_profile->countdown = chip8_profile->sample_period;
+  chip8_profile->sampled++;
+  return 1;
+}
+
+// Count an instruction (used by the execution engines)
+static inline void chip8_profile_instruction(chip8_profile_t *chip8_profile,
+                                             uint16_t pc, uint16_t opcode) {
+  chip8_profile->pc_counts[pc % CHIP8_MEM_SIZE]++;
+  chip8_profile->class_counts[chip8_profile->classes[opcode]]++;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // !CHIP8_PROFILE
@@ -0,0 +1,83 @@
+#ifndef CHIP8_REWIND
+#define CHIP8_REWIND
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <chip8.h>
+#include <chip8_snapshot.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Rewind history, one entry per captured frame. Each entry is the XOR of the
+state against the state of the frame before, run-length encoded (most frames
+only touch a few bytes), so going back a frame is XORing it into the current
+state. Every keyframe_interval frames a full snapshot is kept too, so going
+back many frames starts from the closest keyframe instead of undoing every
+frame. Deltas live in a byte ring, the oldest frames are dropped when it or
+the frame ring is full.
+*/
+
+// Frame entry
+typedef struct {
+  uint64_t start;    // Position of the delta in the byte ring (not wrapped)
+  uint32_t size;     // Bytes of the delta
+  uint32_t keyframe; // Keyframe number, CHIP8_REWIND_NO_KEYFRAME if none
+} chip8_rewind_frame_t;
+
+#define CHIP8_REWIND_NO_KEYFRAME UINT32_MAX
+
+// Rewind struct type thing
+typedef struct {
+  chip8_rewind_frame_t *frames; // Frame ring
+  uint32_t frame_capacity;
+  uint32_t frame_head;  // Oldest frame
+  uint32_t frame_count; // Frames held, the newest is the current state
+  uint8_t *data;        // Byte ring for the deltas
+  size_t data_size;
+  uint64_t data_tail;          // End of the newest delta (not wrapped)
+  chip8_snapshot_t *keyframes; // Keyframe ring
+  uint32_t keyframe_capacity;
+  uint32_t keyframe_interval; // Frames between keyframes
+  uint32_t next_keyframe;     // Number of the next keyframe
+  uint32_t since_keyframe;    // Frames captured since the last keyframe
+  chip8_snapshot_t states[2]; // Newest state and scratch
+  uint8_t current;            // Which of states is the newest
+  // Stats
+  uint64_t captures;
+  double capture_seconds;     // Time spent capturing, total
+  double capture_max_seconds; // Slowest capture
+} chip8_rewind_t;
+
+// Initialize the history for up to frames frames with a keyframe every
+// keyframe_interval frames and data_size bytes of deltas, returns 1 on error
+int chip8_rewind_initialize(chip8_rewind_t *chip8_rewind, uint32_t frames,
+                            uint32_t keyframe_interval, size_t data_size);
+
+// Free the history
+void chip8_rewind_destroy(chip8_rewind_t *chip8_rewind);
+
+// Drop every frame
+void chip8_rewind_clear(chip8_rewind_t *chip8_rewind);
+
+// Add the state of chip8 at the end of a frame
+void chip8_rewind_capture(chip8_rewind_t *chip8_rewind, const chip8_t *chip8);
+
+// Go back frames frames, dropping them, and put chip8 in that state, returns
+// the frames it went back (less if the history is shorter)
+uint32_t chip8_rewind_step_back(chip8_rewind_t *chip8_rewind, chip8_t *chip8,
+                                uint32_t frames);
+
+// Bytes used by the frames held (deltas plus keyframes)
+size_t chip8_rewind_memory(const chip8_rewind_t *chip8_rewind);
+
+// Print frames held, memory and capture times
+void chip8_rewind_print_stats(const chip8_rewind_t *chip8_rewind);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // !CHIP8_REWIND
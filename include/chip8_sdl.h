@@ -8,18 +8,79 @@ extern "C" {
 
 #include <SDL2/SDL.h>
 #include <chip8.h>
+#include <chip8_movie.h>
+#include <chip8_rewind.h>
+#include <chip8_sdl_audio.h>
 
 /*
 So, here is the SDL backend for the chip8 emulator
 TODO: add usage details
 */
 
+// Milliseconds before a deadline spent spinning instead of sleeping
+#define CHIP8_SDL_SPIN_MS 2u
+
+// Milliseconds between the slices the current 60 Hz frame is run in, about
+// the longest a key event waits to be applied
+#define CHIP8_SDL_SLICE_MS 1u
+
+// A present this many milliseconds after its deadline counts as late
+#define CHIP8_SDL_LATE_MS 1.0
+
+// Most 60 Hz frames run back to back to catch up after a stall
+#define CHIP8_SDL_MAX_CATCH_UP 4u
+
+// Marks the frame in chip8_sdl_t.middle as not taken by the render thread yet
+#define CHIP8_SDL_FRESH 4
+
+// Key events the render thread can queue ahead of the emulation thread
+#define CHIP8_SDL_KEY_RING_SIZE 256u
+
+// Key event handed to the emulation thread
+typedef struct {
+  uint64_t time;   // Performance counter when it happened
+  uint8_t key;
+  uint8_t pressed;
+} chip8_sdl_key_t;
+
+// Frame pacing stats of chip8_sdl_run
+typedef struct {
+  uint32_t target_fps;
+  uint64_t frames;          // Frames presented on the schedule
+  uint64_t late_frames;     // Presents later than CHIP8_SDL_LATE_MS
+  double frame_seconds;     // Time between presents, total
+  double frame_seconds_sq;  // Same squared, for the jitter
+  double min_frame_seconds;
+  double max_frame_seconds;
+  uint64_t ticks;           // 60 Hz frames run (timer ticks), by the emulation thread
+  double seconds;           // Time running
+} chip8_sdl_pacing_t;
+
 // SDL struct type thing
 typedef struct {
   SDL_Window *window;
   SDL_Renderer *renderer;
+  SDL_Texture *texture; // Streaming texture, one texel per pixel
   SDL_Color background_color;
   SDL_Color foreground_color;
+  chip8_display_t shown;  // Display as last presented
+  uint32_t lut[256][8];   // Display byte to its 8 texels (ARGB8888)
+  uint32_t texels[CHIP8_DISPLAY_HEIGHT][CHIP8_DISPLAY_WIDTH]; // Texture contents
+  chip8_rewind_t *rewind; // History for holding Backspace (NULL disables it)
+  chip8_movie_t *movie;   // Movie to record or replay (NULL if none)
+  chip8_sdl_audio_t *audio; // Buzzer (NULL for no sound)
+  uint8_t movie_replay;   // Replay movie as fast as possible, ignoring the keys
+  chip8_sdl_pacing_t pacing; // Stats of the last chip8_sdl_run
+  // Shared by the render and emulation threads of chip8_sdl_run
+  chip8_display_t frames[3]; // Triple buffer of finished frames
+  SDL_atomic_t middle;       // Frame handed over, plus CHIP8_SDL_FRESH
+  chip8_sdl_key_t key_ring[CHIP8_SDL_KEY_RING_SIZE]; // Timestamped key events
+  SDL_atomic_t key_head;     // Next key event to write
+  SDL_atomic_t key_tail;     // Next key event to read
+  uint32_t keys_dropped;     // Key events lost to a full ring
+  SDL_atomic_t rewinding;    // Backspace held
+  SDL_atomic_t quit;         // Tells the emulation thread to stop
+  SDL_atomic_t done;         // The emulation thread stopped (end of a replay)
 } chip8_sdl_t;
 
 // Initialize SDL, returns 1 on error
@@ -28,12 +89,22 @@ int chip8_sdl_initialize(chip8_sdl_t *chip8_sdl, char *window_name, uint32_t ren
 // Destroy SDL
 void chip8_sdl_destroy(chip8_sdl_t *chip8_sdl);
 
-// Draw the chip8 display
+// Draw the chip8 display and present it
 void chip8_sdl_draw_display(const chip8_display_t *display, void *sdl_context);
 
-// Run the SDL Loop
+// Run the SDL Loop, cycles_per_frame instructions per 60 Hz frame (timers
+// tick once per frame) whatever target_fps is, presenting at target_fps.
+// chip8 runs on its own thread, finished frames go through a triple buffer
+// and timestamped key events through a ring, so neither thread ever waits for
+// the other. The current frame is run in slices as the time goes by, key
+// events are applied at the instruction of the frame matching when they
+// happened and what they draw is handed over without waiting for the frame
+// to end
 void chip8_sdl_run(chip8_t *chip8, chip8_sdl_t *chip8_sdl, uint32_t cycles_per_frame, uint32_t target_fps);
 
+// Print the frame pacing stats of the last run
+void chip8_sdl_print_pacing(const chip8_sdl_t *chip8_sdl);
+
 #ifndef NDEBUG
 void chip8_sdl_test(chip8_sdl_t *chip8_sdl);
 #endif
@@ -0,0 +1,82 @@
+#ifndef CHIP8_SDL_AUDIO
+#define CHIP8_SDL_AUDIO
+
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <SDL2/SDL.h>
+
+/*
+Buzzer for the SDL backend, a square wave played while ST is not 0.
+The emulation thread pushes the ST on/off transitions, timestamped in emulated
+time (samples since the start, 60 Hz frames are samples_per_frame long), into
+a lock-free ring, and the audio callback plays them a fixed latency behind the
+emulation. Neither side ever waits for the other, the buzzer fades in and out
+over a couple of milliseconds so starting and stopping never clicks.
+*/
+
+// Audio settings asked for (SDL may give others)
+#define CHIP8_SDL_AUDIO_FREQUENCY 48000
+#define CHIP8_SDL_AUDIO_SAMPLES 256u // Samples per callback
+#define CHIP8_SDL_AUDIO_TONE_HZ 440u
+#define CHIP8_SDL_AUDIO_VOLUME 0.2f
+#define CHIP8_SDL_AUDIO_FADE_MS 2u
+
+// Transitions the ring holds (power of 2), when full new ones are dropped
+#define CHIP8_SDL_AUDIO_RING_SIZE 256u
+
+// ST transition
+typedef struct {
+  uint32_t time; // Emulated time, in samples
+  uint8_t on;
+} chip8_sdl_audio_transition_t;
+
+// SDL audio struct type thing
+typedef struct {
+  SDL_AudioDeviceID device;
+  uint32_t frequency;         // Samples per second
+  uint32_t samples;           // Samples per callback
+  uint32_t samples_per_frame; // Samples per 60 Hz frame
+  uint32_t latency;           // Samples the callback plays behind the emulation
+  // Written by the emulation thread, read by the callback
+  chip8_sdl_audio_transition_t ring[CHIP8_SDL_AUDIO_RING_SIZE];
+  SDL_atomic_t head;     // Next transition to write
+  SDL_atomic_t tail;     // Next transition to read
+  SDL_atomic_t emulated; // Emulated time reached
+  uint32_t dropped;      // Transitions lost to a full ring
+  // Callback state
+  uint8_t started;       // The cursor follows the emulation
+  uint8_t on;            // Buzzer state at the cursor
+  uint32_t cursor;       // Emulated time being played
+  float gain;            // Fades towards on
+  uint32_t phase;        // Square wave phase, 32-bit fixed point
+  uint32_t phase_step;
+  uint32_t callbacks;
+  uint32_t underruns;    // Callbacks that got ahead of the emulation
+  uint32_t resyncs;      // Times the cursor was put back behind the emulation
+} chip8_sdl_audio_t;
+
+// Open the audio device and start it, returns 1 on error
+int chip8_sdl_audio_initialize(chip8_sdl_audio_t *chip8_sdl_audio);
+
+// Close the audio device
+void chip8_sdl_audio_destroy(chip8_sdl_audio_t *chip8_sdl_audio);
+
+// Queue an ST transition at time (emulation thread)
+void chip8_sdl_audio_push(chip8_sdl_audio_t *chip8_sdl_audio, uint32_t time,
+                          uint8_t on);
+
+// Let the callback know the emulation reached time (emulation thread)
+void chip8_sdl_audio_advance(chip8_sdl_audio_t *chip8_sdl_audio,
+                             uint32_t time);
+
+// Print buffer size, latency, underruns and dropped transitions
+void chip8_sdl_audio_print_stats(const chip8_sdl_audio_t *chip8_sdl_audio);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // !CHIP8_SDL_AUDIO
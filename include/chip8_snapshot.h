@@ -0,0 +1,109 @@
+#ifndef CHIP8_SNAPSHOT
+#define CHIP8_SNAPSHOT
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <chip8.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Savestates, in two forms:
+- chip8_snapshot_t, a plain copy of the machine state in memory. Taking and
+  restoring one are a few memcpy, meant for rewind, fuzzing and anything else
+  that restores a lot.
+- The on-disk form written by chip8_snapshot_save, versioned and
+  little-endian. Memory is stored as the runs that differ from the boot image
+  (zeros, font and ROM), so the same ROM has to be given to load it back.
+
+On-disk format, version 2 (version 1 had no RNG state, the memory runs started
+at 347):
+  offset  size  field
+  0       4     magic "CH8S"
+  4       2     version
+  6       1     quirks
+  7       1     SP
+  8       2     PC
+  10      2     I
+  12      16    V0 to VF
+  28      32    stack, 16 entries of 2 bytes
+  60      1     DT
+  61      1     ST
+  62      2     keys, bit n is key n
+  64      2     previous keys (for CHIP8_FX0A_RELEASE)
+  66      1     vblank_ready
+  67      8     cycles
+  75      8     idle cycles
+  83      8     boot image hash (64-bit FNV-1a)
+  91      256   display
+  347     4     built-in RNG state
+  351     2     number of memory runs
+  353     ...   memory runs: 2 bytes address, 2 bytes length, then the bytes
+*/
+
+// On-disk format version
+#define CHIP8_SNAPSHOT_VERSION 2u
+
+// Size of the on-disk snapshot without the memory runs
+#define CHIP8_SNAPSHOT_HEADER_SIZE 353u
+
+// Biggest on-disk snapshot (a single run with the whole memory)
+#define CHIP8_SNAPSHOT_MAX_SIZE (CHIP8_SNAPSHOT_HEADER_SIZE + 4u + CHIP8_MEM_SIZE)
+
+// Snapshot struct type thing
+typedef struct {
+  uint16_t PC;
+  uint8_t SP;
+  uint16_t stack[CHIP8_STACK_SIZE];
+  uint8_t V[16];
+  uint16_t I;
+  uint8_t DT;
+  uint8_t ST;
+  uint8_t memory[CHIP8_MEM_SIZE];
+  chip8_display_t display;
+  uint16_t keys;          // Bit n is key n
+  uint16_t previous_keys; // Only used with CHIP8_FX0A_RELEASE
+  uint8_t quirks;
+  uint8_t vblank_ready;
+  uint64_t cycles;
+  uint64_t idle_cycles;
+  uint32_t rand_state;
+} chip8_snapshot_t;
+
+// Copy the state of chip8 into snapshot
+void chip8_snapshot_take(const chip8_t *chip8, chip8_snapshot_t *snapshot);
+
+// Put chip8 back in the snapshot state, the interface, engines and attached
+// caches are kept (the caches are only flushed if memory or quirks changed),
+// queued events are dropped
+void chip8_snapshot_restore(chip8_t *chip8, const chip8_snapshot_t *snapshot);
+
+// Write chip8 in the on-disk form into buffer, rom is the ROM it was booted
+// with (NULL if none), returns the bytes written or 0 if it does not fit
+// (CHIP8_SNAPSHOT_MAX_SIZE always fits)
+size_t chip8_snapshot_save(const chip8_t *chip8, const uint8_t *rom,
+                           uint16_t rom_size, uint8_t *buffer, size_t size);
+
+// Load an on-disk snapshot into chip8, rom has to be the same ROM it was saved
+// with, returns 1 on error (chip8 is left untouched)
+int chip8_snapshot_load(chip8_t *chip8, const uint8_t *rom, uint16_t rom_size,
+                        const uint8_t *buffer, size_t size);
+
+// Hash of the boot image (zeros, font and rom), to tell ROMs apart
+uint64_t chip8_snapshot_boot_hash(const uint8_t *rom, uint16_t rom_size);
+
+// Save an on-disk snapshot to a file, returns 1 on error
+int chip8_snapshot_save_to_file(const chip8_t *chip8, const uint8_t *rom,
+                                uint16_t rom_size, const char *filename);
+
+// Load an on-disk snapshot from a file, returns 1 on error
+int chip8_snapshot_load_from_file(chip8_t *chip8, const uint8_t *rom,
+                                  uint16_t rom_size, const char *filename);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // !CHIP8_SNAPSHOT
@@ -0,0 +1,123 @@
+#ifndef CHIP8_TRACE
+#define CHIP8_TRACE
+
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+#include <chip8.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+Instruction tracer, replaces printing the registers on every instruction.
+While a tracer is attached (chip8_trace_attach) chip8_run runs the plain
+interpreter and writes a fixed-size binary record per instruction into a
+lock-free ring, a thread of the tracer writes the ring to the file in big
+chunks. When the ring is full the emulation waits for the writer, so the trace
+has every instruction. Not attached it costs one check per chip8_run.
+Idle loops and blocked instructions are still skipped (see chip8_run), the
+skipped instructions show up as a gap in the cycles. tools/ch8trace prints a
+trace.
+
+File format, version 1 (little-endian):
+  offset  size  field
+  0       4     magic "CH8T"
+  4       2     version
+  6       2     record size (32)
+  8       ...   records (chip8_trace_decode reads one):
+    0     8     cycle
+    8     2     PC
+    10    2     opcode
+    12    2     changed
+    14    2     I
+    16    16    V0 to VF
+*/
+
+// File format version
+#define CHIP8_TRACE_VERSION 1u
+
+// Size of the file without the records
+#define CHIP8_TRACE_HEADER_SIZE 8u
+
+// Size of a record in the file
+#define CHIP8_TRACE_RECORD_SIZE 32u
+
+// Records the ring holds (power of 2)
+#define CHIP8_TRACE_RING_SIZE 65536u
+
+// Record of an instruction, with the registers after it ran
+typedef struct {
+  uint64_t cycle;   // chip8->cycles when it started
+  uint16_t PC;      // Address of the instruction
+  uint16_t opcode;
+  uint16_t changed; // V registers it changed, bit n is Vn
+  uint16_t I;
+  uint8_t V[16];
+} chip8_trace_record_t;
+
+// Trace struct type thing
+typedef struct chip8_trace {
+  chip8_trace_record_t *ring;
+  // Written by the emulation, read by the writer thread
+  uint32_t head; // Next record to write
+  uint32_t tail; // Next record to flush
+  uint8_t stop;  // Tells the writer to flush what is left and quit
+  FILE *fd;
+  pthread_t writer;
+  uint64_t records; // Records written to the file
+  uint64_t stalls;  // Times the emulation waited for the writer
+  uint8_t error;    // Writing the file failed, the rest is dropped
+} chip8_trace_t;
+
+// Open the trace file and start the writer thread, returns 1 on error
+int chip8_trace_initialize(chip8_trace_t *chip8_trace, const char *filename);
+
+// Flush what is left, stop the writer and close the file (detach it first)
+void chip8_trace_destroy(chip8_trace_t *chip8_trace);
+
+// Start tracing chip8 into chip8_trace, NULL stops it, can be called between
+// chip8_run calls
+void chip8_trace_attach(chip8_t *chip8, chip8_trace_t *chip8_trace);
+
+// Print the records written and the times the emulation had to wait
+void chip8_trace_print_stats(const chip8_trace_t *chip8_trace);
+
+// Read a record of the file (CHIP8_TRACE_RECORD_SIZE bytes)
+void chip8_trace_decode(const uint8_t *data, chip8_trace_record_t *record);
+
+// Wait for room in the ring (used by chip8_trace_instruction)
+void chip8_trace_wait(chip8_trace_t *chip8_trace);
+
+// Record an instruction that already ran, V_before are the V registers before
+// it ran (used by the execution engines)
+static inline void chip8_trace_instruction(chip8_trace_t *chip8_trace,
+                                           const chip8_t *chip8,
+                                           uint64_t cycle, uint16_t pc,
+                                           uint16_t opcode,
+                                           const uint8_t *V_before) {
+  uint32_t head = chip8_trace->head;
+  if (head - __atomic_load_n(&chip8_trace->tail, __ATOMIC_ACQUIRE) >=
+      CHIP8_TRACE_RING_SIZE)
+    chip8_trace_wait(chip8_trace);
+  chip8_trace_record_t *record =
+      &chip8_trace->ring[head % CHIP8_TRACE_RING_SIZE];
+  record->cycle = cycle;
+  record->PC = pc;
+  record->opcode = opcode;
+  record->I = chip8->I;
+  uint16_t changed = 0;
+  for (uint8_t i = 0; i < 16; i++)
+    changed |= (uint16_t)((chip8->V[i] != V_before[i]) << i);
+  record->changed = changed;
+  memcpy(record->V, chip8->V, sizeof(record->V));
+  __atomic_store_n(&chip8_trace->head, head + 1u, __ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // !CHIP8_TRACE
@@ -1,28 +1,69 @@
+#define _POSIX_C_SOURCE 200809L // getopt
 #include <chip8.h>
+#include <chip8_headless.h>
+#include <chip8_jit.h>
+#include <chip8_movie.h>
+#include <chip8_pak.h>
+#include <chip8_profile.h>
+#include <chip8_rewind.h>
+#include <chip8_snapshot.h>
+#include <chip8_trace.h>
+#ifndef CHIP8_NO_SDL
 #include <chip8_sdl.h>
+#endif // CHIP8_NO_SDL
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <unistd.h>
 
-uint8_t uint8_rand(void);
+// Max number of frames given to -H
+#define MAX_HASH_FRAMES 64u
+
 void print_usage(void);
+#ifndef CHIP8_NO_SDL
 int parse_color(const char *str, SDL_Color *color);
+#endif // CHIP8_NO_SDL
+int parse_frames(const char *str, uint32_t *frames, uint32_t *count);
 
 int main(int argc, char *argv[]) {
   // Some variables
   typedef enum { NONE, SDL } Backend;
+#ifndef CHIP8_NO_SDL
   Backend backend = SDL;
+#else
+  Backend backend = NONE;
+#endif // CHIP8_NO_SDL
+  typedef enum { INTERP, PREDECODE, FUSED, JIT } Engine;
+  Engine engine = INTERP;
   uint32_t cycles_per_frame = 20;
   uint32_t render_scale = 16;
   uint32_t target_fps = 60;
+  uint8_t quirks = CHIP8_DEFAULT_PROFILE;
+  uint8_t profile_given = 0;
+  uint32_t frames = 600;
+  uint32_t hash_frames[MAX_HASH_FRAMES];
+  uint32_t hash_frame_count = 0;
+  const char *load_state = NULL;
+  uint32_t rewind_seconds = 10;
+  uint8_t sound = 1;
+  uint32_t seed = (uint32_t)time(NULL);
+  const char *record_movie = NULL;
+  const char *replay_movie = NULL;
+  const char *save_state = NULL;
+  const char *trace_file = NULL;
+  const char *profile_file = NULL;
+  uint32_t profile_period = 1;
+#ifndef CHIP8_NO_SDL
   SDL_Color fg_color = {255, 0x68, 0x0E, 255};
   SDL_Color bg_color = {255, 0xFF, 0x6E, 0x28};
+#endif // CHIP8_NO_SDL
 
   // Parse options
   int opt;
-  while ((opt = getopt(argc, argv, "hc:b:f:s:F:G:")) != -1) {
+  while ((opt = getopt(argc, argv, "hqc:b:e:f:l:m:n:p:r:s:t:w:F:G:H:M:P:R:S:")) != -1) {
     switch (opt) {
     case 'h':
       print_usage();
@@ -36,32 +77,108 @@ int main(int argc, char *argv[]) {
     case 'b':
       if (strcasecmp(optarg, "none") == 0)
         backend = NONE;
-      else if (strcasecmp(optarg, "sdl") == 0)
+      else if (strcasecmp(optarg, "sdl") == 0) {
+#ifndef CHIP8_NO_SDL
         backend = SDL;
-      else {
+#else
+        fprintf(stderr, "Built without SDL\n");
+        return 1;
+#endif // CHIP8_NO_SDL
+      } else {
         fprintf(stderr, "Unknown backend: %s\n", optarg);
         print_usage();
         return 1;
       }
       break;
+    case 'e':
+      if (strcasecmp(optarg, "interp") == 0)
+        engine = INTERP;
+      else if (strcasecmp(optarg, "predecode") == 0)
+        engine = PREDECODE;
+      else if (strcasecmp(optarg, "fused") == 0)
+        engine = FUSED;
+      else if (strcasecmp(optarg, "jit") == 0)
+        engine = JIT;
+      else {
+        fprintf(stderr, "Unknown engine: %s\n", optarg);
+        print_usage();
+        return 1;
+      }
+      break;
     case 'f':
       if (!(target_fps = (uint32_t)atoi(optarg))) {
         printf("Cannot be 0\n");
         return 1;
       }
       break;
+    case 'l':
+      load_state = optarg;
+      break;
+    case 'm':
+      record_movie = optarg;
+      break;
+    case 'n':
+      if (!(frames = (uint32_t)atoi(optarg))) {
+        printf("Cannot be 0\n");
+        return 1;
+      }
+      break;
+    case 'p':
+      if (chip8_parse_profile(optarg, &quirks)) {
+        fprintf(stderr, "Unknown profile: %s\n", optarg);
+        print_usage();
+        return 1;
+      }
+      profile_given = 1;
+      break;
+    case 'q':
+      sound = 0;
+      break;
+    case 'r':
+      rewind_seconds = (uint32_t)atoi(optarg);
+      break;
     case 's':
       if (!(render_scale = (uint32_t)atoi(optarg))) {
         printf("Cannot be 0\n");
         return 1;
       }
       break;
+    case 't':
+      trace_file = optarg;
+      break;
+    case 'P':
+      profile_file = optarg;
+      break;
+    case 'S':
+      if (!(profile_period = (uint32_t)atoi(optarg))) {
+        printf("Cannot be 0\n");
+        return 1;
+      }
+      break;
+    case 'w':
+      save_state = optarg;
+      break;
+#ifndef CHIP8_NO_SDL
     case 'F':
       parse_color(optarg, &fg_color);
       break;
     case 'G':
       parse_color(optarg, &bg_color);
       break;
+#endif // CHIP8_NO_SDL
+    case 'M':
+      replay_movie = optarg;
+      break;
+    case 'R':
+      seed = (uint32_t)strtoul(optarg, NULL, 0);
+      break;
+    case 'H':
+      if (parse_frames(optarg, hash_frames, &hash_frame_count)) {
+        fprintf(stderr, "Bad frame list: %s\n", optarg);
+        print_usage();
+        return 1;
+      }
+      break;
     default:
       print_usage();
       return 1;
@@ -73,7 +190,47 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  // ROM from an archive, run from its mapping with its suggested profile
+  chip8_pak_t pak;
+  chip8_pak_entry_t pak_entry;
+  char pak_file[4096];
+  const char *pak_rom =
+      chip8_pak_split(argv[optind], pak_file, sizeof(pak_file));
+  if (pak_rom) {
+    if (chip8_pak_open(&pak, pak_file))
+      return 1;
+    if (chip8_pak_find(&pak, pak_rom, &pak_entry)) {
+      printf("Pak Error: no ROM %s in %s\n", pak_rom, pak_file);
+      chip8_pak_close(&pak);
+      return 1;
+    }
+    if (!profile_given && (pak_entry.flags & CHIP8_PAK_HAS_PROFILE))
+      quirks = pak_entry.quirks;
+  }
+
+  // A movie has what the run depends on, and starts from a fresh boot
+  chip8_movie_t chip8_movie;
+  chip8_movie_t *movie = NULL;
+  if ((record_movie || replay_movie) && load_state) {
+    printf("Error: movies start from boot, -l cannot be used with them\n");
+    return 1;
+  }
+  if (replay_movie) {
+    if (chip8_movie_load(&chip8_movie, replay_movie))
+      return 1;
+    movie = &chip8_movie;
+    seed = chip8_movie.seed;
+    quirks = chip8_movie.quirks;
+    cycles_per_frame = chip8_movie.cycles_per_frame;
+    frames = chip8_movie.frames;
+    rewind_seconds = 0;
+  } else if (record_movie) {
+    movie = &chip8_movie;
+    rewind_seconds = 0; // Going back would not be in the movie
+  }
+
   // Initialize chip8_sdl
+#ifndef CHIP8_NO_SDL
   chip8_sdl_t chip8_sdl;
   if (backend == SDL) {
     if (chip8_sdl_initialize(&chip8_sdl, argv[argc - 1], render_scale, bg_color,
@@ -83,36 +240,148 @@ int main(int argc, char *argv[]) {
     // chip8_sdl_test(&chip8_sdl);
 #endif
   }
+#else
+  (void)render_scale;
+  (void)target_fps;
+  (void)rewind_seconds;
+  (void)sound;
+#endif // CHIP8_NO_SDL
 
   // Setup chip8 interface
-  srand((unsigned int)time(NULL)); // Seeding random number generator
-  chip8_interface_t chip8_interface = {.rand = uint8_rand};
-  if (backend == SDL) {
-#ifdef CHIP8_USE_DRAW_CALLBACK
-    chip8_interface.draw_display = chip8_sdl_draw_display;
-    chip8_interface.user_data = &chip8_sdl;
-#endif /* ifdef CHIP8_USE_DRAW_CALLBACK */
-  }
+  // The built-in RNG does rand, and the SDL loop presents once per frame when
+  // the display changed instead of using the draw callback
+  chip8_interface_t chip8_interface = {0};
 
   // Initialize chip8 core
   chip8_t chip8;
   chip8_initialize(&chip8, chip8_interface);
-  if (chip8_load_rom_from_file(&chip8, argv[optind])) {
+  chip8_set_quirks(&chip8, quirks);
+  chip8_seed_rand(&chip8, seed);
+  static chip8_predecode_t predecode; // Too big for the stack
+  if (engine == PREDECODE || engine == FUSED)
+    chip8_predecode_attach(&chip8, &predecode);
+  if (engine == FUSED)
+    chip8_predecode_set_fusion(&chip8, 1);
+  static chip8_jit_t jit; // Too big for the stack
+  if (engine == JIT) {
+    if (chip8_jit_initialize(&jit))
+      return 1;
+    chip8_jit_attach(&chip8, &jit);
+  }
+  if (pak_rom) {
+    chip8_load_image(&chip8, pak_entry.image);
+  } else if (chip8_load_rom_from_file(&chip8, argv[optind])) {
     return 1;
   }
+  // Snapshots are stored against the ROM as loaded
+  static uint8_t rom[CHIP8_MEM_SIZE - 0x200];
+  memcpy(rom, &chip8.memory[0x200], sizeof(rom));
+  if (load_state && chip8_snapshot_load_from_file(&chip8, rom, sizeof(rom),
+                                                  load_state))
+    return 1;
+  uint64_t boot_hash = chip8_snapshot_boot_hash(rom, sizeof(rom));
+  if (replay_movie && boot_hash != chip8_movie.boot_hash) {
+    printf("Movie Error: recorded with another ROM\n");
+    return 1;
+  }
+  if (record_movie && chip8_movie_initialize(&chip8_movie, seed, quirks,
+                                             cycles_per_frame, boot_hash))
+    return 1;
+  static chip8_profile_t profile; // Too big for the stack
+  if (profile_file) {
+    chip8_profile_initialize(&profile, profile_period);
+    chip8_profile_attach(&chip8, &profile);
+  }
+  chip8_trace_t chip8_trace;
+  if (trace_file) {
+    if (chip8_trace_initialize(&chip8_trace, trace_file))
+      return 1;
+    chip8_trace_attach(&chip8, &chip8_trace);
+  }
 
   // Enter SDL Loop
+#ifndef CHIP8_NO_SDL
+  chip8_rewind_t chip8_rewind;
+  if (backend == SDL && rewind_seconds) {
+    // A keyframe a second, deltas are mostly well under 1 KB
+    uint32_t rewind_frames = rewind_seconds * CHIP8_TIMER_HZ;
+    if (chip8_rewind_initialize(&chip8_rewind, rewind_frames, CHIP8_TIMER_HZ,
+                                (size_t)rewind_frames * 1024u))
+      return 1;
+    chip8_sdl.rewind = &chip8_rewind;
+  }
+  // A replay runs uncapped, it would not sound like anything
+  chip8_sdl_audio_t chip8_sdl_audio;
+  if (backend == SDL && sound && !replay_movie &&
+      !chip8_sdl_audio_initialize(&chip8_sdl_audio))
+    chip8_sdl.audio = &chip8_sdl_audio;
   if (backend == SDL) {
+    chip8_sdl.movie = movie;
+    chip8_sdl.movie_replay = replay_movie != NULL;
     chip8_sdl_run(&chip8, &chip8_sdl, cycles_per_frame, target_fps);
   }
+#endif // CHIP8_NO_SDL
+
+  // Or run headless
+  if (backend == NONE) {
+    chip8_headless_t chip8_headless;
+    chip8_headless_initialize(&chip8_headless, frames, cycles_per_frame);
+    chip8_headless.hash_frames = hash_frames;
+    chip8_headless.hash_frame_count = hash_frame_count;
+    chip8_headless.movie = movie;
+    chip8_headless.movie_replay = replay_movie != NULL;
+    chip8_headless_run(&chip8, &chip8_headless);
+  }
+
+  if (trace_file) {
+    chip8_trace_attach(&chip8, NULL);
+    chip8_trace_destroy(&chip8_trace);
+    chip8_trace_print_stats(&chip8_trace);
+  }
+  if (profile_file) {
+    chip8_profile_attach(&chip8, NULL);
+    chip8_profile_print(&profile, &chip8, 16);
+    chip8_profile_save(&profile, profile_file);
+  }
+  if (save_state)
+    chip8_snapshot_save_to_file(&chip8, rom, sizeof(rom), save_state);
+  int status = 0;
+  if (record_movie)
+    status = chip8_movie_save(&chip8_movie, record_movie);
+  if (replay_movie)
+    status = chip8_movie_check(&chip8_movie, &chip8);
+  if (movie)
+    chip8_movie_destroy(&chip8_movie);
 
   // Clean up stuff
+#ifndef CHIP8_NO_SDL
   if (backend == SDL) {
+    if (chip8_sdl.audio) {
+      chip8_sdl_audio_destroy(&chip8_sdl_audio);
+      chip8_sdl_audio_print_stats(&chip8_sdl_audio);
+    }
     chip8_sdl_destroy(&chip8_sdl);
+    chip8_sdl_print_pacing(&chip8_sdl);
+    if (rewind_seconds) {
+      chip8_rewind_print_stats(&chip8_rewind);
+      chip8_rewind_destroy(&chip8_rewind);
+    }
   }
-  return 0;
+#endif // CHIP8_NO_SDL
+  if (engine == JIT)
+    chip8_jit_destroy(&jit);
+  if (engine == FUSED)
+    chip8_predecode_print_fusion(&chip8);
+  printf("Idle loops skipped %llu of %llu cycles\n",
+         (unsigned long long)chip8.idle_cycles,
+         (unsigned long long)chip8.cycles);
+  chip8_destroy(&chip8);
+  if (pak_rom)
+    chip8_pak_close(&pak);
+  return status;
 }
 
+#ifndef CHIP8_NO_SDL
 // Parses "R,G,B" into SDL_Color
 int parse_color(const char *str, SDL_Color *color) {
   unsigned int r, g, b;
@@ -124,17 +393,64 @@ int parse_color(const char *str, SDL_Color *color) {
   color->a = 255;
   return 0;
 }
+#endif // CHIP8_NO_SDL
+
+// Parses "N,N,..." (ascending frame numbers) into frames
+int parse_frames(const char *str, uint32_t *frames, uint32_t *count) {
+  *count = 0;
+  while (*str) {
+    char *end;
+    unsigned long frame = strtoul(str, &end, 10);
+    if (end == str || frame == 0 || frame > UINT32_MAX ||
+        *count == MAX_HASH_FRAMES || (*count && frame <= frames[*count - 1]))
+      return -1;
+    frames[(*count)++] = (uint32_t)frame;
+    if (*end == ',')
+      end++;
+    else if (*end != '\0')
+      return -1;
+    str = end;
+  }
+  return *count ? 0 : -1;
+}
 
 void print_usage(void) {
   printf("Usage: ch8run [OPTION]... [ROMFILE]\n\n");
+  printf("ROMFILE can be ARCHIVE.c8pak:NAME, a ROM in an archive built by\n");
+  printf("ch8pak (its suggested profile is used unless -p is given)\n\n");
   printf("Options:\n");
   printf("  -h         display this help\n");
-  printf("  -c NUM     number of cycles per frame (default: 20)\n");
+  printf("  -c NUM     number of cycles per 60 Hz frame (default: 20)\n");
   printf("  -b BACKEND choose backend (none, SDL) (default: SDL)\n");
-  printf("  -f FPS     target frames per second (default: 60)\n");
+  printf("             none runs headless as fast as possible\n");
+  printf("  -e ENGINE  execution engine (interp, predecode, fused, jit)\n");
+  printf("             (default: interp)\n");
+  printf("  -f FPS     frames presented per second, the emulation and timers\n");
+  printf("             always run at 60 Hz (default: 60)\n");
+  printf("  -l FILE    resume from a snapshot saved with -w\n");
+  printf("  -m FILE    record the keys into a movie\n");
+  printf("  -M FILE    replay a movie as fast as possible and check its final\n");
+  printf("             display hash (its profile, cycles and seed are used)\n");
+  printf("  -n NUM     number of frames to run headless (default: 600)\n");
+  printf("  -H N,N,... print the display hash at these frames when headless\n");
+  printf("             (default: at exit)\n");
+  printf("  -p PROFILE quirk profile (vip, modern, timendous or a quirk bitmask)\n");
+  printf("  -q         no sound\n");
+  printf("  -P FILE    profile the guest code, print the hottest opcodes and\n");
+  printf("             addresses at exit and save all the counts into a file\n");
+  printf("  -S NUM     profile one of every NUM batches of instructions, the\n");
+  printf("             rest run on the engine (default: 1)\n");
+  printf("  -R SEED    seed of the random numbers (default: the time)\n");
+  printf("  -r SECONDS rewind history, hold Backspace to go back (default: 10)\n");
+  printf("             0 disables it\n");
   printf("  -s SCALE   render scale (default: 16)\n");
+  printf("  -t FILE    trace every instruction into a file (see ch8trace),\n");
+  printf("             runs the plain interpreter\n");
+  printf("  -w FILE    save a snapshot at exit\n");
   printf("  -F R,G,B   foreground color (default: 104,14,13)\n");
   printf("  -G R,G,B   background color (default: 255,110,40)\n");
+  printf("\nQuirk bitmask:\n");
+  printf("  0x01 VF reset, 0x02 memory increment, 0x04 clip, 0x08 wait vblank,\n");
+  printf("  0x10 shift Vx only, 0x20 jump uses Vx\n");
 }
 
-uint8_t uint8_rand(void) { return (uint8_t)(rand() & 0xFF); }
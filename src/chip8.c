@@ -1,32 +1,52 @@
+#define _POSIX_C_SOURCE 200809L // strcasecmp
 #include <assert.h>
 #include <chip8.h>
+#include <chip8_jit.h>
+#include <chip8_profile.h>
+#include <chip8_trace.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 
-static inline void load_font(chip8_t *chip8) {
-  uint8_t fontset[16 * 5] = {
-      0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-      0x20, 0x60, 0x20, 0x20, 0x70, // 1
-      0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-      0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-      0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-      0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-      0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-      0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-      0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-      0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-      0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-      0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-      0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-      0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-      0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-      0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-  };
-  memcpy(&chip8->memory[CHIP8_FONT_DATA_START], fontset, sizeof(fontset));
-}
+// Quirk specialization relies on this being inlined with a constant quirks
+#define CHIP8_ALWAYS_INLINE inline __attribute__((always_inline))
+
+// Memory addresses wrap around the 4K, so broken ROMs (I or PC running off the
+// end) stay inside the chip8_t and behave the same in every engine
+#define CHIP8_ADDR_MASK (CHIP8_MEM_SIZE - 1u)
+
+// The state used by every instruction has to stay in the first cache line
+typedef char
+    chip8_hot_state_check[offsetof(chip8_t, predecode) + sizeof(void *) <=
+                                  CHIP8_CACHE_LINE
+                              ? 1
+                              : -1];
+
+// Memory after chip8_initialize, the font and nothing else, shared by every
+// instance until it loads a ROM
+static const chip8_image_t boot_image = {{
+    [CHIP8_FONT_DATA_START] =
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+}};
 
 void chip8_initialize(chip8_t *chip8, const chip8_interface_t chip8_interface) {
   // Set everything to zero
@@ -41,8 +61,67 @@ void chip8_initialize(chip8_t *chip8, const chip8_interface_t chip8_interface) {
 #endif /* ifdef CHIP8_USE_DRAW_CALLBACK */
   // Setting PC
   chip8->PC = 0x200;
-  // Loading Font
-  load_font(chip8);
+  // Setting quirks
+  chip8->quirks = CHIP8_DEFAULT_PROFILE;
+  // Seeding the built-in RNG
+  chip8_seed_rand(chip8, 0);
+  // Sharing the font
+  chip8->memory = boot_image.memory;
+}
+
+void chip8_destroy(chip8_t *chip8) {
+  if (chip8->ram_allocated) {
+    if (chip8->memory == chip8->ram)
+      chip8->memory = boot_image.memory;
+    free(chip8->ram);
+    chip8->ram = NULL;
+    chip8->ram_allocated = 0;
+  }
+}
+
+void chip8_set_ram(chip8_t *chip8, uint8_t *ram) {
+  if (chip8->memory == chip8->ram) {
+    memcpy(ram, chip8->ram, CHIP8_MEM_SIZE); // Already private, keep it
+    chip8->memory = ram;
+  }
+  if (chip8->ram_allocated)
+    free(chip8->ram);
+  chip8->ram = ram;
+  chip8->ram_allocated = 0;
+}
+
+uint8_t *chip8_memory_writable(chip8_t *chip8) {
+  if (chip8->memory == chip8->ram)
+    return chip8->ram;
+  if (!chip8->ram) {
+    chip8->ram = malloc(CHIP8_MEM_SIZE);
+    if (!chip8->ram) {
+      printf("Memory Error: out of memory\n");
+      abort(); // The store cannot be dropped
+    }
+    chip8->ram_allocated = 1;
+  }
+  // Same bytes, the engines do not go stale
+  memcpy(chip8->ram, chip8->memory, CHIP8_MEM_SIZE);
+  chip8->memory = chip8->ram;
+  return chip8->ram;
+}
+
+void chip8_seed_rand(chip8_t *chip8, uint32_t seed) {
+  // Mix the seed so close seeds do not start alike (and xorshift needs non 0)
+  seed ^= seed >> 16;
+  seed *= 0x7feb352du;
+  seed ^= seed >> 15;
+  seed *= 0x846ca68bu;
+  seed ^= seed >> 16;
+  chip8->rand_state = seed ? seed : 1u;
+}
+
+uint8_t chip8_rand(uint32_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return (uint8_t)(*state >> 24);
 }
 
 void chip8_print_registers(chip8_t *chip8, int flags) {
@@ -70,7 +149,7 @@ void chip8_print_registers(chip8_t *chip8, int flags) {
     printf("Sound Timer\t0x%02x\n", chip8->ST);
   if (flags & PRINT_KEYS) {
     for (int i = 0; i < 16; i++) {
-      printf("Key %X\t0x%02x\n", i, chip8->keys[i]);
+      printf("Key %X\t0x%02x\n", i, chip8_key_pressed(chip8, (uint8_t)i));
     }
   }
 }
@@ -103,70 +182,132 @@ void chip8_print_display(chip8_t *chip8, char on_char, char off_char) {
   }
 }
 
+uint16_t chip8_opcode_at(const chip8_t *chip8, uint16_t addr) {
+  return (uint16_t)((chip8->memory[addr % CHIP8_MEM_SIZE] << 8) |
+                    chip8->memory[(addr + 1u) % CHIP8_MEM_SIZE]);
+}
+
+uint32_t chip8_display_changes(chip8_t *chip8, chip8_display_t *shown) {
+  uint32_t changed = 0;
+  for (uint8_t y = 0; y < CHIP8_DISPLAY_HEIGHT; y++) {
+    if ((chip8->dirty_rows >> y & 1u) &&
+        memcmp((*shown)[y], chip8->display[y], sizeof((*shown)[y]))) {
+      memcpy((*shown)[y], chip8->display[y], sizeof((*shown)[y]));
+      changed |= 1u << y;
+    }
+  }
+  chip8->dirty_rows = 0;
+  return changed;
+}
+
+void chip8_display_invalidate(chip8_t *chip8) {
+  chip8->dirty_rows = CHIP8_DISPLAY_ALL_ROWS;
+  chip8->display_generation++;
+}
+
+uint64_t chip8_display_hash(const chip8_display_t *display) {
+  const uint8_t *bytes = (const uint8_t *)display;
+  uint64_t hash = UINT64_C(0xcbf29ce484222325); // FNV-1a offset basis
+  for (size_t i = 0; i < sizeof(*display); i++) {
+    hash ^= bytes[i];
+    hash *= UINT64_C(0x100000001b3); // FNV-1a prime
+  }
+  return hash;
+}
+
 void chip8_load_rom(chip8_t *chip8, const uint8_t *rom, uint16_t size) {
-  assert(size < CHIP8_MEM_SIZE - 0x200);
-  memcpy(&chip8->memory[0x200], rom, size);
+  assert(size <= CHIP8_MAX_ROM_SIZE);
+  memcpy(&chip8_memory_writable(chip8)[0x200], rom, size);
+  chip8_predecode_flush(chip8);
+  if (chip8->jit)
+    chip8_jit_flush(chip8->jit);
 }
 
-int chip8_load_rom_from_file(chip8_t *chip8, const char *filename) {
+void chip8_image_initialize(chip8_image_t *image, const uint8_t *rom,
+                            uint16_t size) {
+  assert(size <= CHIP8_MAX_ROM_SIZE);
+  memcpy(image, &boot_image, sizeof(*image));
+  memcpy(&image->memory[0x200], rom, size);
+}
+
+void chip8_load_image(chip8_t *chip8, const chip8_image_t *image) {
+  chip8->memory = image->memory;
+  chip8_predecode_flush(chip8);
+  if (chip8->jit)
+    chip8_jit_flush(chip8->jit);
+}
+
+int chip8_read_rom_file(const char *filename, uint8_t *rom, uint16_t *size) {
   FILE *fd = fopen(filename, "rb");
   if (fd == NULL) {
-    printf("Could not open file\n");
+    printf("Could not open ROM %s\n", filename);
     return -1;
   }
-  fseek(fd, 0, SEEK_END);
-  size_t filesize = (size_t)ftell(fd);
-  rewind(fd);
-  if (filesize > CHIP8_MEM_SIZE) {
-    printf("ROM is too big!\n");
-    fclose(fd);
+  size_t read = fread(rom, 1, CHIP8_MAX_ROM_SIZE, fd);
+  int too_big = fgetc(fd) != EOF;
+  fclose(fd);
+  if (too_big) {
+    printf("ROM too big: %s\n", filename);
     return -1;
   }
-  size_t bytes_read = fread(&chip8->memory[0x200], 1, filesize, fd);
-  if (bytes_read != filesize)
-    printf("Error: expected %zu bytes, got %zu\n", filesize, bytes_read);
-  fclose(fd);
+  *size = (uint16_t)read;
+  return 0;
+}
+
+int chip8_load_rom_from_file(chip8_t *chip8, const char *filename) {
+  uint8_t rom[CHIP8_MAX_ROM_SIZE];
+  uint16_t size;
+  if (chip8_read_rom_file(filename, rom, &size))
+    return -1;
+  chip8_load_rom(chip8, rom, size);
   return 0;
 }
 
 void chip8_set_key(chip8_t *chip8, uint8_t key) {
   assert(key < 16);
-  chip8->keys[key] = 1;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_KEYS);
-#endif
+  chip8->keys |= (uint16_t)(1u << key);
+#ifdef CHIP8_FX0A_RELEASE
+  // Pressed during this frame, so releasing it before chip8_save_key still
+  // counts as a press and release for Fx0A
+  chip8->previous_keys |= (uint16_t)(1u << key);
+#endif // CHIP8_FX0A_RELEASE
 }
 
 void chip8_reset_key(chip8_t *chip8, uint8_t key) {
   assert(key < 16);
-  chip8->keys[key] = 0;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_KEYS);
-#endif
+  chip8->keys &= (uint16_t)~(1u << key);
 }
 
 void chip8_timer_tick(chip8_t *chip8) {
   if (chip8->DT)
     chip8->DT--;
-  if (chip8->ST)
+  if (chip8->ST) {
     chip8->ST--;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_DT | PRINT_ST);
-#endif
+    if (!chip8->ST) {
+      chip8->pending_events |= CHIP8_EVENT_SOUND_STOP;
+      chip8_commit_events(chip8, chip8->PC);
+    }
+  }
+}
+
+void chip8_frame_end(chip8_t *chip8) {
+  chip8->interface.vblank_ready = 1;
+#ifdef CHIP8_FX0A_RELEASE
+  chip8_save_key(chip8);
+#endif // CHIP8_FX0A_RELEASE
+  chip8_timer_tick(chip8);
 }
 
 // 0nnn - SYS addr
 static inline void ins_sys_addr(chip8_t *chip8, uint16_t instruction) {
   (void)chip8;
   (void)instruction;
-#ifndef NDEBUG
-  printf("Uninmplemented Instruction: 0nnn\n");
-#endif
 }
 
-// 00E0 - CLS
-static inline void ins_cls(chip8_t *chip8) {
-  memset(chip8->display, 0x0, sizeof(chip8->display));
+// Mark rows changed by a display instruction and let the host know
+static inline void display_changed(chip8_t *chip8, uint32_t rows) {
+  chip8->dirty_rows |= rows;
+  chip8->display_generation++;
 #ifdef CHIP8_USE_DRAW_CALLBACK
   if (chip8->interface.draw_display)
     chip8->interface.draw_display((const chip8_display_t *)&chip8->display,
@@ -174,39 +315,43 @@ static inline void ins_cls(chip8_t *chip8) {
 #else
   chip8->interface.display_update_flag = 1;
 #endif /* ifndef CHIP8_USE_DRAW_CALLBACK */
-#ifndef NDEBUG
-  chip8_print_display(chip8, '#', ' ');
-#endif
+  chip8->pending_events |= CHIP8_EVENT_DISPLAY;
+}
+
+// 00E0 - CLS
+static inline void ins_cls(chip8_t *chip8) {
+  // Only the rows that had something on them change
+  uint32_t rows = 0;
+  for (uint8_t y = 0; y < CHIP8_DISPLAY_HEIGHT; y++) {
+    uint64_t row;
+    memcpy(&row, chip8->display[y], sizeof(row));
+    if (row)
+      rows |= 1u << y;
+  }
+  memset(chip8->display, 0x0, sizeof(chip8->display));
+  if (rows)
+    display_changed(chip8, rows);
 }
 
 // 00EE - RET
 static inline void ins_ret(chip8_t *chip8) {
   assert(chip8->SP < (sizeof(chip8->stack) / sizeof(chip8->PC)) &&
          chip8->SP >= 0);
-  chip8->PC = chip8->stack[chip8->SP];
+  chip8->PC = chip8->stack[chip8->SP % CHIP8_STACK_SIZE];
   chip8->SP--;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_SP | PRINT_STACK | PRINT_PC);
-#endif
 }
 
 // 1nnn - JP addr
 static inline void ins_jp_addr(chip8_t *chip8, uint16_t instruction) {
   chip8->PC = instruction & 0x0FFF;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_PC);
-#endif
 }
 
 // 2nnn - CALL addr
 static inline void ins_call_addr(chip8_t *chip8, uint16_t instruction) {
   assert(chip8->SP < (sizeof(chip8->stack) / sizeof(chip8->PC)));
   chip8->SP++;
-  chip8->stack[chip8->SP] = chip8->PC;
+  chip8->stack[chip8->SP % CHIP8_STACK_SIZE] = chip8->PC;
   chip8->PC = instruction & 0x0FFF;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_STACK | PRINT_SP | PRINT_PC);
-#endif
 }
 
 // 3xkk - SE Vx, byte
@@ -215,9 +360,6 @@ static inline void ins_se_vx_byte(chip8_t *chip8, uint16_t instruction) {
   uint8_t kk = (instruction & 0x00FF);
   if (chip8->V[x] == kk)
     chip8->PC += 2;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
 }
 
 // 4xkk - SNE Vx, byte
@@ -226,9 +368,6 @@ static inline void ins_sne_vx_byte(chip8_t *chip8, uint16_t instruction) {
   uint8_t kk = (instruction & 0x00FF);
   if (chip8->V[x] != kk)
     chip8->PC += 2;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
 }
 
 // 5xy0 - SE Vx, Vy
@@ -237,9 +376,6 @@ static inline void ins_se_vx_vy(chip8_t *chip8, uint16_t instruction) {
   uint8_t y = (instruction & 0x00F0) >> 4;
   if (chip8->V[x] == chip8->V[y])
     chip8->PC += 2;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
 }
 
 // 6xkk - LD Vx, byte
@@ -247,9 +383,6 @@ static inline void ins_ld_vx_byte(chip8_t *chip8, uint16_t instruction) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   uint8_t kk = (instruction & 0x00FF);
   chip8->V[x] = kk;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
 }
 
 // 7xkk - ADD Vx, byte
@@ -257,9 +390,6 @@ static inline void ins_add_vx_byte(chip8_t *chip8, uint16_t instruction) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   uint8_t kk = (instruction & 0x00FF);
   chip8->V[x] += kk;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
 }
 
 // 8xy0 - LD Vx, Vy
@@ -267,48 +397,39 @@ static inline void ins_ld_vx_vy(chip8_t *chip8, uint16_t instruction) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   uint8_t y = (instruction & 0x00F0) >> 4;
   chip8->V[x] = chip8->V[y];
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
 }
 
 // 8xy1 - OR Vx, Vy
-static inline void ins_or_vx_vy(chip8_t *chip8, uint16_t instruction) {
+static CHIP8_ALWAYS_INLINE void ins_or_vx_vy(chip8_t *chip8,
+                                                uint16_t instruction,
+                                                const unsigned quirks) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   uint8_t y = (instruction & 0x00F0) >> 4;
   chip8->V[x] |= chip8->V[y];
-#ifdef CHIP8_VF_RESET
-  chip8->V[0xF] = 0;
-#endif
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
+  if (quirks & CHIP8_QUIRK_VF_RESET)
+    chip8->V[0xF] = 0;
 }
 
 // 8xy2 - AND Vx, Vy
-static inline void ins_and_vx_vy(chip8_t *chip8, uint16_t instruction) {
+static CHIP8_ALWAYS_INLINE void ins_and_vx_vy(chip8_t *chip8,
+                                                uint16_t instruction,
+                                                const unsigned quirks) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   uint8_t y = (instruction & 0x00F0) >> 4;
   chip8->V[x] &= chip8->V[y];
-#ifdef CHIP8_VF_RESET
-  chip8->V[0xF] = 0;
-#endif
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
+  if (quirks & CHIP8_QUIRK_VF_RESET)
+    chip8->V[0xF] = 0;
 }
 
 // 8xy3 - XOR Vx, Vy
-static inline void ins_xor_vx_vy(chip8_t *chip8, uint16_t instruction) {
+static CHIP8_ALWAYS_INLINE void ins_xor_vx_vy(chip8_t *chip8,
+                                                uint16_t instruction,
+                                                const unsigned quirks) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   uint8_t y = (instruction & 0x00F0) >> 4;
   chip8->V[x] ^= chip8->V[y];
-#ifdef CHIP8_VF_RESET
-  chip8->V[0xF] = 0;
-#endif
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
+  if (quirks & CHIP8_QUIRK_VF_RESET)
+    chip8->V[0xF] = 0;
 }
 
 // 8xy4 - ADD Vx, Vy
@@ -318,9 +439,6 @@ static inline void ins_add_vx_vy(chip8_t *chip8, uint16_t instruction) {
   uint8_t set_vf = chip8->V[x] > UINT8_MAX - chip8->V[y];
   chip8->V[x] += chip8->V[y];
   chip8->V[0xF] = set_vf;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
 }
 
 // 8xy5 - SUB Vx, Vy
@@ -330,27 +448,18 @@ static inline void ins_sub_vx_vy(chip8_t *chip8, uint16_t instruction) {
   uint8_t set_vf = chip8->V[x] >= chip8->V[y];
   chip8->V[x] -= chip8->V[y];
   chip8->V[0xF] = set_vf;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
 }
 
 // 8xy6 - SHR Vx {, Vy}
-static inline void ins_shr_vx(chip8_t *chip8, uint16_t instruction) {
+static CHIP8_ALWAYS_INLINE void ins_shr_vx(chip8_t *chip8, uint16_t instruction,
+                                           const unsigned quirks) {
   uint8_t x = (instruction & 0x0F00) >> 8;
-#ifdef CHIP8_SHIFT_VX_ONLY
-  uint8_t set_vf = chip8->V[x] & 0x1;
-  chip8->V[x] >>= 1;
-#else
   uint8_t y = (instruction & 0x00F0) >> 4;
-  chip8->V[x] = chip8->V[y];
+  if (!(quirks & CHIP8_QUIRK_SHIFT_VX_ONLY))
+    chip8->V[x] = chip8->V[y];
   uint8_t set_vf = chip8->V[x] & 0x1;
   chip8->V[x] >>= 1;
-#endif
   chip8->V[0xF] = set_vf;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
 }
 
 // 8xy7 - SUBN Vx, Vy
@@ -360,27 +469,18 @@ static inline void ins_subn_vx_vy(chip8_t *chip8, uint16_t instruction) {
   uint8_t set_vf = chip8->V[y] >= chip8->V[x];
   chip8->V[x] = chip8->V[y] - chip8->V[x];
   chip8->V[0xF] = set_vf;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
 }
 
 // 8xyE - SHL Vx {, Vy}
-static inline void ins_shl_vx(chip8_t *chip8, uint16_t instruction) {
+static CHIP8_ALWAYS_INLINE void ins_shl_vx(chip8_t *chip8, uint16_t instruction,
+                                           const unsigned quirks) {
   uint8_t x = (instruction & 0x0F00) >> 8;
-#ifdef CHIP8_SHIFT_VX_ONLY
-  uint8_t set_vf = (chip8->V[x] >> 7) & 0x1;
-  chip8->V[x] <<= 1;
-#else
   uint8_t y = (instruction & 0x00F0) >> 4;
-  chip8->V[x] = chip8->V[y];
+  if (!(quirks & CHIP8_QUIRK_SHIFT_VX_ONLY))
+    chip8->V[x] = chip8->V[y];
   uint8_t set_vf = (chip8->V[x] >> 7) & 0x1;
   chip8->V[x] <<= 1;
-#endif
   chip8->V[0xF] = set_vf;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
 }
 
 // 9xy0 - SNE Vx, Vy
@@ -389,31 +489,24 @@ static inline void ins_sne_vx_vy(chip8_t *chip8, uint16_t instruction) {
   uint8_t y = (instruction & 0x00F0) >> 4;
   if (chip8->V[x] != chip8->V[y])
     chip8->PC += 2;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V | PRINT_PC);
-#endif
 }
 
 // Annn - LD I, addr
 static inline void ins_ld_i_addr(chip8_t *chip8, uint16_t instruction) {
   chip8->I = instruction & 0x0FFF;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_I);
-#endif
 }
 
 // Bnnn - JP V0, addr
-static inline void ins_jp_v0_addr(chip8_t *chip8, uint16_t instruction) {
+static CHIP8_ALWAYS_INLINE void ins_jp_v0_addr(chip8_t *chip8,
+                                               uint16_t instruction,
+                                               const unsigned quirks) {
   uint16_t addr = instruction & 0x0FFF;
-#ifdef CHIP8_JUMP_USE_VX
-  uint8_t x = (addr & 0x0F00) >> 8;
-  chip8->PC = addr + chip8->V[x];
-#else
-  chip8->PC = addr + chip8->V[0];
-#endif
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_PC);
-#endif
+  if (quirks & CHIP8_QUIRK_JUMP_USE_VX) {
+    uint8_t x = (addr & 0x0F00) >> 8;
+    chip8->PC = addr + chip8->V[x];
+  } else {
+    chip8->PC = addr + chip8->V[0];
+  }
 }
 
 // Cxkk - RND Vx, byte
@@ -423,24 +516,24 @@ static inline void ins_rnd_vx_byte(chip8_t *chip8, uint16_t instruction) {
   if (chip8->interface.rand) {
     chip8->V[x] = chip8->interface.rand() & kk;
   } else {
-    chip8->V[x] = 0x77 & kk; // A totally random number
+    chip8->V[x] = chip8_rand(&chip8->rand_state) & kk;
   }
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
 }
 
 // Dxyn - DRW Vx, Vy, nibble
 #ifndef CHIP8_BUGGY
-static inline void ins_drw_vx_vy(chip8_t *chip8, uint16_t instruction) {
-#ifdef CHIP8_WAIT_VBLANK
-  if (!chip8->interface.vblank_ready) {
-    chip8->PC -= 2;
-    return;
-  } else {
-    chip8->interface.vblank_ready = 0;
+static CHIP8_ALWAYS_INLINE void ins_drw_vx_vy(chip8_t *chip8,
+                                              uint16_t instruction,
+                                              const unsigned quirks) {
+  if (quirks & CHIP8_QUIRK_WAIT_VBLANK) {
+    if (!chip8->interface.vblank_ready) {
+      chip8->PC -= 2;
+      chip8->pending_events |= CHIP8_EVENT_VBLANK_WAIT;
+      return;
+    } else {
+      chip8->interface.vblank_ready = 0;
+    }
   }
-#endif
 
   uint8_t x = (instruction & 0x0F00) >> 8;
   uint8_t y = (instruction & 0x00F0) >> 4;
@@ -455,50 +548,48 @@ static inline void ins_drw_vx_vy(chip8_t *chip8, uint16_t instruction) {
 
   chip8->V[0xF] = 0;
   uint8_t set_vf = 0;
+  uint32_t rows = 0; // Rows with any pixel flipped
 
   // Lets go row by row according to n
   for (uint8_t row = 0; row < n; row++) {
-    uint8_t sprite_row = chip8->memory[chip8->I + row];
+    uint8_t sprite_row = chip8->memory[(chip8->I + row) & CHIP8_ADDR_MASK];
     // It could be the case that drawing will cross a boundary,
     // so I'll separate it into two bytes (xpos % 8)
     uint8_t sprite_row_first = sprite_row >> (xpos % 8u);
     uint8_t sprite_row_second = sprite_row << (8u - (xpos % 8u));
-    if (ypos + row < CHIP8_DISPLAY_HEIGHT) { // It will CLIP on the bottom
-      set_vf |=
-          (chip8->display[ypos + row][xpos / 8u] & sprite_row_first) ? 1 : 0;
-      chip8->display[ypos + row][xpos / 8u] ^= sprite_row_first;
-      if ((xpos / 8u + 1u) < 8u) { // It will CLIP on right
-        set_vf |=
-            (chip8->display[ypos + row][xpos / 8u + 1u] & sprite_row_second)
-                ? 1
-                : 0;
-        chip8->display[ypos + row][xpos / 8u + 1u] ^= sprite_row_second;
-      }
+    uint8_t line = (ypos + row) % CHIP8_DISPLAY_HEIGHT;
+    uint8_t second = (xpos / 8u + 1u) % (CHIP8_DISPLAY_WIDTH / 8u);
+    if (quirks & CHIP8_QUIRK_CLIP) {
+      if (row >= CHIP8_DISPLAY_HEIGHT - ypos) // It will CLIP on the bottom
+        break;
+      if ((xpos / 8u + 1u) >= 8u) // It will CLIP on right
+        sprite_row_second = 0;
     }
+    set_vf |= (chip8->display[line][xpos / 8u] & sprite_row_first) ? 1 : 0;
+    chip8->display[line][xpos / 8u] ^= sprite_row_first;
+    set_vf |= (chip8->display[line][second] & sprite_row_second) ? 1 : 0;
+    chip8->display[line][second] ^= sprite_row_second;
+    if (sprite_row_first | sprite_row_second)
+      rows |= 1u << line;
   }
   chip8->V[0xF] = set_vf;
 
-#ifdef CHIP8_USE_DRAW_CALLBACK
-  if (chip8->interface.draw_display)
-    chip8->interface.draw_display((const chip8_display_t *)&chip8->display,
-                                  chip8->interface.user_data);
-#else
-  chip8->interface.display_update_flag = 1;
-#endif /* ifndef CHIP8_USE_DRAW_CALLBACK */
-#ifndef NDEBUG
-  chip8_print_display(chip8, '#', ' ');
-#endif
+  if (rows)
+    display_changed(chip8, rows);
 }
 #else // The first buggy implementation TBR
-static inline void ins_drw_vx_vy(chip8_t *chip8, uint16_t instruction) {
-#ifdef CHIP8_WAIT_VBLANK
-  if (!chip8->interface.vblank_ready) {
-    chip8->PC -= 2;
-    return;
-  } else {
-    chip8->interface.vblank_ready = 0;
+static CHIP8_ALWAYS_INLINE void ins_drw_vx_vy(chip8_t *chip8,
+                                              uint16_t instruction,
+                                              const unsigned quirks) {
+  if (quirks & CHIP8_QUIRK_WAIT_VBLANK) {
+    if (!chip8->interface.vblank_ready) {
+      chip8->PC -= 2;
+      chip8->pending_events |= CHIP8_EVENT_VBLANK_WAIT;
+      return;
+    } else {
+      chip8->interface.vblank_ready = 0;
+    }
   }
-#endif
   unsigned char x = chip8->V[(instruction & 0x0F00) >> 8] % CHIP8_DISPLAY_WIDTH;
   unsigned char y =
       chip8->V[(instruction & 0x00F0) >> 4] % CHIP8_DISPLAY_HEIGHT;
@@ -506,8 +597,11 @@ static inline void ins_drw_vx_vy(chip8_t *chip8, uint16_t instruction) {
   assert(chip8->I < CHIP8_MEM_SIZE);
   assert(chip8->I + n < CHIP8_MEM_SIZE);
   unsigned char pixel_erased = 0;
+  uint32_t rows = 0;
   for (unsigned char i = 0; i < (instruction & 0x000F); i++) {
-    uint8_t spritebyte = chip8->memory[chip8->I + i];
+    uint8_t spritebyte = chip8->memory[(chip8->I + i) & CHIP8_ADDR_MASK];
+    if (spritebyte)
+      rows |= 1u << ((y + i) % CHIP8_DISPLAY_HEIGHT);
     pixel_erased |= chip8->display[(y + i) % CHIP8_DISPLAY_HEIGHT][x / 8] &
                         spritebyte >> (x % 8) &&
                     chip8->display[(y + i) % CHIP8_DISPLAY_HEIGHT]
@@ -520,16 +614,8 @@ static inline void ins_drw_vx_vy(chip8_t *chip8, uint16_t instruction) {
         (uint8_t)(spritebyte << (8 - (x % 8)));
   }
   chip8->V[0xF] = pixel_erased;
-#ifdef CHIP8_USE_DRAW_CALLBACK
-  if (chip8->interface.draw_display)
-    chip8->interface.draw_display((const chip8_display_t *)&chip8->display,
-                                  chip8->interface.user_data);
-#else
-  chip8->interface.display_update_flag = 1;
-#endif /* ifndef CHIP8_USE_DRAW_CALLBACK */
-#ifndef NDEBUG
-  chip8_print_display(chip8, '#', ' ');
-#endif
+  if (rows)
+    display_changed(chip8, rows);
 }
 #endif /* ifndef CHIP8_BUGGY */
 
@@ -537,154 +623,136 @@ static inline void ins_drw_vx_vy(chip8_t *chip8, uint16_t instruction) {
 static inline void ins_skp_vx(chip8_t *chip8, uint16_t instruction) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   assert(x < 16);
-  if (chip8->keys[chip8->V[x] % 16])
+  if (chip8_key_pressed(chip8, chip8->V[x]))
     chip8->PC += 2;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_PC | PRINT_KEYS);
-#endif
 }
 
 // ExA1 - SKNP Vx
 static inline void ins_sknp_vx(chip8_t *chip8, uint16_t instruction) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   assert(x < 16);
-  if (!chip8->keys[chip8->V[x] % 16])
+  if (!chip8_key_pressed(chip8, chip8->V[x]))
     chip8->PC += 2;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_PC | PRINT_KEYS);
-#endif
 }
 
 // Fx07 - LD Vx, DT
 static inline void ins_ld_vx_dt(chip8_t *chip8, uint16_t instruction) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   chip8->V[x] = chip8->DT;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V | PRINT_DT);
-#endif
 }
 
 #ifdef CHIP8_FX0A_RELEASE
 void chip8_save_key(chip8_t *chip8) {
-  memcpy(chip8->previous_keys, chip8->keys, sizeof(chip8->keys));
+  chip8->previous_keys = chip8->keys;
 }
 #endif /* ifdef CHIP8_FX0A_RELEASE */
 
 // Fx0A - LD Vx, K
 static inline void ins_ld_vx_k(chip8_t *chip8, uint16_t instruction) {
   uint8_t x = (instruction & 0x0F00) >> 8;
-  for (uint8_t i = 0; i < 16; i++) {
 #ifdef CHIP8_FX0A_RELEASE
-    if (!chip8->keys[i] && chip8->previous_keys[i]) {
-      chip8->V[x] = i;
-      return;
-    }
+  unsigned ready = chip8->previous_keys & (uint16_t)~chip8->keys; // Released
 #else
-    if (chip8->keys[i]) {
-      chip8->V[x] = i;
-      return;
-    }
+  unsigned ready = chip8->keys;
 #endif /* ifdef CHIP8_FX0A_RELEASE */
+  if (ready) {
+    chip8->V[x] = (uint8_t)__builtin_ctz(ready); // Lowest key first
+    return;
   }
   chip8->PC -= 2;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V);
-#endif
+  chip8->pending_events |= CHIP8_EVENT_KEY_WAIT;
 }
 
 // Fx15 - LD DT, Vx
 static inline void ins_ld_dt_vx(chip8_t *chip8, uint16_t instruction) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   chip8->DT = chip8->V[x];
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V | PRINT_DT);
-#endif
 }
 
 // Fx18 - LD ST, Vx
 static inline void ins_ld_st_vx(chip8_t *chip8, uint16_t instruction) {
   uint8_t x = (instruction & 0x0F00) >> 8;
+  if (!chip8->ST && chip8->V[x])
+    chip8->pending_events |= CHIP8_EVENT_SOUND_START;
+  else if (chip8->ST && !chip8->V[x])
+    chip8->pending_events |= CHIP8_EVENT_SOUND_STOP;
   chip8->ST = chip8->V[x];
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V | PRINT_ST);
-#endif
 }
 
 // Fx1E - ADD I, Vx
 static inline void ins_add_i_vx(chip8_t *chip8, uint16_t instruction) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   chip8->I += chip8->V[x];
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V | PRINT_I);
-#endif
 }
 
 // Fx29 - LD F, Vx
 static inline void ins_ld_f_vx(chip8_t *chip8, uint16_t instruction) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   chip8->I = (uint16_t)(CHIP8_FONT_DATA_START + 5 * chip8->V[x]);
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V | PRINT_I);
-#endif
+}
+
+// Memory the stores write to, a private copy is made by the first one
+static inline uint8_t *store_memory(chip8_t *chip8) {
+  if (chip8->memory == chip8->ram)
+    return chip8->ram;
+  return chip8_memory_writable(chip8);
 }
 
 // Fx33 - LD B, Vx
 static inline void ins_ld_b_vx(chip8_t *chip8, uint16_t instruction) {
   assert(chip8->I + 2u < CHIP8_MEM_SIZE);
   uint8_t x = (instruction & 0x0F00) >> 8;
-  chip8->memory[chip8->I] = (chip8->V[x] / 100) % 10;
-  chip8->memory[chip8->I + 1] = (chip8->V[x] / 10) % 10;
-  chip8->memory[chip8->I + 2] = chip8->V[x] % 10;
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V | PRINT_I);
-#endif
+  uint8_t *ram = store_memory(chip8);
+  ram[chip8->I & CHIP8_ADDR_MASK] = (chip8->V[x] / 100) % 10;
+  ram[(chip8->I + 1u) & CHIP8_ADDR_MASK] = (chip8->V[x] / 10) % 10;
+  ram[(chip8->I + 2u) & CHIP8_ADDR_MASK] = chip8->V[x] % 10;
 }
 
 // Fx55 - LD [I], Vx
-static inline void ins_ld_i_vx(chip8_t *chip8, uint16_t instruction) {
+static CHIP8_ALWAYS_INLINE void ins_ld_i_vx(chip8_t *chip8, uint16_t instruction,
+                                            const unsigned quirks) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   assert(chip8->I + x < CHIP8_MEM_SIZE);
+  uint8_t *ram = store_memory(chip8);
   for (uint8_t i = 0; i <= x; i++) {
-    chip8->memory[chip8->I + i] = chip8->V[i];
+    ram[(chip8->I + i) & CHIP8_ADDR_MASK] = chip8->V[i];
   }
-#ifdef CHIP8_MEM_INCR
-  chip8->I += x + 1; // increment I after storing registers
-#endif
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V | PRINT_I);
-  chip8_mem_hexdump(chip8, chip8->I, chip8->I + 16);
-#endif
+  if (quirks & CHIP8_QUIRK_MEM_INCR)
+    chip8->I += x + 1; // increment I after storing registers
 }
 
 // Fx65 - LD Vx, [I]
-static inline void ins_ld_vx_i(chip8_t *chip8, uint16_t instruction) {
+static CHIP8_ALWAYS_INLINE void ins_ld_vx_i(chip8_t *chip8, uint16_t instruction,
+                                            const unsigned quirks) {
   uint8_t x = (instruction & 0x0F00) >> 8;
   assert(chip8->I + x < CHIP8_MEM_SIZE);
   for (uint8_t i = 0; i <= x; i++) {
-    chip8->V[i] = chip8->memory[chip8->I + i];
+    chip8->V[i] = chip8->memory[(chip8->I + i) & CHIP8_ADDR_MASK];
   }
-#ifdef CHIP8_MEM_INCR
-  chip8->I += x + 1; // increment I after loading registers
-#endif
-#ifndef NDEBUG
-  chip8_print_registers(chip8, PRINT_V | PRINT_I);
-  chip8_mem_hexdump(chip8, chip8->I, chip8->I + 16);
-#endif
+  if (quirks & CHIP8_QUIRK_MEM_INCR)
+    chip8->I += x + 1; // increment I after loading registers
+}
+
+// Unknown instruction
+static inline void ins_unknown(chip8_t *chip8, uint16_t instruction) {
+  (void)instruction;
+  chip8->pending_events |= CHIP8_EVENT_UNKNOWN_OPCODE; // Frontends report it
 }
 
 // Fetch instruction and increase Program Counter by 2
 static inline uint16_t chip8_fetch(chip8_t *chip8) {
-  uint16_t instruction = (uint16_t)((chip8->memory[chip8->PC] << 8) +
-                                    chip8->memory[chip8->PC + 1]);
+  uint16_t instruction =
+      (uint16_t)((chip8->memory[chip8->PC & CHIP8_ADDR_MASK] << 8) +
+                 chip8->memory[(chip8->PC + 1u) & CHIP8_ADDR_MASK]);
   chip8->PC += 2;
-#ifndef NDEBUG
-  printf("Fetching Instruction: %04x\n", instruction);
-#endif
   return instruction;
 }
 
-// Decode and execute an instruction
-static inline void chip8_decode_execute(chip8_t *chip8, uint16_t instruction) {
+// Decode and execute an instruction, quirks is always a constant so every
+// specialized copy gets the quirk checks folded away
+static CHIP8_ALWAYS_INLINE void chip8_decode_execute(chip8_t *chip8,
+                                                     uint16_t instruction,
+                                                     const unsigned quirks) {
   switch (instruction) {
   case 0x00E0:
     ins_cls(chip8);
@@ -715,7 +783,7 @@ static inline void chip8_decode_execute(chip8_t *chip8, uint16_t instruction) {
         ins_se_vx_vy(chip8, instruction);
         break;
       default:
-        printf("Unknown Instruction found: %04x\n", instruction);
+        ins_unknown(chip8, instruction);
       }
       break;
     case 0x6000:
@@ -730,13 +798,13 @@ static inline void chip8_decode_execute(chip8_t *chip8, uint16_t instruction) {
         ins_ld_vx_vy(chip8, instruction);
         break;
       case 0x0001:
-        ins_or_vx_vy(chip8, instruction);
+        ins_or_vx_vy(chip8, instruction, quirks);
         break;
       case 0x0002:
-        ins_and_vx_vy(chip8, instruction);
+        ins_and_vx_vy(chip8, instruction, quirks);
         break;
       case 0x0003:
-        ins_xor_vx_vy(chip8, instruction);
+        ins_xor_vx_vy(chip8, instruction, quirks);
         break;
       case 0x0004:
         ins_add_vx_vy(chip8, instruction);
@@ -745,16 +813,16 @@ static inline void chip8_decode_execute(chip8_t *chip8, uint16_t instruction) {
         ins_sub_vx_vy(chip8, instruction);
         break;
       case 0x0006:
-        ins_shr_vx(chip8, instruction);
+        ins_shr_vx(chip8, instruction, quirks);
         break;
       case 0x0007:
         ins_subn_vx_vy(chip8, instruction);
         break;
       case 0x000E:
-        ins_shl_vx(chip8, instruction);
+        ins_shl_vx(chip8, instruction, quirks);
         break;
       default:
-        printf("Unknown Instruction found: %04x\n", instruction);
+        ins_unknown(chip8, instruction);
       }
       break;
     case 0x9000:
@@ -763,20 +831,20 @@ static inline void chip8_decode_execute(chip8_t *chip8, uint16_t instruction) {
         ins_sne_vx_vy(chip8, instruction);
         break;
       default:
-        printf("Unknown Instruction found: %04x\n", instruction);
+        ins_unknown(chip8, instruction);
       }
       break;
     case 0xA000:
       ins_ld_i_addr(chip8, instruction);
       break;
     case 0xB000:
-      ins_jp_v0_addr(chip8, instruction);
+      ins_jp_v0_addr(chip8, instruction, quirks);
       break;
     case 0xC000:
       ins_rnd_vx_byte(chip8, instruction);
       break;
     case 0xD000:
-      ins_drw_vx_vy(chip8, instruction);
+      ins_drw_vx_vy(chip8, instruction, quirks);
       break;
     case 0xE000:
       switch (instruction & 0x00FF) {
@@ -787,7 +855,7 @@ static inline void chip8_decode_execute(chip8_t *chip8, uint16_t instruction) {
         ins_sknp_vx(chip8, instruction);
         break;
       default:
-        printf("Unknown Instruction found: %04x\n", instruction);
+        ins_unknown(chip8, instruction);
       }
       break;
     case 0xF000:
@@ -814,22 +882,808 @@ static inline void chip8_decode_execute(chip8_t *chip8, uint16_t instruction) {
         ins_ld_b_vx(chip8, instruction);
         break;
       case 0x0055:
-        ins_ld_i_vx(chip8, instruction);
+        ins_ld_i_vx(chip8, instruction, quirks);
         break;
       case 0x0065:
-        ins_ld_vx_i(chip8, instruction);
+        ins_ld_vx_i(chip8, instruction, quirks);
         break;
       default:
-        printf("Unknown Instruction found: %04x\n", instruction);
+        ins_unknown(chip8, instruction);
       }
       break;
     default:
-      printf("Unknown Instruction found: %04x\n", instruction);
+      ins_unknown(chip8, instruction);
     }
   }
 }
 
+// Predecoded engine
+// Every memory address gets a chip8_op_t with the handler and the operands
+// already extracted, entries start as op_decode and get filled the first time
+// they are executed. Only Fx33 and Fx55 write memory, so their handlers drop the
+// entries they wrote over (a fused idiom reads up to 5 bytes after its start,
+// so entries starting that far before the write are stale too). Filled entries
+// are kept in a bitmap, so stores to data (most of them) rewrite nothing.
+
+#define CHIP8_FUSION_SPAN 6u // Bytes read by the longest fused idiom
+
+static void op_decode(chip8_t *chip8, const chip8_op_t *op);
+
+// Drop the filled entries of the bitmap byte, the 8 entries it covers
+static inline void predecode_drop(chip8_predecode_t *predecode, uint16_t byte) {
+  uint8_t bits = predecode->decoded[byte];
+  predecode->decoded[byte] = 0;
+  while (bits) {
+    chip8_op_t *op = &predecode->ops[byte * 8u + (uint16_t)__builtin_ctz(bits)];
+    op->handler = op_decode;
+    op->fused = NULL;
+    bits &= (uint8_t)(bits - 1u);
+  }
+}
+
+static inline void predecode_invalidate(chip8_t *chip8, uint16_t addr,
+                                        uint16_t len) {
+  chip8_predecode_t *predecode = chip8->predecode;
+  uint16_t start = (addr - (CHIP8_FUSION_SPAN - 1u)) & CHIP8_ADDR_MASK;
+  uint16_t end = (uint16_t)(start + len + CHIP8_FUSION_SPAN - 2u); // Last one
+  // Whole bitmap bytes, dropping a few entries around the span is harmless
+  for (uint16_t byte = start / 8u; byte <= end / 8u; byte++) {
+    if (predecode->decoded[byte % sizeof(predecode->decoded)])
+      predecode_drop(predecode, byte % sizeof(predecode->decoded));
+  }
+}
+
+static void op_sys_addr(chip8_t *chip8, const chip8_op_t *op) {
+  ins_sys_addr(chip8, op->instruction);
+}
+
+static void op_cls(chip8_t *chip8, const chip8_op_t *op) {
+  (void)op;
+  ins_cls(chip8);
+}
+
+static void op_ret(chip8_t *chip8, const chip8_op_t *op) {
+  (void)op;
+  ins_ret(chip8);
+}
+
+static void op_jp_addr(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->PC = op->nnn;
+}
+
+static void op_call_addr(chip8_t *chip8, const chip8_op_t *op) {
+  ins_call_addr(chip8, op->instruction);
+}
+
+static void op_se_vx_byte(chip8_t *chip8, const chip8_op_t *op) {
+  if (chip8->V[op->x] == op->kk)
+    chip8->PC += 2;
+}
+
+static void op_sne_vx_byte(chip8_t *chip8, const chip8_op_t *op) {
+  if (chip8->V[op->x] != op->kk)
+    chip8->PC += 2;
+}
+
+static void op_se_vx_vy(chip8_t *chip8, const chip8_op_t *op) {
+  if (chip8->V[op->x] == chip8->V[op->y])
+    chip8->PC += 2;
+}
+
+static void op_ld_vx_byte(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] = op->kk;
+}
+
+static void op_add_vx_byte(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] += op->kk;
+}
+
+static void op_ld_vx_vy(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] = chip8->V[op->y];
+}
+
+static void op_or_vx_vy(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] |= chip8->V[op->y];
+}
+
+static void op_or_vx_vy_vf_reset(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] |= chip8->V[op->y];
+  chip8->V[0xF] = 0;
+}
+
+static void op_and_vx_vy(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] &= chip8->V[op->y];
+}
+
+static void op_and_vx_vy_vf_reset(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] &= chip8->V[op->y];
+  chip8->V[0xF] = 0;
+}
+
+static void op_xor_vx_vy(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] ^= chip8->V[op->y];
+}
+
+static void op_xor_vx_vy_vf_reset(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] ^= chip8->V[op->y];
+  chip8->V[0xF] = 0;
+}
+
+static void op_add_vx_vy(chip8_t *chip8, const chip8_op_t *op) {
+  uint8_t set_vf = chip8->V[op->x] > UINT8_MAX - chip8->V[op->y];
+  chip8->V[op->x] += chip8->V[op->y];
+  chip8->V[0xF] = set_vf;
+}
+
+static void op_sub_vx_vy(chip8_t *chip8, const chip8_op_t *op) {
+  uint8_t set_vf = chip8->V[op->x] >= chip8->V[op->y];
+  chip8->V[op->x] -= chip8->V[op->y];
+  chip8->V[0xF] = set_vf;
+}
+
+static void op_shr_vx(chip8_t *chip8, const chip8_op_t *op) {
+  ins_shr_vx(chip8, op->instruction, 0);
+}
+
+static void op_shr_vx_only(chip8_t *chip8, const chip8_op_t *op) {
+  ins_shr_vx(chip8, op->instruction, CHIP8_QUIRK_SHIFT_VX_ONLY);
+}
+
+static void op_subn_vx_vy(chip8_t *chip8, const chip8_op_t *op) {
+  uint8_t set_vf = chip8->V[op->y] >= chip8->V[op->x];
+  chip8->V[op->x] = chip8->V[op->y] - chip8->V[op->x];
+  chip8->V[0xF] = set_vf;
+}
+
+static void op_shl_vx(chip8_t *chip8, const chip8_op_t *op) {
+  ins_shl_vx(chip8, op->instruction, 0);
+}
+
+static void op_shl_vx_only(chip8_t *chip8, const chip8_op_t *op) {
+  ins_shl_vx(chip8, op->instruction, CHIP8_QUIRK_SHIFT_VX_ONLY);
+}
+
+static void op_sne_vx_vy(chip8_t *chip8, const chip8_op_t *op) {
+  if (chip8->V[op->x] != chip8->V[op->y])
+    chip8->PC += 2;
+}
+
+static void op_ld_i_addr(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->I = op->nnn;
+}
+
+static void op_jp_v0_addr(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->PC = op->nnn + chip8->V[0];
+}
+
+static void op_jp_vx_addr(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->PC = op->nnn + chip8->V[op->x];
+}
+
+static void op_rnd_vx_byte(chip8_t *chip8, const chip8_op_t *op) {
+  ins_rnd_vx_byte(chip8, op->instruction);
+}
+
+// Dxyn only cares about CHIP8_QUIRK_CLIP and CHIP8_QUIRK_WAIT_VBLANK
+static void op_drw_vx_vy(chip8_t *chip8, const chip8_op_t *op) {
+  ins_drw_vx_vy(chip8, op->instruction, 0);
+}
+
+static void op_drw_vx_vy_clip(chip8_t *chip8, const chip8_op_t *op) {
+  ins_drw_vx_vy(chip8, op->instruction, CHIP8_QUIRK_CLIP);
+}
+
+static void op_drw_vx_vy_vblank(chip8_t *chip8, const chip8_op_t *op) {
+  ins_drw_vx_vy(chip8, op->instruction, CHIP8_QUIRK_WAIT_VBLANK);
+}
+
+static void op_drw_vx_vy_clip_vblank(chip8_t *chip8, const chip8_op_t *op) {
+  ins_drw_vx_vy(chip8, op->instruction,
+                CHIP8_QUIRK_CLIP | CHIP8_QUIRK_WAIT_VBLANK);
+}
+
+static void op_skp_vx(chip8_t *chip8, const chip8_op_t *op) {
+  if (chip8_key_pressed(chip8, chip8->V[op->x]))
+    chip8->PC += 2;
+}
+
+static void op_sknp_vx(chip8_t *chip8, const chip8_op_t *op) {
+  if (!chip8_key_pressed(chip8, chip8->V[op->x]))
+    chip8->PC += 2;
+}
+
+static void op_ld_vx_dt(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] = chip8->DT;
+}
+
+static void op_ld_vx_k(chip8_t *chip8, const chip8_op_t *op) {
+  ins_ld_vx_k(chip8, op->instruction);
+}
+
+static void op_ld_dt_vx(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->DT = chip8->V[op->x];
+}
+
+static void op_ld_st_vx(chip8_t *chip8, const chip8_op_t *op) {
+  ins_ld_st_vx(chip8, op->instruction);
+}
+
+static void op_add_i_vx(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->I += chip8->V[op->x];
+}
+
+static void op_ld_f_vx(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->I = (uint16_t)(CHIP8_FONT_DATA_START + 5 * chip8->V[op->x]);
+}
+
+static void op_ld_b_vx(chip8_t *chip8, const chip8_op_t *op) {
+  uint16_t addr = chip8->I;
+  ins_ld_b_vx(chip8, op->instruction);
+  predecode_invalidate(chip8, addr, 3);
+}
+
+static void op_ld_i_vx(chip8_t *chip8, const chip8_op_t *op) {
+  uint16_t addr = chip8->I;
+  ins_ld_i_vx(chip8, op->instruction, 0);
+  predecode_invalidate(chip8, addr, op->x + 1u);
+}
+
+static void op_ld_i_vx_incr(chip8_t *chip8, const chip8_op_t *op) {
+  uint16_t addr = chip8->I;
+  ins_ld_i_vx(chip8, op->instruction, CHIP8_QUIRK_MEM_INCR);
+  predecode_invalidate(chip8, addr, op->x + 1u);
+}
+
+static void op_ld_vx_i(chip8_t *chip8, const chip8_op_t *op) {
+  ins_ld_vx_i(chip8, op->instruction, 0);
+}
+
+static void op_ld_vx_i_incr(chip8_t *chip8, const chip8_op_t *op) {
+  ins_ld_vx_i(chip8, op->instruction, CHIP8_QUIRK_MEM_INCR);
+}
+
+static void op_unknown(chip8_t *chip8, const chip8_op_t *op) {
+  ins_unknown(chip8, op->instruction);
+}
+
+// Same decoding as chip8_decode_execute, but returning the handler specialized
+// for the quirks
+static chip8_op_handler_t op_select(uint16_t instruction, unsigned quirks) {
+  const int vf_reset = (quirks & CHIP8_QUIRK_VF_RESET) != 0;
+  const int shift_vx_only = (quirks & CHIP8_QUIRK_SHIFT_VX_ONLY) != 0;
+  const int mem_incr = (quirks & CHIP8_QUIRK_MEM_INCR) != 0;
+  static const chip8_op_handler_t drw[4] = {
+      op_drw_vx_vy, op_drw_vx_vy_clip, op_drw_vx_vy_vblank,
+      op_drw_vx_vy_clip_vblank};
+  switch (instruction) {
+  case 0x00E0:
+    return op_cls;
+  case 0x00EE:
+    return op_ret;
+  default:
+    break;
+  }
+  switch (instruction & 0xF000) {
+  case 0x0000:
+    return op_sys_addr;
+  case 0x1000:
+    return op_jp_addr;
+  case 0x2000:
+    return op_call_addr;
+  case 0x3000:
+    return op_se_vx_byte;
+  case 0x4000:
+    return op_sne_vx_byte;
+  case 0x5000:
+    return (instruction & 0x000F) == 0x0000 ? op_se_vx_vy : op_unknown;
+  case 0x6000:
+    return op_ld_vx_byte;
+  case 0x7000:
+    return op_add_vx_byte;
+  case 0x8000:
+    switch (instruction & 0x000F) {
+    case 0x0000:
+      return op_ld_vx_vy;
+    case 0x0001:
+      return vf_reset ? op_or_vx_vy_vf_reset : op_or_vx_vy;
+    case 0x0002:
+      return vf_reset ? op_and_vx_vy_vf_reset : op_and_vx_vy;
+    case 0x0003:
+      return vf_reset ? op_xor_vx_vy_vf_reset : op_xor_vx_vy;
+    case 0x0004:
+      return op_add_vx_vy;
+    case 0x0005:
+      return op_sub_vx_vy;
+    case 0x0006:
+      return shift_vx_only ? op_shr_vx_only : op_shr_vx;
+    case 0x0007:
+      return op_subn_vx_vy;
+    case 0x000E:
+      return shift_vx_only ? op_shl_vx_only : op_shl_vx;
+    default:
+      return op_unknown;
+    }
+  case 0x9000:
+    return (instruction & 0x000F) == 0x0000 ? op_sne_vx_vy : op_unknown;
+  case 0xA000:
+    return op_ld_i_addr;
+  case 0xB000:
+    return (quirks & CHIP8_QUIRK_JUMP_USE_VX) ? op_jp_vx_addr : op_jp_v0_addr;
+  case 0xC000:
+    return op_rnd_vx_byte;
+  case 0xD000:
+    return drw[((quirks & CHIP8_QUIRK_CLIP) ? 1 : 0) +
+               ((quirks & CHIP8_QUIRK_WAIT_VBLANK) ? 2 : 0)];
+  case 0xE000:
+    switch (instruction & 0x00FF) {
+    case 0x009E:
+      return op_skp_vx;
+    case 0x00A1:
+      return op_sknp_vx;
+    default:
+      return op_unknown;
+    }
+  case 0xF000:
+    switch (instruction & 0x00FF) {
+    case 0x0007:
+      return op_ld_vx_dt;
+    case 0x000A:
+      return op_ld_vx_k;
+    case 0x0015:
+      return op_ld_dt_vx;
+    case 0x0018:
+      return op_ld_st_vx;
+    case 0x001E:
+      return op_add_i_vx;
+    case 0x0029:
+      return op_ld_f_vx;
+    case 0x0033:
+      return op_ld_b_vx;
+    case 0x0055:
+      return mem_incr ? op_ld_i_vx_incr : op_ld_i_vx;
+    case 0x0065:
+      return mem_incr ? op_ld_vx_i_incr : op_ld_vx_i;
+    default:
+      return op_unknown;
+    }
+  default:
+    return op_unknown;
+  }
+}
+
+// Fused idioms
+// The following instructions of the idiom are the entries at op + 2 and op + 4,
+// which are filled before the idiom gets fused. PC still points to the first
+// instruction when these run.
+
+// Fx07; 3xkk; 1nnn (waiting on the delay timer)
+static uint8_t fused_timer_poll(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] = chip8->DT;
+  if (chip8->V[op->x] == op[2].kk) {
+    chip8->PC += 6;
+    return 2;
+  }
+  chip8->PC = op[4].nnn;
+  return 3;
+}
+
+// Annn; Dxyn
+static uint8_t fused_sprite(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->I = op->nnn;
+  chip8->PC += 4;
+  op[2].handler(chip8, &op[2]);
+  return 2;
+}
+
+// 6xkk; 6ykk
+static uint8_t fused_load_pair(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] = op->kk;
+  chip8->V[op[2].x] = op[2].kk;
+  chip8->PC += 4;
+  return 2;
+}
+
+// 7xkk; 3xkk; 1nnn (loop counter)
+static uint8_t fused_counted_loop(chip8_t *chip8, const chip8_op_t *op) {
+  chip8->V[op->x] += op->kk;
+  if (chip8->V[op->x] == op[2].kk) {
+    chip8->PC += 6;
+    return 2;
+  }
+  chip8->PC = op[4].nnn;
+  return 3;
+}
+
+static inline uint16_t predecode_read(const chip8_t *chip8, uint16_t addr) {
+  return (uint16_t)((chip8->memory[addr & CHIP8_ADDR_MASK] << 8) +
+                    chip8->memory[(addr + 1u) & CHIP8_ADDR_MASK]);
+}
+
+static void predecode_fill(chip8_t *chip8, uint16_t addr) {
+  chip8_op_t *entry = &chip8->predecode->ops[addr];
+  uint16_t instruction = predecode_read(chip8, addr);
+  entry->instruction = instruction;
+  entry->nnn = instruction & 0x0FFF;
+  entry->x = (instruction & 0x0F00) >> 8;
+  entry->y = (instruction & 0x00F0) >> 4;
+  entry->kk = instruction & 0x00FF;
+  entry->n = instruction & 0x000F;
+  entry->handler = op_select(instruction, chip8->quirks);
+  entry->fused = NULL;
+  entry->fusion = CHIP8_FUSION_NONE;
+  entry->fused_length = 0;
+  chip8->predecode->decoded[addr / 8u] |= (uint8_t)(1u << (addr % 8u));
+}
+
+// Peephole over the code starting at addr, fuses the idiom found there
+static void predecode_fuse(chip8_t *chip8, uint16_t addr) {
+  if (addr + CHIP8_FUSION_SPAN > CHIP8_MEM_SIZE)
+    return;
+  uint16_t i0 = predecode_read(chip8, addr);
+  uint16_t i1 = predecode_read(chip8, addr + 2u);
+  uint16_t i2 = predecode_read(chip8, addr + 4u);
+  uint16_t x_mask = i0 & 0x0F00;
+  chip8_fusion_t fusion = CHIP8_FUSION_NONE;
+  chip8_fused_handler_t fused = NULL;
+  uint8_t length = 0;
+  if ((i0 & 0xF0FF) == 0xF007 && (i1 & 0xFF00) == (0x3000 | x_mask) &&
+      (i2 & 0xF000) == 0x1000) {
+    fusion = CHIP8_FUSION_TIMER_POLL;
+    fused = fused_timer_poll;
+    length = 3;
+  } else if ((i0 & 0xF000) == 0x7000 && (i1 & 0xFF00) == (0x3000 | x_mask) &&
+             (i2 & 0xF000) == 0x1000) {
+    fusion = CHIP8_FUSION_COUNTED_LOOP;
+    fused = fused_counted_loop;
+    length = 3;
+  } else if ((i0 & 0xF000) == 0xA000 && (i1 & 0xF000) == 0xD000) {
+    fusion = CHIP8_FUSION_SPRITE;
+    fused = fused_sprite;
+    length = 2;
+  } else if ((i0 & 0xF000) == 0x6000 && (i1 & 0xF000) == 0x6000) {
+    fusion = CHIP8_FUSION_LOAD_PAIR;
+    fused = fused_load_pair;
+    length = 2;
+  } else {
+    return;
+  }
+  // Followers first, the head's invalidation range covers them
+  for (uint8_t i = 1; i < length; i++) {
+    if (chip8->predecode->ops[addr + 2u * i].handler == op_decode)
+      predecode_fill(chip8, addr + 2u * i);
+  }
+  chip8_op_t *entry = &chip8->predecode->ops[addr];
+  entry->fused = fused;
+  entry->fusion = (uint8_t)fusion;
+  entry->fused_length = length;
+}
+
+// Fill the entry on its first execution and run it
+static void op_decode(chip8_t *chip8, const chip8_op_t *op) {
+  uint16_t addr = (uint16_t)(op - chip8->predecode->ops);
+  chip8_op_t *entry = &chip8->predecode->ops[addr];
+  predecode_fill(chip8, addr);
+  if (chip8->predecode->fuse)
+    predecode_fuse(chip8, addr);
+  entry->handler(chip8, entry);
+}
+
+void chip8_predecode_flush(chip8_t *chip8) {
+  if (!chip8->predecode)
+    return;
+  for (uint16_t addr = 0; addr < CHIP8_MEM_SIZE; addr++) {
+    chip8->predecode->ops[addr].handler = op_decode;
+    chip8->predecode->ops[addr].fused = NULL;
+  }
+  memset(chip8->predecode->decoded, 0, sizeof(chip8->predecode->decoded));
+}
+
+void chip8_predecode_set_fusion(chip8_t *chip8, uint8_t enable) {
+  if (!chip8->predecode)
+    return;
+  chip8->predecode->fuse = enable ? 1 : 0;
+  chip8_predecode_flush(chip8);
+}
+
+void chip8_predecode_print_fusion(chip8_t *chip8) {
+  static const char *const names[CHIP8_FUSION_COUNT] = {
+      [CHIP8_FUSION_NONE] = "none",
+      [CHIP8_FUSION_TIMER_POLL] = "Fx07; 3xkk; 1nnn (timer poll)",
+      [CHIP8_FUSION_SPRITE] = "Annn; Dxyn (sprite draw)",
+      [CHIP8_FUSION_LOAD_PAIR] = "6xkk; 6ykk (register setup)",
+      [CHIP8_FUSION_COUNTED_LOOP] = "7xkk; 3xkk; 1nnn (counted loop)"};
+  if (!chip8->predecode)
+    return;
+  printf("Fused idiom hits\n");
+  for (int i = CHIP8_FUSION_NONE + 1; i < CHIP8_FUSION_COUNT; i++)
+    printf("  %-34s %llu\n", names[i],
+           (unsigned long long)chip8->predecode->fusion_hits[i]);
+}
+
+void chip8_predecode_attach(chip8_t *chip8, chip8_predecode_t *predecode) {
+  chip8->predecode = predecode;
+  chip8_predecode_flush(chip8);
+}
+
+void chip8_set_quirks(chip8_t *chip8, uint8_t quirks) {
+  chip8->quirks = quirks & CHIP8_QUIRK_MASK;
+  chip8_predecode_flush(chip8); // Handlers depend on the quirks
+}
+
+int chip8_parse_profile(const char *str, uint8_t *quirks) {
+  if (strcasecmp(str, "vip") == 0) {
+    *quirks = CHIP8_PROFILE_VIP;
+  } else if (strcasecmp(str, "modern") == 0) {
+    *quirks = CHIP8_PROFILE_MODERN;
+  } else if (strcasecmp(str, "timendous") == 0) {
+    *quirks = CHIP8_PROFILE_TIMENDOUS;
+  } else {
+    char *end;
+    unsigned long mask = strtoul(str, &end, 0);
+    if (*str == '\0' || *end != '\0' || mask > CHIP8_QUIRK_MASK)
+      return -1;
+    *quirks = (uint8_t)mask;
+  }
+  return 0;
+}
+
+// Specialized interpreters
+// One chip8_step copy per quirk combination, all of them come from
+// chip8_decode_execute with a constant quirks
+#define CHIP8_QUIRK_SETS(X)                                                    \
+  X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7)                                      \
+  X(8) X(9) X(10) X(11) X(12) X(13) X(14) X(15)                                \
+  X(16) X(17) X(18) X(19) X(20) X(21) X(22) X(23)                              \
+  X(24) X(25) X(26) X(27) X(28) X(29) X(30) X(31)                              \
+  X(32) X(33) X(34) X(35) X(36) X(37) X(38) X(39)                              \
+  X(40) X(41) X(42) X(43) X(44) X(45) X(46) X(47)                              \
+  X(48) X(49) X(50) X(51) X(52) X(53) X(54) X(55)                              \
+  X(56) X(57) X(58) X(59) X(60) X(61) X(62) X(63)
+
+#define CHIP8_DEFINE_STEP(q)                                                   \
+  static void chip8_step_q##q(chip8_t *chip8) {                                \
+    chip8_decode_execute(chip8, chip8_fetch(chip8), q##u);                     \
+  }
+CHIP8_QUIRK_SETS(CHIP8_DEFINE_STEP)
+
+#define CHIP8_STEP_ENTRY(q) chip8_step_q##q,
+static void (*const chip8_step_quirks[CHIP8_QUIRK_MASK + 1u])(chip8_t *) = {
+    CHIP8_QUIRK_SETS(CHIP8_STEP_ENTRY)};
+
+// Queue every pending event into the ring
+uint8_t chip8_commit_events(chip8_t *chip8, uint16_t pc) {
+  uint8_t events = chip8->pending_events;
+  for (uint8_t type = 1; type && type <= events; type = (uint8_t)(type << 1)) {
+    if (!(events & type))
+      continue;
+    chip8_event_t *event = &chip8->events[chip8->event_head];
+    event->cycle = chip8->cycles;
+    event->pc = pc & CHIP8_ADDR_MASK; // Where it was fetched from
+    event->type = type;
+    chip8->event_head = (chip8->event_head + 1u) % CHIP8_EVENT_RING_SIZE;
+    if (chip8->event_head == chip8->event_tail) // Full, drop the oldest
+      chip8->event_tail = (chip8->event_tail + 1u) % CHIP8_EVENT_RING_SIZE;
+  }
+  chip8->pending_events = 0;
+  chip8->last_events = events;
+  return events;
+}
+
+int chip8_poll_event(chip8_t *chip8, chip8_event_t *event) {
+  if (chip8->event_tail == chip8->event_head)
+    return 0;
+  *event = chip8->events[chip8->event_tail];
+  chip8->event_tail = (chip8->event_tail + 1u) % CHIP8_EVENT_RING_SIZE;
+  return 1;
+}
+
+// Idle loops, the only ways out are DT, the keys or VBlank (which do not change
+// during a batch) and nothing gets written, so the rest of the batch can be
+// skipped leaving the same state stepping through it would:
+//   1nnn/Bnnn to itself
+//   Fx07; 3xkk/4xkk; 1nnn to the Fx07 (DT poll)
+//   Ex9E/ExA1; 1nnn to the Ex9E/ExA1 (key poll)
+uint32_t chip8_idle_skip(chip8_t *chip8, uint32_t remaining) {
+  uint16_t head = chip8->PC;
+  if (!remaining || head > CHIP8_MEM_SIZE - 6u)
+    return 0;
+  const uint8_t *code = &chip8->memory[head];
+  uint16_t i0 = (uint16_t)((code[0] << 8) | code[1]);
+  uint16_t i1 = (uint16_t)((code[2] << 8) | code[3]);
+  uint16_t i2 = (uint16_t)((code[4] << 8) | code[5]);
+  uint16_t jp_head = (uint16_t)(0x1000u | head);
+  uint8_t x = (i0 & 0x0F00) >> 8;
+  uint8_t length; // Instructions in the loop
+
+  if (i0 == jp_head) {
+    length = 1;
+  } else if ((i0 & 0xF000) == 0xB000) {
+    uint16_t addr = i0 & 0x0FFF;
+    uint8_t offset = (chip8->quirks & CHIP8_QUIRK_JUMP_USE_VX)
+                         ? chip8->V[(addr & 0x0F00) >> 8]
+                         : chip8->V[0];
+    if (addr + offset != head)
+      return 0;
+    length = 1;
+  } else if ((i0 & 0xF0FF) == 0xF007 && i2 == jp_head &&
+             (i1 & 0x0F00) >> 8 == x) {
+    uint8_t kk = i1 & 0x00FF;
+    if (!(((i1 & 0xF000) == 0x3000 && chip8->DT != kk) ||
+          ((i1 & 0xF000) == 0x4000 && chip8->DT == kk)))
+      return 0;
+    chip8->V[x] = chip8->DT; // Whatever the phase, Fx07 runs at least once
+    length = 3;
+  } else if ((i0 & 0xF000) == 0xE000 && i1 == jp_head) {
+    uint8_t pressed = chip8_key_pressed(chip8, chip8->V[x]);
+    if (!(((i0 & 0x00FF) == 0x9E && !pressed) ||
+          ((i0 & 0x00FF) == 0xA1 && pressed)))
+      return 0;
+    length = 2;
+  } else {
+    return 0;
+  }
+
+  chip8->PC = (uint16_t)(head + 2u * (remaining % length));
+  chip8->idle_cycles += remaining;
+  return remaining;
+}
+
+// Drop what the attached engines cached from the memory an instruction run by
+// the plain interpreter wrote (Fx33 and Fx55 at addr, the I it started with),
+// for the tracer, the profiler and chip8_step that run it with them attached
+static inline void interpreted_store(chip8_t *chip8, uint16_t opcode,
+                                     uint16_t addr) {
+  uint16_t len;
+  if ((opcode & 0xF0FF) == 0xF033)
+    len = 3;
+  else if ((opcode & 0xF0FF) == 0xF055)
+    len = (uint16_t)(((opcode & 0x0F00u) >> 8) + 1u);
+  else
+    return;
+  if (chip8->predecode)
+    predecode_invalidate(chip8, addr, len);
+  if (chip8->jit)
+    chip8_jit_invalidate(chip8->jit, addr, len);
+}
+
 // Execute a single instruction
-void chip8_step(chip8_t *chip8) {
-  chip8_decode_execute(chip8, chip8_fetch(chip8));
+uint8_t chip8_step(chip8_t *chip8) {
+  uint16_t pc = chip8->PC;
+  if (chip8->trace) {
+    uint16_t opcode = chip8_opcode_at(chip8, pc);
+    uint8_t V[16];
+    uint16_t I = chip8->I;
+    memcpy(V, chip8->V, sizeof(V));
+    chip8_step_quirks[chip8->quirks & CHIP8_QUIRK_MASK](chip8);
+    interpreted_store(chip8, opcode, I);
+    chip8_trace_instruction(chip8->trace, chip8, chip8->cycles, pc, opcode, V);
+  } else {
+    // The JIT's code only goes stale through here when it is attached
+    uint16_t opcode = chip8->jit ? chip8_opcode_at(chip8, pc) : 0;
+    uint16_t I = chip8->I;
+    if (chip8->predecode) {
+      const chip8_op_t *op = &chip8->predecode->ops[pc & CHIP8_ADDR_MASK];
+      chip8->PC += 2;
+      op->handler(chip8, op);
+    } else {
+      chip8_step_quirks[chip8->quirks & CHIP8_QUIRK_MASK](chip8);
+    }
+    if (chip8->jit)
+      interpreted_store(chip8, opcode, I);
+  }
+  chip8->cycles++;
+  if (chip8->pending_events)
+    return chip8_commit_events(chip8, pc);
+  return 0;
+}
+
+// Plain interpreter batch, traced and profiled are always constants so the
+// plain copy has no instrumentation at all
+static CHIP8_ALWAYS_INLINE uint32_t chip8_run_steps(chip8_t *chip8,
+                                                    uint32_t max_cycles,
+                                                    const int traced,
+                                                    const int profiled) {
+  void (*const step)(chip8_t *) =
+      chip8_step_quirks[chip8->quirks & CHIP8_QUIRK_MASK];
+  uint32_t cycles = 0;
+  while (cycles < max_cycles) {
+    uint16_t pc = chip8->PC;
+    if (traced || profiled) {
+      uint16_t opcode = chip8_opcode_at(chip8, pc);
+      uint16_t I = chip8->I;
+      uint8_t V[16];
+      if (traced)
+        memcpy(V, chip8->V, sizeof(V));
+      step(chip8);
+      interpreted_store(chip8, opcode, I);
+      if (traced)
+        chip8_trace_instruction(chip8->trace, chip8, chip8->cycles + cycles,
+                                pc, opcode, V);
+      if (profiled)
+        chip8_profile_instruction(chip8->profile, pc, opcode);
+    } else {
+      step(chip8);
+    }
+    cycles++;
+    if (chip8->pending_events) {
+      chip8->cycles += cycles;
+      chip8_commit_events(chip8, pc);
+      return cycles;
+    }
+    if (chip8->PC <= pc) { // Jumped back, maybe into an idle loop
+      uint32_t skipped = chip8_idle_skip(chip8, max_cycles - cycles);
+      cycles += skipped;
+      if (profiled)
+        chip8->profile->idle += skipped;
+    }
+  }
+  chip8->cycles += cycles;
+  return cycles;
+}
+
+static uint32_t chip8_run_interpreted(chip8_t *chip8, uint32_t max_cycles) {
+  return chip8_run_steps(chip8, max_cycles, 0, 0);
+}
+
+static uint32_t chip8_run_traced(chip8_t *chip8, uint32_t max_cycles) {
+  return chip8_run_steps(chip8, max_cycles, 1, 0);
+}
+
+static uint32_t chip8_run_profiled(chip8_t *chip8, uint32_t max_cycles) {
+  return chip8_run_steps(chip8, max_cycles, 0, 1);
+}
+
+// Predecoded batch, fused idioms run when the whole idiom fits in the batch
+static uint32_t chip8_run_predecoded(chip8_t *chip8, uint32_t max_cycles) {
+  chip8_predecode_t *predecode = chip8->predecode;
+  uint32_t cycles = 0;
+  while (cycles < max_cycles) {
+    uint16_t pc = chip8->PC;
+    const chip8_op_t *op = &predecode->ops[pc & CHIP8_ADDR_MASK];
+    if (op->fused && max_cycles - cycles >= op->fused_length) {
+      predecode->fusion_hits[op->fusion]++;
+      cycles += op->fused(chip8, op);
+    } else {
+      chip8->PC += 2;
+      op->handler(chip8, op);
+      cycles++;
+    }
+    if (chip8->pending_events) {
+      chip8->cycles += cycles;
+      chip8_commit_events(chip8, pc);
+      return cycles;
+    }
+    if (chip8->PC <= pc) // Jumped back, maybe into an idle loop
+      cycles += chip8_idle_skip(chip8, max_cycles - cycles);
+  }
+  chip8->cycles += cycles;
+  return cycles;
+}
+
+// Execute a batch of instructions
+uint32_t chip8_run(chip8_t *chip8, uint32_t max_cycles) {
+  uint32_t cycles;
+  chip8->last_events = 0;
+  const int profiled =
+      !chip8->trace && chip8->profile && chip8_profile_sample(chip8->profile);
+  if (chip8->trace)
+    cycles = chip8_run_traced(chip8, max_cycles);
+  else if (profiled)
+    cycles = chip8_run_profiled(chip8, max_cycles);
+  else if (chip8->jit)
+    cycles = chip8_jit_run(chip8->jit, chip8, max_cycles);
+  else if (chip8->predecode)
+    cycles = chip8_run_predecoded(chip8, max_cycles);
+  else
+    cycles = chip8_run_interpreted(chip8, max_cycles);
+  // Nothing changes while blocked until the host steps in, skip the spinning
+  if (cycles < max_cycles && (chip8->last_events & CHIP8_EVENT_BLOCKED)) {
+    if (profiled && (chip8->last_events & CHIP8_EVENT_KEY_WAIT))
+      chip8->profile->blocked_key += max_cycles - cycles;
+    else if (profiled)
+      chip8->profile->blocked_vblank += max_cycles - cycles;
+    chip8->cycles += max_cycles - cycles;
+    cycles = max_cycles;
+  }
+  return cycles;
 }
@@ -0,0 +1,61 @@
+#include <assert.h>
+#include <chip8.h>
+#include <chip8_arena.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int chip8_arena_initialize(chip8_arena_t *arena, uint32_t capacity) {
+  memset(arena, 0, sizeof(*arena));
+  size_t size = (size_t)capacity * sizeof(chip8_t);
+  if (!capacity || size / sizeof(chip8_t) != capacity) {
+    printf("Arena Error: cannot hold %u instances\n", capacity);
+    return 1;
+  }
+  // Over-allocated by a line so the first instance can be aligned
+  arena->block = malloc(size + CHIP8_CACHE_LINE - 1u);
+  if (!arena->block) {
+    printf("Arena Error: out of memory\n");
+    return 1;
+  }
+  uintptr_t address = (uintptr_t)arena->block;
+  address = (address + CHIP8_CACHE_LINE - 1u) &
+            ~(uintptr_t)(CHIP8_CACHE_LINE - 1u);
+  arena->instances = (chip8_t *)address;
+  // A slot per host page, malloc leaves the pages untouched until written
+  arena->ram_block =
+      malloc((size_t)capacity * CHIP8_MEM_SIZE + CHIP8_MEM_SIZE - 1u);
+  if (!arena->ram_block) {
+    printf("Arena Error: out of memory\n");
+    chip8_arena_destroy(arena);
+    return 1;
+  }
+  address = (uintptr_t)arena->ram_block;
+  address =
+      (address + CHIP8_MEM_SIZE - 1u) & ~(uintptr_t)(CHIP8_MEM_SIZE - 1u);
+  arena->ram = (uint8_t *)address;
+  arena->capacity = capacity;
+  return 0;
+}
+
+void chip8_arena_destroy(chip8_arena_t *arena) {
+  free(arena->block);
+  free(arena->ram_block);
+  memset(arena, 0, sizeof(*arena));
+}
+
+chip8_t *chip8_arena_alloc(chip8_arena_t *arena, uint32_t count) {
+  if (!count || count > arena->capacity - arena->used)
+    return NULL;
+  chip8_t *instances = &arena->instances[arena->used];
+  arena->used += count;
+  return instances;
+}
+
+uint8_t *chip8_arena_ram(const chip8_arena_t *arena, const chip8_t *chip8) {
+  assert(chip8 >= arena->instances && chip8 < arena->instances + arena->used);
+  return &arena->ram[(size_t)(chip8 - arena->instances) * CHIP8_MEM_SIZE];
+}
+
+void chip8_arena_reset(chip8_arena_t *arena) { arena->used = 0; }
@@ -0,0 +1,80 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+#include <chip8.h>
+#include <chip8_headless.h>
+#include <chip8_movie.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+void chip8_headless_initialize(chip8_headless_t *chip8_headless, uint32_t frames,
+                               uint32_t cycles_per_frame) {
+  chip8_headless->frames = frames;
+  chip8_headless->cycles_per_frame = cycles_per_frame;
+  chip8_headless->hash_frames = NULL;
+  chip8_headless->hash_frame_count = 0;
+  chip8_headless->movie = NULL;
+  chip8_headless->movie_replay = 0;
+  chip8_headless->instructions = 0;
+  chip8_headless->seconds = 0.0;
+}
+
+static double headless_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static void headless_print_hash(chip8_t *chip8, uint32_t frame) {
+  printf("frame %u hash %016llx\n", frame,
+         (unsigned long long)chip8_display_hash(
+             (const chip8_display_t *)&chip8->display));
+}
+
+// Same loop as chip8_sdl_run, minus the input, drawing and delay
+void chip8_headless_run(chip8_t *chip8, chip8_headless_t *chip8_headless) {
+  const uint32_t cycles_per_frame = chip8_headless->cycles_per_frame;
+  uint32_t next_hash = 0;
+  uint64_t start_cycles = chip8->cycles;
+  double start_seconds = headless_seconds();
+
+  for (uint32_t frame = 1; frame <= chip8_headless->frames; frame++) {
+    if (chip8_headless->movie && chip8_headless->movie_replay) {
+      chip8_movie_run_frame(chip8_headless->movie, chip8, frame,
+                            cycles_per_frame);
+    } else {
+      // chip8_run returns early on events, keep going until the frame is done
+      for (uint32_t cycles = 0; cycles < cycles_per_frame;)
+        cycles += chip8_run(chip8, cycles_per_frame - cycles);
+    }
+    // Only unknown instructions are worth reporting
+    chip8_event_t event;
+    while (chip8_poll_event(chip8, &event)) {
+      if (event.type == CHIP8_EVENT_UNKNOWN_OPCODE)
+        printf("Unknown Instruction found: %04x at 0x%03x\n",
+               chip8_opcode_at(chip8, event.pc), event.pc);
+    }
+    chip8_frame_end(chip8);
+
+    while (next_hash < chip8_headless->hash_frame_count &&
+           chip8_headless->hash_frames[next_hash] <= frame) {
+      if (chip8_headless->hash_frames[next_hash] == frame)
+        headless_print_hash(chip8, frame);
+      next_hash++;
+    }
+  }
+
+  chip8_headless->seconds = headless_seconds() - start_seconds;
+  chip8_headless->instructions = chip8->cycles - start_cycles;
+  if (chip8_headless->movie && !chip8_headless->movie_replay)
+    chip8_movie_end(chip8_headless->movie, chip8_headless->frames, chip8);
+  if (!chip8_headless->hash_frame_count)
+    headless_print_hash(chip8, chip8_headless->frames);
+  printf("%u frames, %llu instructions in %.3f s", chip8_headless->frames,
+         (unsigned long long)chip8_headless->instructions,
+         chip8_headless->seconds);
+  if (chip8_headless->seconds > 0.0)
+    printf(" (%.1f M instructions/s)",
+           (double)chip8_headless->instructions / chip8_headless->seconds /
+               1e6);
+  printf("\n");
+}
@@ -0,0 +1,637 @@
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#include <assert.h>
+#include <chip8.h>
+#include <chip8_jit.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+
+// Compiled blocks are called as void block(chip8_t *chip8), so the chip8 is
+// in rdi during the whole block and every register access is [rdi + disp32].
+// Only rax, rcx, rdx and rsi (memory, for Fx33, Fx55 and Fx65) are used, no
+// stack and no calls.
+
+typedef void (*chip8_jit_code_t)(chip8_t *chip8);
+
+// Worst case bytes emitted by one instruction (Fx55 of 15 registers takes
+// 126), the block epilogue (10) counts as one more
+#define JIT_MAX_INSTRUCTION_BYTES 128u
+#define JIT_MAX_BLOCK_BYTES                                                    \
+  ((CHIP8_JIT_MAX_BLOCK + 1u) * JIT_MAX_INSTRUCTION_BYTES)
+
+// x86 register numbers used in ModRM
+#define REG_AL 0u
+#define REG_CL 1u
+#define REG_DL 2u
+#define REG_SI 6u  // rsi with REX.W
+#define REG_OP7 7u // /7 opcode extension (cmp)
+
+#define OFF_PC ((int32_t)offsetof(chip8_t, PC))
+#define OFF_I ((int32_t)offsetof(chip8_t, I))
+#define OFF_DT ((int32_t)offsetof(chip8_t, DT))
+#define OFF_KEYS ((int32_t)offsetof(chip8_t, keys))
+#define OFF_SP ((int32_t)offsetof(chip8_t, SP))
+#define OFF_STACK ((int32_t)offsetof(chip8_t, stack))
+#define OFF_MEMORY ((int32_t)offsetof(chip8_t, memory))
+#define OFF_V(x) ((int32_t)offsetof(chip8_t, V) + (int32_t)(x))
+
+// What emitting an instruction did
+typedef enum {
+  EMIT_NONE, // Not compiled, the block ends before it
+  EMIT_OK,   // Compiled, the block goes on
+  EMIT_END   // Compiled and it ends the block (PC already stored)
+} emit_result_t;
+
+static inline void emit8(uint8_t **p, uint8_t byte) { *(*p)++ = byte; }
+
+static inline void emit16(uint8_t **p, uint16_t value) {
+  emit8(p, (uint8_t)value);
+  emit8(p, (uint8_t)(value >> 8));
+}
+
+static inline void emit32(uint8_t **p, uint32_t value) {
+  emit16(p, (uint16_t)value);
+  emit16(p, (uint16_t)(value >> 16));
+}
+
+// ModRM for [rdi + disp32]
+static inline void emit_mem(uint8_t **p, uint8_t reg, int32_t disp) {
+  emit8(p, (uint8_t)(0x87u | ((unsigned)reg << 3)));
+  emit32(p, (uint32_t)disp);
+}
+
+// op r8, [rdi + disp32]
+static inline void emit_op_reg_mem(uint8_t **p, uint8_t opcode, uint8_t reg,
+                                   int32_t disp) {
+  emit8(p, opcode);
+  emit_mem(p, reg, disp);
+}
+
+// mov byte [rdi + disp32], imm8
+static inline void emit_store_imm8(uint8_t **p, int32_t disp, uint8_t imm) {
+  emit8(p, 0xC6);
+  emit_mem(p, 0, disp);
+  emit8(p, imm);
+}
+
+// mov word [rdi + disp32], imm16
+static inline void emit_store_imm16(uint8_t **p, int32_t disp, uint16_t imm) {
+  emit8(p, 0x66);
+  emit8(p, 0xC7);
+  emit_mem(p, 0, disp);
+  emit16(p, imm);
+}
+
+// movzx e(reg), byte [rdi + disp32]
+static inline void emit_movzx(uint8_t **p, uint8_t reg, int32_t disp) {
+  emit8(p, 0x0F);
+  emit8(p, 0xB6);
+  emit_mem(p, reg, disp);
+}
+
+// Store the PC and return
+static inline void emit_exit(uint8_t **p, uint16_t pc) {
+  emit_store_imm16(p, OFF_PC, pc);
+  emit8(p, 0xC3); // ret
+}
+
+// Flags are already set, PC = condition ? skip : next and return
+static inline void emit_skip_exit(uint8_t **p, uint8_t cmov, uint16_t next) {
+  emit8(p, 0xB8); // mov eax, next
+  emit32(p, next);
+  emit8(p, 0xB9); // mov ecx, next + 2
+  emit32(p, next + 2u);
+  emit8(p, 0x0F); // cmovcc eax, ecx
+  emit8(p, cmov);
+  emit8(p, 0xC1);
+  emit8(p, 0x66); // mov word [rdi + PC], ax
+  emit_op_reg_mem(p, 0x89, REG_AL, OFF_PC);
+  emit8(p, 0xC3); // ret
+}
+
+#define CMOVB 0x42
+#define CMOVAE 0x43
+#define CMOVE 0x44
+#define CMOVNE 0x45
+
+// mov rsi, [rdi + memory], writable when the block stores (see chip8_jit_run)
+static inline void emit_load_memory(uint8_t **p) {
+  emit8(p, 0x48);
+  emit_op_reg_mem(p, 0x8B, REG_SI, OFF_MEMORY);
+}
+
+// edx = (I + offset) & 0xFFF, the memory address like the interpreter's
+static inline void emit_address(uint8_t **p, uint8_t offset) {
+  emit8(p, 0x0F); // movzx edx, word [rdi + I]
+  emit8(p, 0xB7);
+  emit_mem(p, REG_DL, OFF_I);
+  if (offset) {
+    emit8(p, 0x83); // add edx, offset
+    emit8(p, 0xC2);
+    emit8(p, offset);
+  }
+  emit8(p, 0x81); // and edx, 0xFFF
+  emit8(p, 0xE2);
+  emit32(p, CHIP8_MEM_SIZE - 1u);
+}
+
+// Size prefix and opcode of a size byte mov, opcode is the 32 bit one
+static inline void emit_sized(uint8_t **p, uint8_t size, uint8_t opcode) {
+  if (size == 2)
+    emit8(p, 0x66);
+  else if (size == 8)
+    emit8(p, 0x48); // REX.W
+  emit8(p, size == 1 ? (uint8_t)(opcode - 1u) : opcode);
+}
+
+// Fx55 (store) and Fx65, V0 to Vx from or to memory at I. When they do not
+// wrap around memory they move through rax 8, 4, 2 and 1 bytes at a time,
+// else a byte at a time with the address masked like the interpreter's
+static inline void emit_copy_registers(uint8_t **p, uint8_t x, int store,
+                                       unsigned quirks) {
+  emit_load_memory(p);
+  emit_address(p, 0);
+  emit8(p, 0x81); // cmp edx, 0xFFF - x
+  emit8(p, 0xFA);
+  emit32(p, CHIP8_MEM_SIZE - 1u - x);
+  emit8(p, 0x77); // ja wraps
+  uint8_t *wraps = (*p)++;
+  for (uint8_t offset = 0; offset <= x;) {
+    uint8_t left = (uint8_t)(x + 1u - offset);
+    uint8_t size = left >= 8 ? 8 : left >= 4 ? 4 : left >= 2 ? 2 : 1;
+    if (store) {
+      emit_sized(p, size, 0x8B); // mov rax, [rdi + V + offset]
+      emit_mem(p, REG_AL, OFF_V(offset));
+    }
+    // mov [rsi + rdx + offset], rax (or rax, [rsi + rdx + offset])
+    emit_sized(p, size, store ? 0x89 : 0x8B);
+    emit8(p, 0x44);
+    emit8(p, 0x16);
+    emit8(p, offset);
+    if (!store) {
+      emit_sized(p, size, 0x89); // mov [rdi + V + offset], rax
+      emit_mem(p, REG_AL, OFF_V(offset));
+    }
+    offset = (uint8_t)(offset + size);
+  }
+  emit8(p, 0xEB); // jmp done
+  uint8_t *done = (*p)++;
+  *wraps = (uint8_t)(*p - (wraps + 1));
+  emit8(p, 0x31); // xor ecx, ecx
+  emit8(p, 0xC9);
+  const uint8_t *loop = *p;
+  emit8(p, 0x0F); // movzx edx, word [rdi + I]
+  emit8(p, 0xB7);
+  emit_mem(p, REG_DL, OFF_I);
+  emit8(p, 0x01); // add edx, ecx
+  emit8(p, 0xCA);
+  emit8(p, 0x81); // and edx, 0xFFF
+  emit8(p, 0xE2);
+  emit32(p, CHIP8_MEM_SIZE - 1u);
+  if (store) {
+    emit8(p, 0x8A); // mov al, [rdi + rcx + V]
+    emit8(p, 0x84);
+    emit8(p, 0x0F);
+    emit32(p, (uint32_t)OFF_V(0));
+    emit8(p, 0x88); // mov [rsi + rdx], al
+    emit8(p, 0x04);
+    emit8(p, 0x16);
+  } else {
+    emit8(p, 0x8A); // mov al, [rsi + rdx]
+    emit8(p, 0x04);
+    emit8(p, 0x16);
+    emit8(p, 0x88); // mov [rdi + rcx + V], al
+    emit8(p, 0x84);
+    emit8(p, 0x0F);
+    emit32(p, (uint32_t)OFF_V(0));
+  }
+  emit8(p, 0xFF); // inc ecx
+  emit8(p, 0xC1);
+  emit8(p, 0x83); // cmp ecx, x + 1
+  emit8(p, 0xF9);
+  emit8(p, (uint8_t)(x + 1u));
+  emit8(p, 0x75); // jne loop
+  emit8(p, (uint8_t)(loop - (*p + 1)));
+  *done = (uint8_t)(*p - (done + 1));
+  if (quirks & CHIP8_QUIRK_MEM_INCR) {
+    emit8(p, 0x66); // add word [rdi + I], x + 1
+    emit8(p, 0x83);
+    emit_mem(p, 0, OFF_I);
+    emit8(p, (uint8_t)(x + 1u));
+  }
+}
+
+// Store al into Vx and cl into VF (in this order, like the interpreter)
+static inline void emit_store_vx_vf(uint8_t **p, uint8_t x) {
+  emit_op_reg_mem(p, 0x88, REG_AL, OFF_V(x));
+  emit_op_reg_mem(p, 0x88, REG_CL, OFF_V(0xF));
+}
+
+// Emit one instruction, next is the address after it
+static emit_result_t emit_instruction(uint8_t **p, uint16_t instruction,
+                                      uint16_t next, unsigned quirks) {
+  uint8_t x = (instruction & 0x0F00) >> 8;
+  uint8_t y = (instruction & 0x00F0) >> 4;
+  uint8_t kk = instruction & 0x00FF;
+  uint16_t nnn = instruction & 0x0FFF;
+
+  switch (instruction & 0xF000) {
+  case 0x0000:
+    if (instruction != 0x00EE)
+      return EMIT_NONE;
+    // RET, the stack index wraps like the interpreter's SP % CHIP8_STACK_SIZE
+    emit_movzx(p, REG_AL, OFF_SP);
+    emit8(p, 0x89); // mov ecx, eax
+    emit8(p, 0xC1);
+    emit8(p, 0x83); // and ecx, 15
+    emit8(p, 0xE1);
+    emit8(p, CHIP8_STACK_SIZE - 1u);
+    emit8(p, 0x0F); // movzx edx, word [rdi + rcx * 2 + stack]
+    emit8(p, 0xB7);
+    emit8(p, 0x94);
+    emit8(p, 0x4F);
+    emit32(p, (uint32_t)OFF_STACK);
+    emit8(p, 0x66); // mov word [rdi + PC], dx
+    emit_op_reg_mem(p, 0x89, REG_DL, OFF_PC);
+    emit8(p, 0xFE); // dec al
+    emit8(p, 0xC8);
+    emit_op_reg_mem(p, 0x88, REG_AL, OFF_SP);
+    emit8(p, 0xC3); // ret
+    return EMIT_END;
+  case 0x1000: // JP addr
+    emit_exit(p, nnn);
+    return EMIT_END;
+  case 0x2000: // CALL addr
+    emit_movzx(p, REG_AL, OFF_SP);
+    emit8(p, 0xFE); // inc al
+    emit8(p, 0xC0);
+    emit_op_reg_mem(p, 0x88, REG_AL, OFF_SP);
+    emit8(p, 0x83); // and eax, 15
+    emit8(p, 0xE0);
+    emit8(p, CHIP8_STACK_SIZE - 1u);
+    emit8(p, 0x66); // mov word [rdi + rax * 2 + stack], next
+    emit8(p, 0xC7);
+    emit8(p, 0x84);
+    emit8(p, 0x47);
+    emit32(p, (uint32_t)OFF_STACK);
+    emit16(p, next);
+    emit_exit(p, nnn);
+    return EMIT_END;
+  case 0x3000: // SE Vx, byte
+  case 0x4000: // SNE Vx, byte
+    emit8(p, 0x80); // cmp byte [Vx], kk
+    emit_mem(p, REG_OP7, OFF_V(x));
+    emit8(p, kk);
+    emit_skip_exit(p, (instruction & 0xF000) == 0x3000 ? CMOVE : CMOVNE, next);
+    return EMIT_END;
+  case 0x5000: // SE Vx, Vy
+  case 0x9000: // SNE Vx, Vy
+    if (instruction & 0x000F)
+      return EMIT_NONE;
+    emit_op_reg_mem(p, 0x8A, REG_DL, OFF_V(x)); // mov dl, [Vx]
+    emit_op_reg_mem(p, 0x3A, REG_DL, OFF_V(y)); // cmp dl, [Vy]
+    emit_skip_exit(p, (instruction & 0xF000) == 0x5000 ? CMOVE : CMOVNE, next);
+    return EMIT_END;
+  case 0x6000: // LD Vx, byte
+    emit_store_imm8(p, OFF_V(x), kk);
+    return EMIT_OK;
+  case 0x7000: // ADD Vx, byte
+    emit8(p, 0x80);
+    emit_mem(p, 0, OFF_V(x));
+    emit8(p, kk);
+    return EMIT_OK;
+  case 0x8000:
+    switch (instruction & 0x000F) {
+    case 0x0: // LD Vx, Vy
+      emit_op_reg_mem(p, 0x8A, REG_AL, OFF_V(y));
+      emit_op_reg_mem(p, 0x88, REG_AL, OFF_V(x));
+      return EMIT_OK;
+    case 0x1: // OR Vx, Vy
+    case 0x2: // AND Vx, Vy
+    case 0x3: { // XOR Vx, Vy
+      static const uint8_t ops[4] = {0, 0x08, 0x20, 0x30};
+      emit_op_reg_mem(p, 0x8A, REG_AL, OFF_V(y));
+      emit_op_reg_mem(p, ops[instruction & 0x3], REG_AL, OFF_V(x));
+      if (quirks & CHIP8_QUIRK_VF_RESET)
+        emit_store_imm8(p, OFF_V(0xF), 0);
+      return EMIT_OK;
+    }
+    case 0x4: // ADD Vx, Vy
+      emit_op_reg_mem(p, 0x8A, REG_AL, OFF_V(x));
+      emit_op_reg_mem(p, 0x02, REG_AL, OFF_V(y)); // add al, [Vy]
+      emit8(p, 0x0F); // setc cl
+      emit8(p, 0x92);
+      emit8(p, 0xC1);
+      emit_store_vx_vf(p, x);
+      return EMIT_OK;
+    case 0x5: // SUB Vx, Vy
+    case 0x7: // SUBN Vx, Vy
+      emit_op_reg_mem(p, 0x8A, REG_AL, OFF_V((instruction & 0x2) ? y : x));
+      emit_op_reg_mem(p, 0x2A, REG_AL, OFF_V((instruction & 0x2) ? x : y));
+      emit8(p, 0x0F); // setnc cl
+      emit8(p, 0x93);
+      emit8(p, 0xC1);
+      emit_store_vx_vf(p, x);
+      return EMIT_OK;
+    case 0x6: // SHR Vx {, Vy}
+    case 0xE: // SHL Vx {, Vy}
+      emit_op_reg_mem(p, 0x8A, REG_AL,
+                      OFF_V((quirks & CHIP8_QUIRK_SHIFT_VX_ONLY) ? x : y));
+      emit8(p, 0x88); // mov cl, al
+      emit8(p, 0xC1);
+      if ((instruction & 0x000F) == 0x6) {
+        emit8(p, 0x80); // and cl, 1
+        emit8(p, 0xE1);
+        emit8(p, 0x01);
+        emit8(p, 0xD0); // shr al, 1
+        emit8(p, 0xE8);
+      } else {
+        emit8(p, 0xC0); // shr cl, 7
+        emit8(p, 0xE9);
+        emit8(p, 0x07);
+        emit8(p, 0xD0); // shl al, 1
+        emit8(p, 0xE0);
+      }
+      emit_store_vx_vf(p, x);
+      return EMIT_OK;
+    default:
+      return EMIT_NONE;
+    }
+  case 0xA000: // LD I, addr
+    emit_store_imm16(p, OFF_I, nnn);
+    return EMIT_OK;
+  case 0xE000: // SKP Vx, SKNP Vx
+    if (kk != 0x9E && kk != 0xA1)
+      return EMIT_NONE;
+    emit_movzx(p, REG_DL, OFF_V(x));
+    emit8(p, 0x83); // and edx, 15
+    emit8(p, 0xE2);
+    emit8(p, 0x0F);
+    emit8(p, 0x0F); // movzx eax, word [rdi + keys]
+    emit8(p, 0xB7);
+    emit_mem(p, REG_AL, OFF_KEYS);
+    emit8(p, 0x0F); // bt eax, edx (CF is the key)
+    emit8(p, 0xA3);
+    emit8(p, 0xD0);
+    emit_skip_exit(p, kk == 0x9E ? CMOVB : CMOVAE, next);
+    return EMIT_END;
+  case 0xF000:
+    switch (kk) {
+    case 0x07: // LD Vx, DT
+      emit_op_reg_mem(p, 0x8A, REG_AL, OFF_DT);
+      emit_op_reg_mem(p, 0x88, REG_AL, OFF_V(x));
+      return EMIT_OK;
+    case 0x15: // LD DT, Vx (Fx18 is left to the interpreter for sound events)
+      emit_op_reg_mem(p, 0x8A, REG_AL, OFF_V(x));
+      emit_op_reg_mem(p, 0x88, REG_AL, OFF_DT);
+      return EMIT_OK;
+    case 0x1E: // ADD I, Vx
+      emit_movzx(p, REG_AL, OFF_V(x));
+      emit8(p, 0x66); // add word [rdi + I], ax
+      emit_op_reg_mem(p, 0x01, REG_AL, OFF_I);
+      return EMIT_OK;
+    case 0x29: // LD F, Vx
+      emit_movzx(p, REG_AL, OFF_V(x));
+      emit8(p, 0x8D); // lea eax, [rax + rax * 4 + CHIP8_FONT_DATA_START]
+      emit8(p, 0x44);
+      emit8(p, 0x80);
+      emit8(p, (uint8_t)CHIP8_FONT_DATA_START);
+      emit8(p, 0x66); // mov word [rdi + I], ax
+      emit_op_reg_mem(p, 0x89, REG_AL, OFF_I);
+      return EMIT_OK;
+    case 0x33: // LD B, Vx, ends the block so chip8_jit_run checks what it wrote
+      emit_load_memory(p);
+      emit_movzx(p, REG_AL, OFF_V(x));
+      emit8(p, 0xB1); // mov cl, 100
+      emit8(p, 100);
+      emit8(p, 0xF6); // div cl (al = Vx / 100, ah = Vx % 100)
+      emit8(p, 0xF1);
+      emit_address(p, 0);
+      emit8(p, 0x88); // mov [rsi + rdx], al
+      emit8(p, 0x04);
+      emit8(p, 0x16);
+      emit8(p, 0x0F); // movzx eax, ah
+      emit8(p, 0xB6);
+      emit8(p, 0xC4);
+      emit8(p, 0xB1); // mov cl, 10
+      emit8(p, 10);
+      emit8(p, 0xF6); // div cl (al = tens, ah = ones)
+      emit8(p, 0xF1);
+      emit_address(p, 1);
+      emit8(p, 0x88); // mov [rsi + rdx], al
+      emit8(p, 0x04);
+      emit8(p, 0x16);
+      emit_address(p, 2);
+      emit8(p, 0x88); // mov [rsi + rdx], ah
+      emit8(p, 0x24);
+      emit8(p, 0x16);
+      emit_exit(p, next);
+      return EMIT_END;
+    case 0x55: // LD [I], Vx, ends the block like Fx33
+      emit_copy_registers(p, x, 1, quirks);
+      emit_exit(p, next);
+      return EMIT_END;
+    case 0x65: // LD Vx, [I]
+      emit_copy_registers(p, x, 0, quirks);
+      return EMIT_OK;
+    default:
+      return EMIT_NONE;
+    }
+  default:
+    return EMIT_NONE;
+  }
+}
+
+static inline void jit_mark(chip8_jit_t *jit, uint16_t addr) {
+  jit->translated[addr / 8u] |= (uint8_t)(1u << (addr % 8u));
+}
+
+static inline int jit_is_translated(const chip8_jit_t *jit, uint16_t addr) {
+  return (jit->translated[addr / 8u] >> (addr % 8u)) & 1;
+}
+
+// Translate the block starting at start
+static void jit_translate(chip8_jit_t *jit, const chip8_t *chip8,
+                          uint16_t start) {
+  if (jit->code_used + JIT_MAX_BLOCK_BYTES > CHIP8_JIT_CODE_SIZE)
+    chip8_jit_flush(jit);
+  mprotect(jit->code, CHIP8_JIT_CODE_SIZE, PROT_READ | PROT_WRITE);
+
+  uint8_t *begin = jit->code + jit->code_used;
+  uint8_t *p = begin;
+  uint16_t addr = start;
+  uint16_t length = 0;
+  emit_result_t result = EMIT_NONE;
+  uint16_t store = 0;
+  while (length < CHIP8_JIT_MAX_BLOCK && addr + 1u < CHIP8_MEM_SIZE) {
+    uint16_t instruction =
+        (uint16_t)((chip8->memory[addr] << 8) + chip8->memory[addr + 1]);
+    result = emit_instruction(&p, instruction, addr + 2u, jit->quirks);
+    assert((size_t)(p - begin) <= (length + 1u) * JIT_MAX_INSTRUCTION_BYTES);
+    if (result == EMIT_NONE)
+      break;
+    jit_mark(jit, addr);
+    jit_mark(jit, addr + 1u);
+    length++;
+    addr += 2;
+    if ((instruction & 0xF0FF) == 0xF033 || (instruction & 0xF0FF) == 0xF055)
+      store = instruction;
+    if (result == EMIT_END)
+      break;
+  }
+  if (length && result != EMIT_END)
+    emit_exit(&p, addr);
+
+  jit->blocks[start].code = begin; // Not NULL even when length is 0
+  jit->blocks[start].length = length;
+  jit->blocks[start].store = store;
+  jit->code_used += (size_t)(p - begin);
+  mprotect(jit->code, CHIP8_JIT_CODE_SIZE, PROT_READ | PROT_EXEC);
+}
+
+int chip8_jit_initialize(chip8_jit_t *jit) {
+  memset(jit, 0, sizeof(*jit));
+  void *code = mmap(NULL, CHIP8_JIT_CODE_SIZE, PROT_READ | PROT_EXEC,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    printf("JIT Error: could not allocate the code buffer\n");
+    return 1;
+  }
+  jit->code = code;
+  return 0;
+}
+
+void chip8_jit_destroy(chip8_jit_t *jit) {
+  if (jit->code)
+    munmap(jit->code, CHIP8_JIT_CODE_SIZE);
+  jit->code = NULL;
+}
+
+void chip8_jit_invalidate(chip8_jit_t *jit, uint16_t addr, uint16_t len) {
+  // Up to 16 bytes at a time, their bits are in the 3 bitmap bytes from addr's
+  while (len) {
+    uint16_t n = len < 16u ? len : 16u;
+    uint32_t bits = 0;
+    for (uint16_t i = 0; i < 3u; i++)
+      bits |= (uint32_t)jit->translated[(addr / 8u + i) %
+                                        sizeof(jit->translated)]
+              << (8u * i);
+    if ((bits >> (addr % 8u)) & ((1u << n) - 1u)) {
+      chip8_jit_flush(jit);
+      return;
+    }
+    addr = (uint16_t)(addr + n);
+    len = (uint16_t)(len - n);
+  }
+}
+
+void chip8_jit_flush(chip8_jit_t *jit) {
+  memset(jit->blocks, 0, sizeof(jit->blocks));
+  memset(jit->translated, 0, sizeof(jit->translated));
+  jit->code_used = 0;
+}
+
+// Drop the translated code the store ending a block (Fx33 or Fx55) wrote
+// over, if any, from the I it left
+static void jit_stored(chip8_jit_t *jit, const chip8_t *chip8,
+                       uint16_t store) {
+  uint16_t addr = chip8->I;
+  uint16_t len = 3;
+  if ((store & 0xF0FF) == 0xF055) {
+    len = (uint16_t)(((store & 0x0F00u) >> 8) + 1u);
+    if (jit->quirks & CHIP8_QUIRK_MEM_INCR)
+      addr = (uint16_t)(addr - len); // It moved I past them
+  }
+  chip8_jit_invalidate(jit, addr, len);
+}
+
+uint32_t chip8_jit_run(chip8_jit_t *jit, chip8_t *chip8, uint32_t max_cycles) {
+  if (jit->quirks != chip8->quirks) {
+    chip8_jit_flush(jit);
+    jit->quirks = chip8->quirks;
+  }
+  uint32_t cycles = 0;
+  while (cycles < max_cycles) {
+    uint16_t pc = chip8->PC;
+    if (pc + 1u < CHIP8_MEM_SIZE) {
+      chip8_jit_block_t *block = &jit->blocks[pc];
+      if (!block->code)
+        jit_translate(jit, chip8, pc);
+      if (block->length && max_cycles - cycles >= block->length) {
+        const uint16_t length = block->length;
+        const uint16_t store = block->store;
+        // Compiled stores write memory as is, it gets copied before the first
+        if (store && chip8->memory != chip8->ram)
+          chip8_memory_writable(chip8);
+        chip8_jit_code_t code;
+        memcpy(&code, &block->code, sizeof(code));
+        code(chip8);
+        cycles += length;
+        chip8->cycles += length;
+        if (store)
+          jit_stored(jit, chip8, store);
+        if (chip8->PC <= pc) { // Jumped back, maybe into an idle loop
+          uint32_t skipped = chip8_idle_skip(chip8, max_cycles - cycles);
+          cycles += skipped;
+          chip8->cycles += skipped;
+        }
+        continue;
+      }
+    }
+
+    // Interpreter, chip8_step watches the stores over translated code
+    uint8_t events = chip8_step(chip8);
+    cycles++;
+    if (events)
+      break;
+    if (chip8->PC <= pc) {
+      uint32_t skipped = chip8_idle_skip(chip8, max_cycles - cycles);
+      cycles += skipped;
+      chip8->cycles += skipped;
+    }
+  }
+  return cycles;
+}
+
+#else // Not x86-64
+
+int chip8_jit_initialize(chip8_jit_t *jit) {
+  memset(jit, 0, sizeof(*jit));
+  printf("JIT Error: only supported on x86-64\n");
+  return 1;
+}
+
+void chip8_jit_destroy(chip8_jit_t *jit) { (void)jit; }
+
+void chip8_jit_flush(chip8_jit_t *jit) { (void)jit; }
+
+void chip8_jit_invalidate(chip8_jit_t *jit, uint16_t addr, uint16_t len) {
+  (void)jit;
+  (void)addr;
+  (void)len;
+}
+
+uint32_t chip8_jit_run(chip8_jit_t *jit, chip8_t *chip8, uint32_t max_cycles) {
+  (void)jit;
+  uint32_t cycles = 0;
+  while (cycles < max_cycles) {
+    cycles++;
+    if (chip8_step(chip8))
+      break;
+  }
+  return cycles;
+}
+
+#endif // __x86_64__
+
+void chip8_jit_attach(chip8_t *chip8, chip8_jit_t *jit) {
+  chip8->jit = jit;
+  if (jit)
+    chip8_jit_flush(jit);
+  else
+    chip8_predecode_flush(chip8); // Compiled stores do not invalidate it
+}
@@ -0,0 +1,510 @@
+#include <chip8.h>
+#include <chip8_jit.h>
+#include <chip8_lanes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define LANES_ADDR_MASK (CHIP8_MEM_SIZE - 1u)
+
+// Lanes of bytes run at a time, 16 (SSE2) or 32 with AVX2. A 16 lane run
+// with AVX2 goes over lanes it does not have too, their mask is 0 and their
+// registers stay 0
+#ifdef __AVX2__
+#define LANES_CHUNK 32u
+#else
+#define LANES_CHUNK 16u
+#endif // __AVX2__
+typedef uint8_t lanes_u8_t __attribute__((vector_size(LANES_CHUNK)));
+
+static inline lanes_u8_t lanes_load(const uint8_t *p) {
+  lanes_u8_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline void lanes_store(uint8_t *p, lanes_u8_t v) {
+  memcpy(p, &v, sizeof(v));
+}
+
+static inline lanes_u8_t lanes_splat(uint8_t value) {
+  lanes_u8_t v;
+  memset(&v, value, sizeof(v));
+  return v;
+}
+
+// Write value into the lanes set in mask, keep the others
+static inline void lanes_store_masked(uint8_t *p, lanes_u8_t mask,
+                                      lanes_u8_t value) {
+  lanes_store(p, (value & mask) | (lanes_load(p) & ~mask));
+}
+
+// Comparisons give 0xFF or 0x00 per lane
+#define LANES_TRUE(cond) ((lanes_u8_t)(cond))
+
+int chip8_lanes_initialize(chip8_lanes_t *lanes, uint8_t count,
+                           uint8_t quirks) {
+  memset(lanes, 0, sizeof(*lanes));
+  if (count != 16u && count != 32u && count != 64u) {
+    printf("Lanes Error: %u lanes, has to be 16, 32 or 64\n", count);
+    return 1;
+  }
+  lanes->count = count;
+  lanes->quirks = quirks & CHIP8_QUIRK_MASK;
+  return 0;
+}
+
+int chip8_lanes_load(chip8_lanes_t *lanes, uint8_t lane, const chip8_t *chip8) {
+  if (lane >= lanes->count || chip8->quirks != lanes->quirks) {
+    printf("Lanes Error: cannot load lane %u\n", lane);
+    return 1;
+  }
+  for (uint8_t i = 0; i < 16; i++)
+    lanes->V[i][lane] = chip8->V[i];
+  lanes->keys[lane] = chip8->keys;
+#ifdef CHIP8_FX0A_RELEASE
+  lanes->previous_keys[lane] = chip8->previous_keys;
+#endif // CHIP8_FX0A_RELEASE
+  for (uint8_t i = 0; i < CHIP8_STACK_SIZE; i++)
+    lanes->stack[i][lane] = chip8->stack[i];
+  lanes->I[lane] = chip8->I;
+  lanes->PC[lane] = chip8->PC;
+  lanes->SP[lane] = chip8->SP;
+  lanes->DT[lane] = chip8->DT;
+  lanes->ST[lane] = chip8->ST;
+  lanes->vblank_ready[lane] = chip8->interface.vblank_ready;
+  lanes->rand[lane] = chip8->interface.rand;
+  lanes->rand_state[lane] = chip8->rand_state;
+  lanes->cycles[lane] = chip8->cycles;
+  for (uint8_t y = 0; y < CHIP8_DISPLAY_HEIGHT; y++) {
+    uint64_t row = 0;
+    for (uint8_t b = 0; b < CHIP8_DISPLAY_WIDTH / 8; b++)
+      row = (row << 8) | chip8->display[y][b];
+    lanes->display[lane][y] = row;
+  }
+  memcpy(lanes->memory[lane], chip8->memory, CHIP8_MEM_SIZE);
+  // Shared lanes skip comparing opcodes, a lane joins them if its memory is
+  // the same (or starts them if there are none)
+  lanes->shared[lane] = 1;
+  for (uint8_t l = 0; l < lanes->count; l++) {
+    if (l != lane && lanes->shared[l]) {
+      lanes->shared[lane] =
+          !memcmp(lanes->memory[lane], lanes->memory[l], CHIP8_MEM_SIZE);
+      break;
+    }
+  }
+  return 0;
+}
+
+void chip8_lanes_store(const chip8_lanes_t *lanes, uint8_t lane,
+                       chip8_t *chip8) {
+  for (uint8_t i = 0; i < 16; i++)
+    chip8->V[i] = lanes->V[i][lane];
+  chip8->keys = lanes->keys[lane];
+#ifdef CHIP8_FX0A_RELEASE
+  chip8->previous_keys = lanes->previous_keys[lane];
+#endif // CHIP8_FX0A_RELEASE
+  for (uint8_t i = 0; i < CHIP8_STACK_SIZE; i++)
+    chip8->stack[i] = lanes->stack[i][lane];
+  chip8->I = lanes->I[lane];
+  chip8->PC = lanes->PC[lane];
+  chip8->SP = lanes->SP[lane];
+  chip8->DT = lanes->DT[lane];
+  chip8->ST = lanes->ST[lane];
+  chip8->interface.vblank_ready = lanes->vblank_ready[lane];
+  chip8->cycles = lanes->cycles[lane];
+  chip8->rand_state = lanes->rand_state[lane];
+  for (uint8_t y = 0; y < CHIP8_DISPLAY_HEIGHT; y++) {
+    uint64_t row = lanes->display[lane][y];
+    for (uint8_t b = 0; b < CHIP8_DISPLAY_WIDTH / 8; b++)
+      chip8->display[y][b] = (uint8_t)(row >> (56u - 8u * b));
+  }
+  chip8_display_invalidate(chip8);
+  // Shared memory stays shared if the lane did not write to it
+  if (memcmp(chip8->memory, lanes->memory[lane], CHIP8_MEM_SIZE)) {
+    memcpy(chip8_memory_writable(chip8), lanes->memory[lane], CHIP8_MEM_SIZE);
+    chip8_predecode_flush(chip8);
+    if (chip8->jit)
+      chip8_jit_flush(chip8->jit);
+  }
+}
+
+void chip8_lanes_set_key(chip8_lanes_t *lanes, uint8_t lane, uint8_t key,
+                         uint8_t pressed) {
+  if (lane >= lanes->count || key >= 16)
+    return;
+  uint16_t bit = (uint16_t)(1u << key);
+  if (pressed)
+    lanes->keys[lane] |= bit;
+  else
+    lanes->keys[lane] &= (uint16_t)~bit;
+#ifdef CHIP8_FX0A_RELEASE
+  if (pressed) // Same as chip8_set_key
+    lanes->previous_keys[lane] |= bit;
+#endif // CHIP8_FX0A_RELEASE
+}
+
+void chip8_lanes_frame_end(chip8_lanes_t *lanes) {
+  memset(lanes->vblank_ready, 1, lanes->count);
+#ifdef CHIP8_FX0A_RELEASE
+  memcpy(lanes->previous_keys, lanes->keys, sizeof(lanes->keys));
+#endif // CHIP8_FX0A_RELEASE
+  const lanes_u8_t zero = lanes_splat(0);
+  for (uint8_t c = 0; c < lanes->count; c += LANES_CHUNK) {
+    // Timers go down by one unless they are 0 (true is 0xFF, so adding it)
+    lanes_u8_t dt = lanes_load(&lanes->DT[c]);
+    lanes_u8_t st = lanes_load(&lanes->ST[c]);
+    lanes_store(&lanes->DT[c], dt + LANES_TRUE(dt != zero));
+    lanes_store(&lanes->ST[c], st + LANES_TRUE(st != zero));
+  }
+}
+
+// Dxyn for one lane, a sprite row is one 64-bit XOR on the display row
+static void lanes_drw(chip8_lanes_t *lanes, uint8_t lane, uint16_t instruction) {
+  const unsigned quirks = lanes->quirks;
+  if (quirks & CHIP8_QUIRK_WAIT_VBLANK) {
+    if (!lanes->vblank_ready[lane]) {
+      lanes->PC[lane] -= 2;
+      return;
+    }
+    lanes->vblank_ready[lane] = 0;
+  }
+  uint8_t n = instruction & 0x000F;
+  uint8_t xpos = lanes->V[(instruction & 0x0F00) >> 8][lane] % CHIP8_DISPLAY_WIDTH;
+  uint8_t ypos = lanes->V[(instruction & 0x00F0) >> 4][lane] % CHIP8_DISPLAY_HEIGHT;
+  const uint8_t *memory = lanes->memory[lane];
+  uint64_t *display = lanes->display[lane];
+  uint16_t I = lanes->I[lane];
+  uint64_t collision = 0;
+
+  for (uint8_t row = 0; row < n; row++) {
+    if ((quirks & CHIP8_QUIRK_CLIP) && row >= CHIP8_DISPLAY_HEIGHT - ypos)
+      break; // It will CLIP on the bottom
+    uint64_t sprite = (uint64_t)memory[(I + row) & LANES_ADDR_MASK] << 56;
+    uint64_t bits = sprite >> xpos; // Off the right side is clipped
+    if (!(quirks & CHIP8_QUIRK_CLIP) && xpos)
+      bits |= sprite << (CHIP8_DISPLAY_WIDTH - xpos); // Or wrapped
+    uint64_t *line = &display[(ypos + row) % CHIP8_DISPLAY_HEIGHT];
+    collision |= *line & bits;
+    *line ^= bits;
+  }
+  lanes->V[0xF][lane] = collision ? 1 : 0;
+}
+
+// Fx0A for one lane
+static void lanes_ld_vx_k(chip8_lanes_t *lanes, uint8_t lane, uint8_t x) {
+#ifdef CHIP8_FX0A_RELEASE
+  unsigned ready = lanes->previous_keys[lane] & (uint16_t)~lanes->keys[lane];
+#else
+  unsigned ready = lanes->keys[lane];
+#endif /* ifdef CHIP8_FX0A_RELEASE */
+  if (ready) {
+    lanes->V[x][lane] = (uint8_t)__builtin_ctz(ready); // Lowest key first
+    return;
+  }
+  lanes->PC[lane] -= 2;
+}
+
+// Rest of the instructions, one lane at a time
+static void lanes_execute_lane(chip8_lanes_t *lanes, uint8_t lane,
+                               uint16_t instruction) {
+  const unsigned quirks = lanes->quirks;
+  uint8_t x = (instruction & 0x0F00) >> 8;
+  uint8_t kk = instruction & 0x00FF;
+  uint16_t nnn = instruction & 0x0FFF;
+  uint8_t *memory = lanes->memory[lane];
+  uint16_t I = lanes->I[lane];
+
+  switch (instruction & 0xF000) {
+  case 0x0000: // 00EE - RET (00E0 and 0nnn are done for every lane)
+    lanes->PC[lane] = lanes->stack[lanes->SP[lane] % CHIP8_STACK_SIZE][lane];
+    lanes->SP[lane]--;
+    break;
+  case 0x2000: // CALL addr
+    lanes->SP[lane]++;
+    lanes->stack[lanes->SP[lane] % CHIP8_STACK_SIZE][lane] = lanes->PC[lane];
+    lanes->PC[lane] = nnn;
+    break;
+  case 0xB000: // JP V0, addr
+    lanes->PC[lane] = (uint16_t)(
+        nnn + lanes->V[(quirks & CHIP8_QUIRK_JUMP_USE_VX) ? x : 0][lane]);
+    break;
+  case 0xC000: // RND Vx, byte
+    lanes->V[x][lane] =
+        (uint8_t)((lanes->rand[lane] ? lanes->rand[lane]()
+                                     : chip8_rand(&lanes->rand_state[lane])) &
+                  kk);
+    break;
+  case 0xD000:
+    lanes_drw(lanes, lane, instruction);
+    break;
+  case 0xE000: // SKP Vx, SKNP Vx
+    if ((kk == 0x9E || kk == 0xA1) &&
+        !(((unsigned)lanes->keys[lane] >> (lanes->V[x][lane] % 16u)) & 1u) ==
+            (kk == 0xA1))
+      lanes->PC[lane] += 2;
+    break;
+  case 0xF000:
+    switch (kk) {
+    case 0x0A:
+      lanes_ld_vx_k(lanes, lane, x);
+      break;
+    case 0x1E:
+      lanes->I[lane] = (uint16_t)(I + lanes->V[x][lane]);
+      break;
+    case 0x29:
+      lanes->I[lane] =
+          (uint16_t)(CHIP8_FONT_DATA_START + 5 * lanes->V[x][lane]);
+      break;
+    case 0x33:
+      memory[I & LANES_ADDR_MASK] = (lanes->V[x][lane] / 100) % 10;
+      memory[(I + 1u) & LANES_ADDR_MASK] = (lanes->V[x][lane] / 10) % 10;
+      memory[(I + 2u) & LANES_ADDR_MASK] = lanes->V[x][lane] % 10;
+      break;
+    case 0x55:
+      for (uint8_t i = 0; i <= x; i++)
+        memory[(I + i) & LANES_ADDR_MASK] = lanes->V[i][lane];
+      if (quirks & CHIP8_QUIRK_MEM_INCR)
+        lanes->I[lane] = (uint16_t)(I + x + 1u);
+      break;
+    case 0x65:
+      for (uint8_t i = 0; i <= x; i++)
+        lanes->V[i][lane] = memory[(I + i) & LANES_ADDR_MASK];
+      if (quirks & CHIP8_QUIRK_MEM_INCR)
+        lanes->I[lane] = (uint16_t)(I + x + 1u);
+      break;
+    default: // Unknown
+      break;
+    }
+    break;
+  default: // Unknown
+    break;
+  }
+}
+
+// After Fx33 or Fx55 the shared lanes that wrote stay shared if they wrote the
+// same bytes as the first of them, the ones that did not write are dropped
+static void lanes_update_shared(chip8_lanes_t *lanes, const uint8_t *mask,
+                                uint16_t instruction) {
+  uint8_t n = (instruction & 0x00FF) == 0x33 ? 3 : ((instruction & 0x0F00) >> 8) + 1;
+  int first = -1;
+  for (uint8_t l = 0; l < lanes->count; l++) {
+    if (lanes->shared[l] && mask[l]) {
+      first = l;
+      break;
+    }
+  }
+  if (first < 0)
+    return; // No shared lane wrote
+  // I moved by the same amount on every lane, so the same I wrote the same place
+  uint16_t I = (uint16_t)(lanes->I[first] -
+                          ((instruction & 0x00FF) == 0x55 &&
+                                   (lanes->quirks & CHIP8_QUIRK_MEM_INCR)
+                               ? n
+                               : 0));
+  for (uint8_t l = 0; l < lanes->count; l++) {
+    if (!lanes->shared[l] || l == first)
+      continue;
+    uint8_t same = mask[l] && lanes->I[l] == lanes->I[first];
+    for (uint8_t i = 0; same && i < n; i++) {
+      uint16_t addr = (I + i) & LANES_ADDR_MASK;
+      same = lanes->memory[l][addr] == lanes->memory[first][addr];
+    }
+    lanes->shared[l] = same;
+  }
+}
+
+// Run an instruction on the lanes in mask (all of them are at pc + 2 already)
+static void lanes_execute(chip8_lanes_t *lanes, const uint8_t *mask,
+                          uint16_t instruction) {
+  const unsigned quirks = lanes->quirks;
+  const uint8_t count = lanes->count;
+  uint8_t x = (instruction & 0x0F00) >> 8;
+  uint8_t y = (instruction & 0x00F0) >> 4;
+  uint8_t kk = instruction & 0x00FF;
+  uint16_t nnn = instruction & 0x0FFF;
+  const lanes_u8_t zero = lanes_splat(0);
+  const lanes_u8_t one = lanes_splat(1);
+
+  switch (instruction & 0xF000) {
+  case 0x0000:
+    if (instruction == 0x00E0) {
+      for (uint8_t l = 0; l < count; l++) {
+        if (mask[l])
+          memset(lanes->display[l], 0, sizeof(lanes->display[l]));
+      }
+      return;
+    }
+    if (instruction != 0x00EE)
+      return; // 0nnn, ignored
+    break;
+  case 0x1000: // JP addr
+    for (uint8_t l = 0; l < count; l++) {
+      if (mask[l])
+        lanes->PC[l] = nnn;
+    }
+    return;
+  case 0x3000: // SE Vx, byte
+  case 0x4000: // SNE Vx, byte
+  case 0x5000: // SE Vx, Vy
+  case 0x9000: { // SNE Vx, Vy
+    if (((instruction & 0xF000) == 0x5000 || (instruction & 0xF000) == 0x9000) &&
+        (instruction & 0x000F))
+      return; // Unknown
+    uint8_t skip[CHIP8_LANES_MAX];
+    int equal_skips = (instruction & 0xF000) == 0x3000 ||
+                      (instruction & 0xF000) == 0x5000;
+    int with_vy = (instruction & 0xF000) >= 0x5000;
+    for (uint8_t c = 0; c < count; c += LANES_CHUNK) {
+      lanes_u8_t vx = lanes_load(&lanes->V[x][c]);
+      lanes_u8_t other = with_vy ? lanes_load(&lanes->V[y][c]) : lanes_splat(kk);
+      lanes_u8_t equal = LANES_TRUE(vx == other);
+      lanes_store(&skip[c], (equal_skips ? equal : ~equal) & lanes_load(&mask[c]));
+    }
+    for (uint8_t l = 0; l < count; l++)
+      lanes->PC[l] = (uint16_t)(lanes->PC[l] + (skip[l] & 2u));
+    return;
+  }
+  case 0x6000: // LD Vx, byte
+  case 0x7000: // ADD Vx, byte
+    for (uint8_t c = 0; c < count; c += LANES_CHUNK) {
+      lanes_u8_t value = lanes_splat(kk);
+      if ((instruction & 0xF000) == 0x7000)
+        value += lanes_load(&lanes->V[x][c]);
+      lanes_store_masked(&lanes->V[x][c], lanes_load(&mask[c]), value);
+    }
+    return;
+  case 0x8000: {
+    uint8_t op = instruction & 0x000F;
+    if (op > 0x7 && op != 0xE)
+      return; // Unknown
+    for (uint8_t c = 0; c < count; c += LANES_CHUNK) {
+      lanes_u8_t m = lanes_load(&mask[c]);
+      lanes_u8_t vx = lanes_load(&lanes->V[x][c]);
+      lanes_u8_t vy = lanes_load(&lanes->V[y][c]);
+      lanes_u8_t src = (quirks & CHIP8_QUIRK_SHIFT_VX_ONLY) ? vx : vy;
+      lanes_u8_t result = zero;
+      lanes_u8_t flag = zero;
+      int set_vf = 1;
+      switch (op) {
+      case 0x0: // LD Vx, Vy
+        result = vy;
+        set_vf = 0;
+        break;
+      case 0x1: // OR Vx, Vy
+      case 0x2: // AND Vx, Vy
+      case 0x3: // XOR Vx, Vy
+        result = op == 0x1 ? (vx | vy) : op == 0x2 ? (vx & vy) : (vx ^ vy);
+        set_vf = (quirks & CHIP8_QUIRK_VF_RESET) != 0;
+        break;
+      case 0x4: // ADD Vx, Vy
+        flag = LANES_TRUE(vx > (lanes_splat(UINT8_MAX) - vy)) & one;
+        result = vx + vy;
+        break;
+      case 0x5: // SUB Vx, Vy
+        flag = LANES_TRUE(vx >= vy) & one;
+        result = vx - vy;
+        break;
+      case 0x6: // SHR Vx {, Vy}
+        flag = src & one;
+        result = src >> 1;
+        break;
+      case 0x7: // SUBN Vx, Vy
+        flag = LANES_TRUE(vy >= vx) & one;
+        result = vy - vx;
+        break;
+      default: // 0xE, SHL Vx {, Vy}
+        flag = LANES_TRUE(src >= lanes_splat(0x80)) & one;
+        result = src << 1;
+        break;
+      }
+      // Vx first and then VF, as VF wins when x is F
+      lanes_store_masked(&lanes->V[x][c], m, result);
+      if (set_vf)
+        lanes_store_masked(&lanes->V[0xF][c], m, flag);
+    }
+    return;
+  }
+  case 0xA000: // LD I, addr
+    for (uint8_t l = 0; l < count; l++) {
+      if (mask[l])
+        lanes->I[l] = nnn;
+    }
+    return;
+  case 0xF000:
+    if (kk == 0x07 || kk == 0x15 || kk == 0x18) {
+      for (uint8_t c = 0; c < count; c += LANES_CHUNK) {
+        lanes_u8_t m = lanes_load(&mask[c]);
+        if (kk == 0x07) // LD Vx, DT
+          lanes_store_masked(&lanes->V[x][c], m, lanes_load(&lanes->DT[c]));
+        else // LD DT, Vx and LD ST, Vx
+          lanes_store_masked(kk == 0x15 ? &lanes->DT[c] : &lanes->ST[c], m,
+                             lanes_load(&lanes->V[x][c]));
+      }
+      return;
+    }
+    break;
+  default:
+    break;
+  }
+
+  // The rest needs memory, the stack, keys or rand, one lane at a time
+  for (uint8_t l = 0; l < count; l++) {
+    if (mask[l])
+      lanes_execute_lane(lanes, l, instruction);
+  }
+  if ((instruction & 0xF0FF) == 0xF033 || (instruction & 0xF0FF) == 0xF055)
+    lanes_update_shared(lanes, mask, instruction);
+}
+
+static inline uint16_t lanes_fetch(const chip8_lanes_t *lanes, uint8_t lane,
+                                   uint16_t pc) {
+  return (uint16_t)((lanes->memory[lane][pc & LANES_ADDR_MASK] << 8) +
+                    lanes->memory[lane][(pc + 1u) & LANES_ADDR_MASK]);
+}
+
+void chip8_lanes_run(chip8_lanes_t *lanes, uint32_t max_cycles) {
+  const uint8_t count = lanes->count;
+  uint32_t remaining[CHIP8_LANES_MAX];
+  uint8_t mask[CHIP8_LANES_MAX] = {0}; // Past count too, for LANES_CHUNK
+  for (uint8_t l = 0; l < count; l++) {
+    remaining[l] = max_cycles;
+    lanes->cycles[l] += max_cycles;
+  }
+  uint8_t active = max_cycles ? count : 0; // Lanes with cycles left
+  uint8_t leader = 0;
+  uint8_t find_leader = 0;
+
+  while (active) {
+    // The lane furthest behind leads, so diverged lanes take turns. While
+    // every lane with cycles left runs each step it stays the furthest behind
+    if (find_leader) {
+      leader = 0;
+      for (uint8_t l = 1; l < count; l++) {
+        if (remaining[l] > remaining[leader])
+          leader = l;
+      }
+    }
+    uint16_t pc = lanes->PC[leader];
+    uint16_t instruction = lanes_fetch(lanes, leader, pc);
+
+    // Group, lanes with cycles left on the same instruction
+    uint8_t group = 0;
+    uint8_t finished = 0;
+    for (uint8_t l = 0; l < count; l++) {
+      uint8_t in = remaining[l] && lanes->PC[l] == pc &&
+                   ((lanes->shared[l] && lanes->shared[leader]) ||
+                    lanes_fetch(lanes, l, pc) == instruction);
+      mask[l] = in ? 0xFF : 0x00;
+      remaining[l] -= in;
+      finished += in && !remaining[l];
+      lanes->PC[l] = (uint16_t)(lanes->PC[l] + (in << 1));
+      group += in;
+    }
+    find_leader = group != active;
+    active -= finished;
+    lanes_execute(lanes, mask, instruction);
+    lanes->steps++;
+    lanes->lane_steps += group;
+  }
+}
@@ -0,0 +1,231 @@
+#include <chip8.h>
+#include <chip8_movie.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Size of the file without the key events
+#define MOVIE_HEADER_SIZE 40u
+
+int chip8_movie_initialize(chip8_movie_t *chip8_movie, uint32_t seed,
+                           uint8_t quirks, uint32_t cycles_per_frame,
+                           uint64_t boot_hash) {
+  memset(chip8_movie, 0, sizeof(*chip8_movie));
+  chip8_movie->quirks = quirks & CHIP8_QUIRK_MASK;
+  chip8_movie->seed = seed;
+  chip8_movie->cycles_per_frame = cycles_per_frame;
+  chip8_movie->boot_hash = boot_hash;
+  chip8_movie->event_capacity = 256;
+  chip8_movie->events =
+      malloc(chip8_movie->event_capacity * sizeof(*chip8_movie->events));
+  if (!chip8_movie->events) {
+    printf("Movie Error: out of memory\n");
+    return 1;
+  }
+  return 0;
+}
+
+void chip8_movie_destroy(chip8_movie_t *chip8_movie) {
+  free(chip8_movie->events);
+  chip8_movie->events = NULL;
+  chip8_movie->event_count = 0;
+  chip8_movie->event_capacity = 0;
+}
+
+int chip8_movie_record_key(chip8_movie_t *chip8_movie, uint32_t frame,
+                           uint32_t cycle, uint8_t key, uint8_t pressed) {
+  if (chip8_movie->event_count == chip8_movie->event_capacity) {
+    uint32_t capacity = chip8_movie->event_capacity * 2u;
+    chip8_movie_event_t *events = malloc(capacity * sizeof(*events));
+    if (!events) {
+      printf("Movie Error: out of memory\n");
+      return 1;
+    }
+    memcpy(events, chip8_movie->events,
+           chip8_movie->event_count * sizeof(*events));
+    free(chip8_movie->events);
+    chip8_movie->events = events;
+    chip8_movie->event_capacity = capacity;
+  }
+  chip8_movie_event_t *event = &chip8_movie->events[chip8_movie->event_count++];
+  event->frame = frame;
+  event->cycle = cycle;
+  event->key = key & 0xF;
+  event->pressed = pressed ? 1 : 0;
+  return 0;
+}
+
+void chip8_movie_end(chip8_movie_t *chip8_movie, uint32_t frames,
+                     const chip8_t *chip8) {
+  chip8_movie->frames = frames;
+  chip8_movie->final_hash =
+      chip8_display_hash((const chip8_display_t *)&chip8->display);
+}
+
+void chip8_movie_run_frame(chip8_movie_t *chip8_movie, chip8_t *chip8,
+                           uint32_t frame, uint32_t cycles_per_frame) {
+  uint32_t cycles = 0;
+  while (chip8_movie->next_event < chip8_movie->event_count &&
+         chip8_movie->events[chip8_movie->next_event].frame <= frame) {
+    const chip8_movie_event_t *event =
+        &chip8_movie->events[chip8_movie->next_event++];
+    uint32_t cycle = event->frame < frame ? 0 : event->cycle;
+    if (cycle > cycles_per_frame)
+      cycle = cycles_per_frame;
+    // chip8_run returns early on events, keep going until the event's cycle
+    while (cycles < cycle)
+      cycles += chip8_run(chip8, cycle - cycles);
+    if (event->pressed)
+      chip8_set_key(chip8, event->key);
+    else
+      chip8_reset_key(chip8, event->key);
+  }
+  while (cycles < cycles_per_frame)
+    cycles += chip8_run(chip8, cycles_per_frame - cycles);
+}
+
+int chip8_movie_check(const chip8_movie_t *chip8_movie, const chip8_t *chip8) {
+  uint64_t hash = chip8_display_hash((const chip8_display_t *)&chip8->display);
+  if (hash != chip8_movie->final_hash) {
+    printf("Movie: final hash %016llx differs from the recorded %016llx\n",
+           (unsigned long long)hash,
+           (unsigned long long)chip8_movie->final_hash);
+    return 1;
+  }
+  printf("Movie: final hash %016llx matches\n", (unsigned long long)hash);
+  return 0;
+}
+
+static inline void put32(uint8_t *p, uint32_t value) {
+  for (uint8_t i = 0; i < 4; i++)
+    p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline void put64(uint8_t *p, uint64_t value) {
+  for (uint8_t i = 0; i < 8; i++)
+    p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t get64(const uint8_t *p) {
+  uint64_t value = 0;
+  for (uint8_t i = 0; i < 8; i++)
+    value |= (uint64_t)p[i] << (8 * i);
+  return value;
+}
+
+// Write value as LEB128 (7 bits at a time) into bytes, returns the size
+static uint8_t put_leb128(uint8_t *bytes, uint32_t value) {
+  uint8_t size = 0;
+  do {
+    bytes[size++] = (uint8_t)((value & 0x7F) | (value > 0x7F ? 0x80 : 0));
+    value >>= 7;
+  } while (value);
+  return size;
+}
+
+// Read a LEB128 value, returns 1 at the end of the file
+static int get_leb128(FILE *fd, uint32_t *value) {
+  *value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    int c = fgetc(fd);
+    if (c == EOF)
+      return 1;
+    *value |= (uint32_t)(c & 0x7F) << shift;
+    if (!(c & 0x80))
+      break;
+  }
+  return 0;
+}
+
+int chip8_movie_save(const chip8_movie_t *chip8_movie, const char *filename) {
+  FILE *fd = fopen(filename, "wb");
+  if (fd == NULL) {
+    printf("Could not open file\n");
+    return 1;
+  }
+  uint8_t header[MOVIE_HEADER_SIZE] = {'C', 'H', '8', 'M'};
+  header[4] = (uint8_t)CHIP8_MOVIE_VERSION;
+  header[5] = (uint8_t)(CHIP8_MOVIE_VERSION >> 8);
+  header[6] = chip8_movie->quirks;
+  put32(header + 8, chip8_movie->seed);
+  put32(header + 12, chip8_movie->cycles_per_frame);
+  put64(header + 16, chip8_movie->boot_hash);
+  put32(header + 24, chip8_movie->frames);
+  put64(header + 28, chip8_movie->final_hash);
+  put32(header + 36, chip8_movie->event_count);
+  int error = fwrite(header, 1, sizeof(header), fd) != sizeof(header);
+
+  uint32_t last_frame = 0;
+  for (uint32_t i = 0; i < chip8_movie->event_count && !error; i++) {
+    const chip8_movie_event_t *event = &chip8_movie->events[i];
+    uint8_t bytes[11];
+    uint8_t size = put_leb128(bytes, event->frame - last_frame);
+    size += put_leb128(bytes + size, event->cycle);
+    bytes[size++] = (uint8_t)(event->key | (event->pressed ? 0x80 : 0));
+    error = fwrite(bytes, 1, size, fd) != size;
+    last_frame = event->frame;
+  }
+  if (fclose(fd) != 0 || error) {
+    printf("Error: could not write %s\n", filename);
+    return 1;
+  }
+  return 0;
+}
+
+int chip8_movie_load(chip8_movie_t *chip8_movie, const char *filename) {
+  FILE *fd = fopen(filename, "rb");
+  if (fd == NULL) {
+    printf("Could not open file\n");
+    return 1;
+  }
+  uint8_t header[MOVIE_HEADER_SIZE];
+  if (fread(header, 1, sizeof(header), fd) != sizeof(header) ||
+      memcmp(header, "CH8M", 4)) {
+    printf("Movie Error: not a movie\n");
+    fclose(fd);
+    return 1;
+  }
+  uint16_t version = (uint16_t)(header[4] | header[5] << 8);
+  if (version != 1 && version != CHIP8_MOVIE_VERSION) {
+    printf("Movie Error: version %u is not supported\n", version);
+    fclose(fd);
+    return 1;
+  }
+  if (chip8_movie_initialize(chip8_movie, get32(header + 8), header[6],
+                             get32(header + 12), get64(header + 16))) {
+    fclose(fd);
+    return 1;
+  }
+  chip8_movie->frames = get32(header + 24);
+  chip8_movie->final_hash = get64(header + 28);
+
+  uint32_t count = get32(header + 36);
+  uint32_t frame = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t gap, cycle = 0;
+    int key = EOF;
+    if (!get_leb128(fd, &gap) && (version < 2 || !get_leb128(fd, &cycle)))
+      key = fgetc(fd);
+    if (key == EOF) {
+      printf("Movie Error: truncated\n");
+      chip8_movie_destroy(chip8_movie);
+      fclose(fd);
+      return 1;
+    }
+    frame += gap;
+    if (chip8_movie_record_key(chip8_movie, frame, cycle, (uint8_t)(key & 0xF),
+                               (key & 0x80) != 0)) {
+      chip8_movie_destroy(chip8_movie);
+      fclose(fd);
+      return 1;
+    }
+  }
+  fclose(fd);
+  return 0;
+}
@@ -0,0 +1,242 @@
+#define _POSIX_C_SOURCE 200809L // mmap, fstat
+#include <chip8.h>
+#include <chip8_pak.h>
+#include <chip8_snapshot.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static inline void put16(uint8_t *p, uint16_t value) {
+  p[0] = (uint8_t)value;
+  p[1] = (uint8_t)(value >> 8);
+}
+
+static inline void put32(uint8_t *p, uint32_t value) {
+  for (uint8_t i = 0; i < 4; i++)
+    p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline void put64(uint8_t *p, uint64_t value) {
+  for (uint8_t i = 0; i < 8; i++)
+    p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline uint16_t get16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static inline uint64_t get64(const uint8_t *p) {
+  uint64_t value = 0;
+  for (uint8_t i = 0; i < 8; i++)
+    value |= (uint64_t)p[i] << (8 * i);
+  return value;
+}
+
+// Where the images start, the first page after the index
+static inline size_t pak_images_start(uint32_t count) {
+  size_t index_end =
+      CHIP8_PAK_HEADER_SIZE + (size_t)count * CHIP8_PAK_ENTRY_SIZE;
+  return (index_end + CHIP8_MEM_SIZE - 1u) & ~(size_t)(CHIP8_MEM_SIZE - 1u);
+}
+
+// Checks an index entry against the file, returns its name or NULL if bad
+static const char *pak_check_entry(const chip8_pak_t *pak, uint32_t index) {
+  const uint8_t *p =
+      pak->map + CHIP8_PAK_HEADER_SIZE + (size_t)index * CHIP8_PAK_ENTRY_SIZE;
+  const char *name = (const char *)p;
+  if (!name[0] || !memchr(name, '\0', CHIP8_PAK_NAME_SIZE))
+    return NULL;
+  uint32_t offset = get32(p + 40);
+  if (offset % CHIP8_MEM_SIZE || offset < pak_images_start(pak->count) ||
+      (size_t)offset + CHIP8_MEM_SIZE > pak->size ||
+      get16(p + 44) > CHIP8_PAK_MAX_ROM_SIZE)
+    return NULL;
+  return name;
+}
+
+int chip8_pak_open(chip8_pak_t *pak, const char *filename) {
+  memset(pak, 0, sizeof(*pak));
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    printf("Could not open file\n");
+    return 1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < (off_t)CHIP8_PAK_HEADER_SIZE) {
+    printf("Pak Error: %s is not an archive\n", filename);
+    close(fd);
+    return 1;
+  }
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // The mapping keeps the file
+  if (map == MAP_FAILED) {
+    printf("Pak Error: could not map %s\n", filename);
+    return 1;
+  }
+  pak->map = map;
+  pak->size = (size_t)st.st_size;
+  if (memcmp(pak->map, "C8PK", 4) != 0) {
+    printf("Pak Error: %s is not an archive\n", filename);
+    chip8_pak_close(pak);
+    return 1;
+  }
+  if (get16(pak->map + 4) != CHIP8_PAK_VERSION) {
+    printf("Pak Error: version %u not supported\n", get16(pak->map + 4));
+    chip8_pak_close(pak);
+    return 1;
+  }
+  pak->count = get32(pak->map + 8);
+  if (pak_images_start(pak->count) > pak->size) {
+    printf("Pak Error: truncated index\n");
+    chip8_pak_close(pak);
+    return 1;
+  }
+  // Only the index is read, the images are paged in when run
+  const char *previous = NULL;
+  for (uint32_t i = 0; i < pak->count; i++) {
+    const char *name = pak_check_entry(pak, i);
+    if (!name || (previous && strcmp(previous, name) >= 0)) {
+      printf("Pak Error: bad index entry %u\n", i);
+      chip8_pak_close(pak);
+      return 1;
+    }
+    previous = name;
+  }
+  return 0;
+}
+
+void chip8_pak_close(chip8_pak_t *pak) {
+  if (pak->map)
+    munmap((void *)(uintptr_t)pak->map, pak->size);
+  memset(pak, 0, sizeof(*pak));
+}
+
+void chip8_pak_entry(const chip8_pak_t *pak, uint32_t index,
+                     chip8_pak_entry_t *entry) {
+  const uint8_t *p =
+      pak->map + CHIP8_PAK_HEADER_SIZE + (size_t)index * CHIP8_PAK_ENTRY_SIZE;
+  entry->name = (const char *)p;
+  entry->hash = get64(p + 32);
+  entry->image = (const chip8_image_t *)(pak->map + get32(p + 40));
+  entry->size = get16(p + 44);
+  entry->flags = p[46];
+  entry->quirks = p[47] & CHIP8_QUIRK_MASK;
+}
+
+int chip8_pak_find(const chip8_pak_t *pak, const char *name,
+                   chip8_pak_entry_t *entry) {
+  uint32_t low = 0;
+  uint32_t high = pak->count;
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2u;
+    chip8_pak_entry(pak, middle, entry);
+    int order = strcmp(name, entry->name);
+    if (order == 0)
+      return 0;
+    if (order < 0)
+      high = middle;
+    else
+      low = middle + 1u;
+  }
+  return 1;
+}
+
+int chip8_pak_entry_valid(const chip8_pak_entry_t *entry) {
+  chip8_image_t expected;
+  const uint8_t *rom = &entry->image->memory[0x200];
+  chip8_image_initialize(&expected, rom, entry->size);
+  return !memcmp(&expected, entry->image, sizeof(expected)) &&
+         entry->hash == chip8_snapshot_boot_hash(rom, entry->size);
+}
+
+static int pak_compare_names(const void *a, const void *b) {
+  return strcmp(((const chip8_pak_entry_t *)a)->name,
+                ((const chip8_pak_entry_t *)b)->name);
+}
+
+int chip8_pak_save(const char *filename, chip8_pak_entry_t *entries,
+                   uint32_t count) {
+  qsort(entries, count, sizeof(*entries), pak_compare_names);
+  for (uint32_t i = 0; i < count; i++) {
+    size_t length = strlen(entries[i].name);
+    if (!length || length >= CHIP8_PAK_NAME_SIZE) {
+      printf("Pak Error: bad name %s\n", entries[i].name);
+      return 1;
+    }
+    if (i && strcmp(entries[i - 1].name, entries[i].name) == 0) {
+      printf("Pak Error: %s is there twice\n", entries[i].name);
+      return 1;
+    }
+    if (entries[i].size > CHIP8_PAK_MAX_ROM_SIZE) {
+      printf("Pak Error: %s is too big\n", entries[i].name);
+      return 1;
+    }
+  }
+  size_t start = pak_images_start(count);
+  if (start + (size_t)count * CHIP8_MEM_SIZE > UINT32_MAX) {
+    printf("Pak Error: too many ROMs\n");
+    return 1;
+  }
+
+  // Header and index, padded up to the first image
+  uint8_t *index = calloc(1, start);
+  if (!index) {
+    printf("Pak Error: out of memory\n");
+    return 1;
+  }
+  memcpy(index, "C8PK", 4);
+  put16(index + 4, CHIP8_PAK_VERSION);
+  put32(index + 8, count);
+  for (uint32_t i = 0; i < count; i++) {
+    chip8_pak_entry_t *entry = &entries[i];
+    uint8_t *p =
+        index + CHIP8_PAK_HEADER_SIZE + (size_t)i * CHIP8_PAK_ENTRY_SIZE;
+    entry->hash =
+        chip8_snapshot_boot_hash(&entry->image->memory[0x200], entry->size);
+    memcpy(p, entry->name, strlen(entry->name));
+    put64(p + 32, entry->hash);
+    put32(p + 40, (uint32_t)(start + (size_t)i * CHIP8_MEM_SIZE));
+    put16(p + 44, entry->size);
+    p[46] = entry->flags;
+    p[47] = entry->quirks;
+  }
+
+  FILE *fd = fopen(filename, "wb");
+  if (fd == NULL) {
+    printf("Could not open file\n");
+    free(index);
+    return 1;
+  }
+  int failed = fwrite(index, 1, start, fd) != start;
+  for (uint32_t i = 0; i < count && !failed; i++)
+    failed = fwrite(entries[i].image, 1, CHIP8_MEM_SIZE, fd) != CHIP8_MEM_SIZE;
+  free(index);
+  if (fclose(fd) != 0 || failed) {
+    printf("Error: could not write %s\n", filename);
+    return 1;
+  }
+  return 0;
+}
+
+const char *chip8_pak_split(const char *path, char *filename, size_t size) {
+  const char *colon = strstr(path, ".c8pak:");
+  if (!colon)
+    return NULL;
+  size_t length = (size_t)(colon - path) + 6u; // Up to the colon
+  if (length >= size)
+    return NULL;
+  memcpy(filename, path, length);
+  filename[length] = '\0';
+  return colon + 7;
+}
@@ -0,0 +1,233 @@
+#include <chip8.h>
+#include <chip8_profile.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const opclass_names[CHIP8_OPCLASS_COUNT] = {
+    [CHIP8_OPCLASS_CLS] = "00E0 CLS",
+    [CHIP8_OPCLASS_RET] = "00EE RET",
+    [CHIP8_OPCLASS_SYS] = "0nnn SYS",
+    [CHIP8_OPCLASS_JP] = "1nnn JP",
+    [CHIP8_OPCLASS_CALL] = "2nnn CALL",
+    [CHIP8_OPCLASS_SE_VX_BYTE] = "3xkk SE",
+    [CHIP8_OPCLASS_SNE_VX_BYTE] = "4xkk SNE",
+    [CHIP8_OPCLASS_SE_VX_VY] = "5xy0 SE",
+    [CHIP8_OPCLASS_LD_VX_BYTE] = "6xkk LD",
+    [CHIP8_OPCLASS_ADD_VX_BYTE] = "7xkk ADD",
+    [CHIP8_OPCLASS_LD_VX_VY] = "8xy0 LD",
+    [CHIP8_OPCLASS_OR] = "8xy1 OR",
+    [CHIP8_OPCLASS_AND] = "8xy2 AND",
+    [CHIP8_OPCLASS_XOR] = "8xy3 XOR",
+    [CHIP8_OPCLASS_ADD_VX_VY] = "8xy4 ADD",
+    [CHIP8_OPCLASS_SUB] = "8xy5 SUB",
+    [CHIP8_OPCLASS_SHR] = "8xy6 SHR",
+    [CHIP8_OPCLASS_SUBN] = "8xy7 SUBN",
+    [CHIP8_OPCLASS_SHL] = "8xyE SHL",
+    [CHIP8_OPCLASS_SNE_VX_VY] = "9xy0 SNE",
+    [CHIP8_OPCLASS_LD_I_ADDR] = "Annn LD I",
+    [CHIP8_OPCLASS_JP_V0] = "Bnnn JP V0",
+    [CHIP8_OPCLASS_RND] = "Cxkk RND",
+    [CHIP8_OPCLASS_DRW] = "Dxyn DRW",
+    [CHIP8_OPCLASS_SKP] = "Ex9E SKP",
+    [CHIP8_OPCLASS_SKNP] = "ExA1 SKNP",
+    [CHIP8_OPCLASS_LD_VX_DT] = "Fx07 LD DT",
+    [CHIP8_OPCLASS_LD_VX_K] = "Fx0A LD K",
+    [CHIP8_OPCLASS_LD_DT_VX] = "Fx15 LD DT",
+    [CHIP8_OPCLASS_LD_ST_VX] = "Fx18 LD ST",
+    [CHIP8_OPCLASS_ADD_I_VX] = "Fx1E ADD I",
+    [CHIP8_OPCLASS_LD_F_VX] = "Fx29 LD F",
+    [CHIP8_OPCLASS_LD_B_VX] = "Fx33 LD B",
+    [CHIP8_OPCLASS_LD_I_VX] = "Fx55 LD [I]",
+    [CHIP8_OPCLASS_LD_VX_I] = "Fx65 LD [I]",
+    [CHIP8_OPCLASS_UNKNOWN] = "unknown"};
+
+chip8_opclass_t chip8_profile_classify(uint16_t opcode) {
+  static const chip8_opclass_t alu[16] = {
+      CHIP8_OPCLASS_LD_VX_VY, CHIP8_OPCLASS_OR,        CHIP8_OPCLASS_AND,
+      CHIP8_OPCLASS_XOR,      CHIP8_OPCLASS_ADD_VX_VY, CHIP8_OPCLASS_SUB,
+      CHIP8_OPCLASS_SHR,      CHIP8_OPCLASS_SUBN,      CHIP8_OPCLASS_UNKNOWN,
+      CHIP8_OPCLASS_UNKNOWN,  CHIP8_OPCLASS_UNKNOWN,   CHIP8_OPCLASS_UNKNOWN,
+      CHIP8_OPCLASS_UNKNOWN,  CHIP8_OPCLASS_UNKNOWN,   CHIP8_OPCLASS_SHL,
+      CHIP8_OPCLASS_UNKNOWN};
+  switch (opcode) {
+  case 0x00E0:
+    return CHIP8_OPCLASS_CLS;
+  case 0x00EE:
+    return CHIP8_OPCLASS_RET;
+  default:
+    break;
+  }
+  switch (opcode & 0xF000) {
+  case 0x0000:
+    return CHIP8_OPCLASS_SYS;
+  case 0x1000:
+    return CHIP8_OPCLASS_JP;
+  case 0x2000:
+    return CHIP8_OPCLASS_CALL;
+  case 0x3000:
+    return CHIP8_OPCLASS_SE_VX_BYTE;
+  case 0x4000:
+    return CHIP8_OPCLASS_SNE_VX_BYTE;
+  case 0x5000:
+    return (opcode & 0x000F) ? CHIP8_OPCLASS_UNKNOWN : CHIP8_OPCLASS_SE_VX_VY;
+  case 0x6000:
+    return CHIP8_OPCLASS_LD_VX_BYTE;
+  case 0x7000:
+    return CHIP8_OPCLASS_ADD_VX_BYTE;
+  case 0x8000:
+    return alu[opcode & 0x000F];
+  case 0x9000:
+    return (opcode & 0x000F) ? CHIP8_OPCLASS_UNKNOWN : CHIP8_OPCLASS_SNE_VX_VY;
+  case 0xA000:
+    return CHIP8_OPCLASS_LD_I_ADDR;
+  case 0xB000:
+    return CHIP8_OPCLASS_JP_V0;
+  case 0xC000:
+    return CHIP8_OPCLASS_RND;
+  case 0xD000:
+    return CHIP8_OPCLASS_DRW;
+  case 0xE000:
+    switch (opcode & 0x00FF) {
+    case 0x009E:
+      return CHIP8_OPCLASS_SKP;
+    case 0x00A1:
+      return CHIP8_OPCLASS_SKNP;
+    default:
+      return CHIP8_OPCLASS_UNKNOWN;
+    }
+  case 0xF000:
+    switch (opcode & 0x00FF) {
+    case 0x0007:
+      return CHIP8_OPCLASS_LD_VX_DT;
+    case 0x000A:
+      return CHIP8_OPCLASS_LD_VX_K;
+    case 0x0015:
+      return CHIP8_OPCLASS_LD_DT_VX;
+    case 0x0018:
+      return CHIP8_OPCLASS_LD_ST_VX;
+    case 0x001E:
+      return CHIP8_OPCLASS_ADD_I_VX;
+    case 0x0029:
+      return CHIP8_OPCLASS_LD_F_VX;
+    case 0x0033:
+      return CHIP8_OPCLASS_LD_B_VX;
+    case 0x0055:
+      return CHIP8_OPCLASS_LD_I_VX;
+    case 0x0065:
+      return CHIP8_OPCLASS_LD_VX_I;
+    default:
+      return CHIP8_OPCLASS_UNKNOWN;
+    }
+  default:
+    return CHIP8_OPCLASS_UNKNOWN;
+  }
+}
+
+void chip8_profile_initialize(chip8_profile_t *chip8_profile,
+                              uint32_t sample_period) {
+  memset(chip8_profile, 0, sizeof(*chip8_profile));
+  // Classified once, counting is then a table lookup
+  for (uint32_t opcode = 0; opcode <= UINT16_MAX; opcode++) {
+    chip8_opclass_t opclass = chip8_profile_classify((uint16_t)opcode);
+    chip8_profile->classes[opcode] = (uint8_t)opclass;
+  }
+  chip8_profile->sample_period = sample_period ? sample_period : 1u;
+  chip8_profile->countdown = 1; // The first batch is sampled
+}
+
+void chip8_profile_attach(chip8_t *chip8, chip8_profile_t *chip8_profile) {
+  chip8->profile = chip8_profile;
+}
+
+// qsort over indices into the counts being sorted
+static const uint64_t *sort_counts;
+
+static int compare_counts(const void *a, const void *b) {
+  uint64_t count_a = sort_counts[*(const uint16_t *)a];
+  uint64_t count_b = sort_counts[*(const uint16_t *)b];
+  if (count_a != count_b)
+    return count_a < count_b ? 1 : -1;
+  return *(const uint16_t *)a < *(const uint16_t *)b ? -1 : 1;
+}
+
+static void sort_by_count(const uint64_t *counts, uint16_t *order,
+                          uint16_t count) {
+  for (uint16_t i = 0; i < count; i++)
+    order[i] = i;
+  sort_counts = counts;
+  qsort(order, count, sizeof(*order), compare_counts);
+}
+
+void chip8_profile_print(const chip8_profile_t *chip8_profile,
+                         const chip8_t *chip8, uint32_t top) {
+  uint64_t total = 0;
+  for (int i = 0; i < CHIP8_OPCLASS_COUNT; i++)
+    total += chip8_profile->class_counts[i];
+  double percent = total ? 100.0 / (double)total : 0.0;
+  printf("Profile: %llu instructions in %llu of %llu batches, %llu cycles "
+         "blocked in Fx0A, %llu in the VBlank wait, %llu skipped in idle "
+         "loops\n",
+         (unsigned long long)total, (unsigned long long)chip8_profile->sampled,
+         (unsigned long long)chip8_profile->batches,
+         (unsigned long long)chip8_profile->blocked_key,
+         (unsigned long long)chip8_profile->blocked_vblank,
+         (unsigned long long)chip8_profile->idle);
+
+  uint16_t classes[CHIP8_OPCLASS_COUNT];
+  sort_by_count(chip8_profile->class_counts, classes, CHIP8_OPCLASS_COUNT);
+  printf("By opcode class\n");
+  for (int i = 0; i < CHIP8_OPCLASS_COUNT; i++) {
+    uint64_t count = chip8_profile->class_counts[classes[i]];
+    if (!count)
+      break;
+    printf("  %-12s %12llu %6.2f%%\n", opclass_names[classes[i]],
+           (unsigned long long)count, (double)count * percent);
+  }
+
+  static uint16_t addresses[CHIP8_MEM_SIZE];
+  sort_by_count(chip8_profile->pc_counts, addresses, CHIP8_MEM_SIZE);
+  printf("Hottest addresses\n");
+  for (uint32_t i = 0; i < top && i < CHIP8_MEM_SIZE; i++) {
+    uint64_t count = chip8_profile->pc_counts[addresses[i]];
+    if (!count)
+      break;
+    uint16_t opcode = chip8_opcode_at(chip8, addresses[i]);
+    printf("  0x%04x %04x %-12s %12llu %6.2f%%\n", addresses[i], opcode,
+           opclass_names[chip8_profile->classes[opcode]],
+           (unsigned long long)count, (double)count * percent);
+  }
+}
+
+int chip8_profile_save(const chip8_profile_t *chip8_profile,
+                       const char *filename) {
+  FILE *fd = fopen(filename, "w");
+  if (fd == NULL) {
+    printf("Could not open file\n");
+    return 1;
+  }
+  int error = 0;
+  // Classes by opcode pattern, without the mnemonic
+  for (int i = 0; i < CHIP8_OPCLASS_COUNT; i++) {
+    if (chip8_profile->class_counts[i])
+      error |= fprintf(fd, "class\t%.*s\t%llu\n",
+                       i == CHIP8_OPCLASS_UNKNOWN ? 7 : 4, opclass_names[i],
+                       (unsigned long long)chip8_profile->class_counts[i]) < 0;
+  }
+  for (uint16_t addr = 0; addr < CHIP8_MEM_SIZE; addr++) {
+    if (chip8_profile->pc_counts[addr])
+      error |= fprintf(fd, "pc\t0x%04x\t%llu\n", addr,
+                       (unsigned long long)chip8_profile->pc_counts[addr]) < 0;
+  }
+  error |= fprintf(fd, "blocked\tkey\t%llu\nblocked\tvblank\t%llu\n",
+                   (unsigned long long)chip8_profile->blocked_key,
+                   (unsigned long long)chip8_profile->blocked_vblank) < 0;
+  error |= fprintf(fd, "idle\t-\t%llu\n",
+                   (unsigned long long)chip8_profile->idle) < 0;
+  if (fclose(fd) != 0 || error) {
+    printf("Error: could not write %s\n", filename);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,260 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+#include <chip8.h>
+#include <chip8_rewind.h>
+#include <chip8_snapshot.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Unchanged bytes shorter than a run header are cheaper kept in the literal
+#define REWIND_RUN_GAP 4u
+
+// Biggest delta, a single literal with the whole state
+#define REWIND_MAX_DELTA (sizeof(chip8_snapshot_t) + 4u)
+
+static double rewind_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+int chip8_rewind_initialize(chip8_rewind_t *chip8_rewind, uint32_t frames,
+                            uint32_t keyframe_interval, size_t data_size) {
+  memset(chip8_rewind, 0, sizeof(*chip8_rewind));
+  if (!frames || !keyframe_interval || data_size < REWIND_MAX_DELTA) {
+    printf("Rewind Error: bad history size\n");
+    return 1;
+  }
+  chip8_rewind->frame_capacity = frames;
+  chip8_rewind->keyframe_interval = keyframe_interval;
+  // Keyframes are numbered without gaps, this many always cover the frames
+  chip8_rewind->keyframe_capacity = frames / keyframe_interval + 2u;
+  chip8_rewind->data_size = data_size;
+  chip8_rewind->frames = malloc(frames * sizeof(*chip8_rewind->frames));
+  chip8_rewind->data = malloc(data_size);
+  chip8_rewind->keyframes = malloc(chip8_rewind->keyframe_capacity *
+                                   sizeof(*chip8_rewind->keyframes));
+  if (!chip8_rewind->frames || !chip8_rewind->data ||
+      !chip8_rewind->keyframes) {
+    printf("Rewind Error: out of memory\n");
+    chip8_rewind_destroy(chip8_rewind);
+    return 1;
+  }
+  return 0;
+}
+
+void chip8_rewind_destroy(chip8_rewind_t *chip8_rewind) {
+  free(chip8_rewind->frames);
+  free(chip8_rewind->data);
+  free(chip8_rewind->keyframes);
+  chip8_rewind->frames = NULL;
+  chip8_rewind->data = NULL;
+  chip8_rewind->keyframes = NULL;
+}
+
+void chip8_rewind_clear(chip8_rewind_t *chip8_rewind) {
+  chip8_rewind->frame_head = 0;
+  chip8_rewind->frame_count = 0;
+  chip8_rewind->data_tail = 0;
+  chip8_rewind->next_keyframe = 0;
+  chip8_rewind->since_keyframe = 0;
+}
+
+static inline chip8_rewind_frame_t *rewind_frame(chip8_rewind_t *chip8_rewind,
+                                                 uint32_t index) {
+  return &chip8_rewind->frames[(chip8_rewind->frame_head + index) %
+                               chip8_rewind->frame_capacity];
+}
+
+static inline void rewind_drop_oldest(chip8_rewind_t *chip8_rewind) {
+  chip8_rewind->frame_head =
+      (chip8_rewind->frame_head + 1) % chip8_rewind->frame_capacity;
+  chip8_rewind->frame_count--;
+}
+
+// Room for the biggest delta in one piece, drops the oldest frames that are
+// in the way, returns where it goes (not wrapped)
+static uint64_t rewind_reserve(chip8_rewind_t *chip8_rewind) {
+  const size_t data_size = chip8_rewind->data_size;
+  uint64_t start = chip8_rewind->data_tail;
+  if (start % data_size + REWIND_MAX_DELTA > data_size)
+    start += data_size - start % data_size; // Does not fit before the end
+  while (chip8_rewind->frame_count &&
+         start + REWIND_MAX_DELTA - rewind_frame(chip8_rewind, 0)->start >
+             data_size)
+    rewind_drop_oldest(chip8_rewind);
+  return start;
+}
+
+// Write the XOR of a and b as (unchanged bytes, literal bytes, literal) runs
+static uint32_t rewind_encode(const uint8_t *a, const uint8_t *b,
+                              uint8_t *out) {
+  const size_t size = sizeof(chip8_snapshot_t);
+  uint8_t *p = out;
+  size_t i = 0;
+  while (i < size) {
+    size_t start = i;
+    // Unchanged bytes, 8 at a time while it can
+    while (i + 8 <= size) {
+      uint64_t wa, wb;
+      memcpy(&wa, a + i, 8);
+      memcpy(&wb, b + i, 8);
+      if (wa != wb)
+        break;
+      i += 8;
+    }
+    while (i < size && a[i] == b[i])
+      i++;
+    if (i == size)
+      break;
+    uint16_t skip = (uint16_t)(i - start);
+    // Changed bytes, until enough unchanged ones in a row
+    size_t literal = i;
+    size_t same = 0;
+    while (i < size && same < REWIND_RUN_GAP) {
+      same = a[i] == b[i] ? same + 1 : 0;
+      i++;
+    }
+    if (same == REWIND_RUN_GAP)
+      i -= same;
+    uint16_t length = (uint16_t)(i - literal);
+    memcpy(p, &skip, 2);
+    memcpy(p + 2, &length, 2);
+    for (size_t j = 0; j < length; j++)
+      p[4 + j] = a[literal + j] ^ b[literal + j];
+    p += 4u + length;
+  }
+  return (uint32_t)(p - out);
+}
+
+// XOR a delta into state, it goes either way
+static void rewind_apply(uint8_t *state, const uint8_t *delta, uint32_t size) {
+  const uint8_t *p = delta;
+  size_t i = 0;
+  while (p < delta + size) {
+    uint16_t skip, length;
+    memcpy(&skip, p, 2);
+    memcpy(&length, p + 2, 2);
+    i += skip;
+    for (uint16_t j = 0; j < length; j++)
+      state[i + j] ^= p[4 + j];
+    i += length;
+    p += 4u + length;
+  }
+}
+
+void chip8_rewind_capture(chip8_rewind_t *chip8_rewind, const chip8_t *chip8) {
+  double start_seconds = rewind_seconds();
+  const uint8_t current = chip8_rewind->current;
+  chip8_snapshot_t *previous = &chip8_rewind->states[current];
+  chip8_snapshot_t *next = &chip8_rewind->states[!current];
+  chip8_snapshot_take(chip8, next);
+
+  if (chip8_rewind->frame_count == chip8_rewind->frame_capacity)
+    rewind_drop_oldest(chip8_rewind);
+  uint64_t start = rewind_reserve(chip8_rewind);
+  uint32_t size = 0;
+  if (chip8_rewind->frame_count) // The oldest frame has nothing to go back to
+    size = rewind_encode((const uint8_t *)previous, (const uint8_t *)next,
+                         &chip8_rewind->data[start % chip8_rewind->data_size]);
+
+  chip8_rewind_frame_t *frame =
+      rewind_frame(chip8_rewind, chip8_rewind->frame_count);
+  frame->start = start;
+  frame->size = size;
+  frame->keyframe = CHIP8_REWIND_NO_KEYFRAME;
+  if (!chip8_rewind->since_keyframe) {
+    frame->keyframe = chip8_rewind->next_keyframe++;
+    chip8_rewind->keyframes[frame->keyframe %
+                            chip8_rewind->keyframe_capacity] = *next;
+  }
+  chip8_rewind->since_keyframe =
+      (chip8_rewind->since_keyframe + 1) % chip8_rewind->keyframe_interval;
+  chip8_rewind->frame_count++;
+  chip8_rewind->data_tail = start + size;
+  chip8_rewind->current = !current;
+
+  double seconds = rewind_seconds() - start_seconds;
+  chip8_rewind->captures++;
+  chip8_rewind->capture_seconds += seconds;
+  if (seconds > chip8_rewind->capture_max_seconds)
+    chip8_rewind->capture_max_seconds = seconds;
+}
+
+uint32_t chip8_rewind_step_back(chip8_rewind_t *chip8_rewind, chip8_t *chip8,
+                                uint32_t frames) {
+  if (chip8_rewind->frame_count < 2)
+    return 0; // Already at the oldest frame
+  uint32_t newest = chip8_rewind->frame_count - 1;
+  if (frames > newest)
+    frames = newest;
+  uint32_t target = newest - frames;
+  chip8_snapshot_t *state = &chip8_rewind->states[chip8_rewind->current];
+
+  // Start from the closest keyframe at or after the target, or the newest
+  uint32_t from = newest;
+  for (uint32_t i = target; i < newest; i++) {
+    uint32_t keyframe = rewind_frame(chip8_rewind, i)->keyframe;
+    if (keyframe != CHIP8_REWIND_NO_KEYFRAME) {
+      *state = chip8_rewind->keyframes[keyframe % chip8_rewind->keyframe_capacity];
+      from = i;
+      break;
+    }
+  }
+  for (uint32_t i = from; i > target; i--) {
+    const chip8_rewind_frame_t *frame = rewind_frame(chip8_rewind, i);
+    rewind_apply((uint8_t *)state,
+                 &chip8_rewind->data[frame->start % chip8_rewind->data_size],
+                 frame->size);
+  }
+
+  // The frames after the target are gone, keyframes keep counting from the
+  // last one left so their numbers have no gaps
+  chip8_rewind->frame_count = target + 1;
+  const chip8_rewind_frame_t *last = rewind_frame(chip8_rewind, target);
+  chip8_rewind->data_tail = last->start + last->size;
+  chip8_rewind->since_keyframe = 0;
+  for (uint32_t i = target + 1; i-- > 0;) {
+    uint32_t keyframe = rewind_frame(chip8_rewind, i)->keyframe;
+    if (keyframe != CHIP8_REWIND_NO_KEYFRAME) {
+      chip8_rewind->next_keyframe = keyframe + 1;
+      chip8_rewind->since_keyframe =
+          (target + 1 - i) % chip8_rewind->keyframe_interval;
+      break;
+    }
+  }
+
+  chip8_snapshot_restore(chip8, state);
+  return frames;
+}
+
+size_t chip8_rewind_memory(const chip8_rewind_t *chip8_rewind) {
+  if (!chip8_rewind->frame_count)
+    return 0;
+  size_t bytes = (size_t)(chip8_rewind->data_tail -
+                          chip8_rewind->frames[chip8_rewind->frame_head].start);
+  for (uint32_t i = 0; i < chip8_rewind->frame_count; i++) {
+    if (chip8_rewind->frames[(chip8_rewind->frame_head + i) %
+                             chip8_rewind->frame_capacity]
+            .keyframe != CHIP8_REWIND_NO_KEYFRAME)
+      bytes += sizeof(chip8_snapshot_t);
+  }
+  return bytes;
+}
+
+void chip8_rewind_print_stats(const chip8_rewind_t *chip8_rewind) {
+  size_t bytes = chip8_rewind_memory(chip8_rewind);
+  printf("Rewind: %u frames held in %.1f KB", chip8_rewind->frame_count,
+         (double)bytes / 1024.0);
+  if (chip8_rewind->frame_count)
+    printf(" (%.0f bytes/frame, a full state is %zu)",
+           (double)bytes / chip8_rewind->frame_count, sizeof(chip8_snapshot_t));
+  if (chip8_rewind->captures)
+    printf(", capture %.1f us avg %.1f us max",
+           chip8_rewind->capture_seconds / (double)chip8_rewind->captures * 1e6,
+           chip8_rewind->capture_max_seconds * 1e6);
+  printf("\n");
+}
@@ -1,8 +1,46 @@
 #include "SDL_stdinc.h"
 #include <SDL2/SDL.h>
 #include <chip8.h>
+#include <chip8_movie.h>
+#include <chip8_rewind.h>
 #include <chip8_sdl.h>
+#include <chip8_sdl_audio.h>
 #include <stdint.h>
+#include <string.h>
+
+static inline uint32_t sdl_argb(SDL_Color color) {
+  return (uint32_t)color.a << 24 | (uint32_t)color.r << 16 |
+         (uint32_t)color.g << 8 | color.b;
+}
+
+// Expand the rows of display (bit n is row n) into texels and upload them,
+// a single update from the first to the last row
+static void sdl_upload_rows(chip8_sdl_t *chip8_sdl,
+                            const chip8_display_t *display, uint32_t rows) {
+  int first = -1, last = 0;
+  for (int y = 0; y < (int)CHIP8_DISPLAY_HEIGHT; y++) {
+    if (!((rows >> y) & 1u))
+      continue;
+    for (uint8_t b = 0; b < CHIP8_DISPLAY_WIDTH / 8; b++)
+      memcpy(&chip8_sdl->texels[y][b * 8], chip8_sdl->lut[(*display)[y][b]],
+             sizeof(chip8_sdl->lut[0]));
+    if (first < 0)
+      first = y;
+    last = y;
+  }
+  if (first < 0)
+    return;
+  const SDL_Rect rect = {0, first, CHIP8_DISPLAY_WIDTH, last - first + 1};
+  SDL_UpdateTexture(chip8_sdl->texture, &rect, chip8_sdl->texels[first],
+                    (int)sizeof(chip8_sdl->texels[0]));
+}
+
+// Show the texture, one copy whatever is lit
+static void sdl_render(chip8_sdl_t *chip8_sdl) {
+  SDL_RenderClear(chip8_sdl->renderer);
+  SDL_RenderCopy(chip8_sdl->renderer, chip8_sdl->texture, NULL, NULL);
+  SDL_RenderPresent(chip8_sdl->renderer);
+}
 
 int chip8_sdl_initialize(chip8_sdl_t *chip8_sdl, char *window_name,
                          uint32_t render_scale, SDL_Color background_color,
@@ -31,25 +69,42 @@ int chip8_sdl_initialize(chip8_sdl_t *chip8_sdl, char *window_name,
     SDL_Quit();
     return 1;
   }
-  // Set scale
+  // Create the display texture, stretched over the whole window
+  chip8_sdl->texture = SDL_CreateTexture(
+      chip8_sdl->renderer, SDL_PIXELFORMAT_ARGB8888,
+      SDL_TEXTUREACCESS_STREAMING, CHIP8_DISPLAY_WIDTH, CHIP8_DISPLAY_HEIGHT);
+  if (!chip8_sdl->texture) {
+    printf("SDL_CreateTexture Error: %s\n", SDL_GetError());
+    SDL_DestroyRenderer(chip8_sdl->renderer);
+    SDL_DestroyWindow(chip8_sdl->window);
+    SDL_Quit();
+    return 1;
+  }
+  // Set scale (only used by chip8_sdl_test now)
   SDL_RenderSetScale(chip8_sdl->renderer, (float)render_scale,
                      (float)render_scale);
   // Set colors
   chip8_sdl->background_color = background_color;
   chip8_sdl->foreground_color = foreground_color;
+  const uint32_t texel[2] = {sdl_argb(background_color),
+                             sdl_argb(foreground_color)};
+  for (uint32_t byte = 0; byte < 256; byte++)
+    for (uint8_t p = 0; p < 8; p++)
+      chip8_sdl->lut[byte][p] = texel[(byte >> (7 - p)) & 1];
+  chip8_sdl->rewind = NULL;
+  chip8_sdl->movie = NULL;
+  chip8_sdl->audio = NULL;
+  chip8_sdl->movie_replay = 0;
 
   // Clear ?
-  SDL_SetRenderDrawColor(chip8_sdl->renderer, chip8_sdl->background_color.r,
-                         chip8_sdl->background_color.g,
-                         chip8_sdl->background_color.b,
-                         chip8_sdl->background_color.a);
-  SDL_RenderClear(chip8_sdl->renderer);
-  SDL_RenderPresent(chip8_sdl->renderer);
+  memset(chip8_sdl->shown, 0, sizeof(chip8_sdl->shown));
+  chip8_sdl_draw_display((const chip8_display_t *)&chip8_sdl->shown, chip8_sdl);
 
   return 0;
 }
 
 void chip8_sdl_destroy(chip8_sdl_t *chip8_sdl) {
+  SDL_DestroyTexture(chip8_sdl->texture);
   SDL_DestroyRenderer(chip8_sdl->renderer);
   SDL_DestroyWindow(chip8_sdl->window);
   SDL_Quit();
@@ -83,28 +138,10 @@ void chip8_sdl_test(chip8_sdl_t *chip8_sdl) {
 }
 #endif
 
-// This is probably slow af
 void chip8_sdl_draw_display(const chip8_display_t *display, void *sdl_context) {
   chip8_sdl_t *chip8_sdl = (chip8_sdl_t *)sdl_context;
-  SDL_SetRenderDrawColor(chip8_sdl->renderer, chip8_sdl->background_color.r,
-                         chip8_sdl->background_color.g,
-                         chip8_sdl->background_color.b,
-                         chip8_sdl->background_color.a);
-  SDL_RenderClear(chip8_sdl->renderer);
-  SDL_SetRenderDrawColor(chip8_sdl->renderer, chip8_sdl->foreground_color.r,
-                         chip8_sdl->foreground_color.g,
-                         chip8_sdl->foreground_color.b,
-                         chip8_sdl->foreground_color.a);
-  for (int32_t y = 0; y < (int32_t)CHIP8_DISPLAY_HEIGHT; y++) {
-    for (int32_t x = 0; x < (int32_t)CHIP8_DISPLAY_WIDTH / 8; x++) {
-      for (int8_t p = 7; p >= 0; p--) {
-        if (((*display)[y][x] >> p) & 1) {
-          SDL_RenderDrawPoint(chip8_sdl->renderer, x * 8 + 7 - p, y);
-        }
-      }
-    }
-  }
-  SDL_RenderPresent(chip8_sdl->renderer);
+  sdl_upload_rows(chip8_sdl, display, CHIP8_DISPLAY_ALL_ROWS);
+  sdl_render(chip8_sdl);
 }
 
 static inline uint8_t sdl_key_to_chip8_key(SDL_Keycode key) {
@@ -146,52 +183,383 @@ static inline uint8_t sdl_key_to_chip8_key(SDL_Keycode key) {
   }
 }
 
-// Basic loop implementation
-// TODO: Improve timings and stuf
+// Emulation thread state
+typedef struct {
+  chip8_t *chip8;
+  chip8_sdl_t *chip8_sdl;
+  uint32_t cycles_per_frame;
+  uint32_t frame;            // Next frame to run
+  uint32_t cycles;           // Instructions of it run so far
+  uint64_t start_cycles;     // chip8->cycles when it started
+  chip8_display_t published; // Last frame handed over
+  uint32_t audio_time;       // Emulated time at the start of the frame, in samples
+  uint8_t buzzing;           // ST state last sent to the audio
+} sdl_emulation_t;
+
+// Queue a key event for the emulation thread (render thread)
+static void sdl_push_key(chip8_sdl_t *chip8_sdl, uint64_t time, uint8_t key,
+                         uint8_t pressed) {
+  uint32_t head = (uint32_t)SDL_AtomicGet(&chip8_sdl->key_head);
+  if (head - (uint32_t)SDL_AtomicGet(&chip8_sdl->key_tail) >=
+      CHIP8_SDL_KEY_RING_SIZE) {
+    chip8_sdl->keys_dropped++;
+    return;
+  }
+  chip8_sdl_key_t *event = &chip8_sdl->key_ring[head % CHIP8_SDL_KEY_RING_SIZE];
+  event->time = time;
+  event->key = key;
+  event->pressed = pressed;
+  SDL_AtomicSet(&chip8_sdl->key_head, (int)(head + 1u)); // Publishes it
+}
+
+// Take the oldest key event that happened before time (emulation thread),
+// returns 0 if there are none
+static int sdl_pop_key(chip8_sdl_t *chip8_sdl, uint64_t time,
+                       chip8_sdl_key_t *event) {
+  uint32_t tail = (uint32_t)SDL_AtomicGet(&chip8_sdl->key_tail);
+  if (tail == (uint32_t)SDL_AtomicGet(&chip8_sdl->key_head))
+    return 0;
+  const chip8_sdl_key_t *next =
+      &chip8_sdl->key_ring[tail % CHIP8_SDL_KEY_RING_SIZE];
+  if (next->time >= time)
+    return 0;
+  *event = *next;
+  SDL_AtomicSet(&chip8_sdl->key_tail, (int)(tail + 1u));
+  return 1;
+}
+
+// Send the ST state to the audio at offset cycles into the frame, if it changed
+static void sdl_buzz(sdl_emulation_t *emulation, uint8_t on, uint64_t offset) {
+  chip8_sdl_audio_t *audio = emulation->chip8_sdl->audio;
+  if (!audio || on == emulation->buzzing)
+    return;
+  if (offset > emulation->cycles_per_frame)
+    offset = emulation->cycles_per_frame;
+  chip8_sdl_audio_push(audio,
+                       emulation->audio_time +
+                           (uint32_t)(offset * audio->samples_per_frame /
+                                      emulation->cycles_per_frame),
+                       on);
+  emulation->buzzing = on;
+}
+
+// End a frame of emulated time for the audio
+static void sdl_audio_frame_end(sdl_emulation_t *emulation) {
+  chip8_sdl_audio_t *audio = emulation->chip8_sdl->audio;
+  if (!audio)
+    return;
+  emulation->audio_time += audio->samples_per_frame;
+  chip8_sdl_audio_advance(audio, emulation->audio_time);
+}
+
+// Run the current 60 Hz frame, which stands for start to end (performance
+// counter), up to the instruction matching now, so what it draws is handed
+// over without waiting for the frame to be over. The key events that happened
+// before now are applied after the instruction at the same point of the frame
+// (or the next one to run, if that one already did), and recorded if there is
+// a movie being recorded. Returns 1 once the frame is over, VBlank and the
+// timers done
+static int sdl_emulate_frame(sdl_emulation_t *emulation, uint64_t start,
+                             uint64_t end, uint64_t now) {
+  chip8_t *chip8 = emulation->chip8;
+  chip8_sdl_t *chip8_sdl = emulation->chip8_sdl;
+  const uint32_t cycles_per_frame = emulation->cycles_per_frame;
+  if (!emulation->cycles)
+    emulation->start_cycles = chip8->cycles;
+  if (chip8_sdl->movie && chip8_sdl->movie_replay) {
+    chip8_movie_run_frame(chip8_sdl->movie, chip8, emulation->frame,
+                          cycles_per_frame);
+    emulation->cycles = cycles_per_frame;
+  } else {
+    if (now > end)
+      now = end;
+    chip8_sdl_key_t event;
+    while (sdl_pop_key(chip8_sdl, now, &event)) {
+      if (chip8_key_pressed(chip8, event.key) == event.pressed)
+        continue;
+      // Older ones (the frames before got dropped) go at the start
+      uint32_t cycle = 0;
+      if (event.time > start)
+        cycle = (uint32_t)((event.time - start) * cycles_per_frame /
+                           (end - start));
+      // chip8_run returns early on events, keep going until the key's cycle
+      while (emulation->cycles < cycle)
+        emulation->cycles += chip8_run(chip8, cycle - emulation->cycles);
+      if (chip8_sdl->movie)
+        chip8_movie_record_key(chip8_sdl->movie, emulation->frame,
+                               emulation->cycles, event.key, event.pressed);
+      if (event.pressed)
+        chip8_set_key(chip8, event.key);
+      else
+        chip8_reset_key(chip8, event.key);
+    }
+    uint32_t cycle = cycles_per_frame;
+    if (now < end)
+      cycle = (uint32_t)((now - start) * cycles_per_frame / (end - start));
+    while (emulation->cycles < cycle)
+      emulation->cycles += chip8_run(chip8, cycle - emulation->cycles);
+  }
+  // Drain the events so far, the display is checked when publishing
+  chip8_event_t chip8_event;
+  while (chip8_poll_event(chip8, &chip8_event)) {
+    // The ST stop of the last timer tick comes before the frame started
+    uint64_t offset = chip8_event.cycle > emulation->start_cycles
+                          ? chip8_event.cycle - emulation->start_cycles
+                          : 0;
+    if (chip8_event.type == CHIP8_EVENT_SOUND_START)
+      sdl_buzz(emulation, 1, offset);
+    else if (chip8_event.type == CHIP8_EVENT_SOUND_STOP)
+      sdl_buzz(emulation, 0, offset);
+    else if (chip8_event.type == CHIP8_EVENT_UNKNOWN_OPCODE)
+      printf("Unknown Instruction found: %04x at 0x%03x\n",
+             chip8_opcode_at(chip8, chip8_event.pc), chip8_event.pc);
+  }
+  if (emulation->cycles < cycles_per_frame)
+    return 0;
+  emulation->cycles = 0;
+  chip8_frame_end(chip8);
+  sdl_audio_frame_end(emulation);
+  if (chip8_sdl->rewind)
+    chip8_rewind_capture(chip8_sdl->rewind, chip8);
+  return 1;
+}
+
+// Wait until the performance counter reaches deadline, SDL_Delay for the bulk
+// (it only has milliseconds and can oversleep one) and spin the rest
+static void sdl_wait_until(Uint64 deadline, Uint64 frequency) {
+  for (;;) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (now >= deadline)
+      return;
+    Uint64 remaining_ms = (deadline - now) * 1000u / frequency;
+    if (remaining_ms > CHIP8_SDL_SPIN_MS)
+      SDL_Delay((Uint32)(remaining_ms - CHIP8_SDL_SPIN_MS));
+  }
+}
+
+// Emulation thread, runs 60 Hz frames from the time elapsed (a fixed
+// timestep), the current one a slice at a time as the time goes by, and hands
+// the display to the renderer whenever it changed
+static int sdl_emulation_thread(void *data) {
+  sdl_emulation_t *emulation = (sdl_emulation_t *)data;
+  chip8_t *chip8 = emulation->chip8;
+  chip8_sdl_t *chip8_sdl = emulation->chip8_sdl;
+  chip8_sdl_pacing_t *pacing = &chip8_sdl->pacing;
+  const SDL_bool replaying =
+      chip8_sdl->movie && chip8_sdl->movie_replay ? SDL_TRUE : SDL_FALSE;
+  int back = 0; // Frame written here, the other two are middle and front
+
+  const Uint64 frequency = SDL_GetPerformanceFrequency();
+  Uint64 tick_start = SDL_GetPerformanceCounter(); // Ticks are counted from here
+  while (!SDL_AtomicGet(&chip8_sdl->quit)) {
+    if (replaying) { // Uncapped
+      if (emulation->frame > chip8_sdl->movie->frames)
+        break;
+      sdl_emulate_frame(emulation, 0, 0, 0);
+      emulation->frame++;
+      pacing->ticks++;
+    } else {
+      // Run the 60 Hz frames that are over and the current one up to now,
+      // dropping time after a stall instead of running a burst of frames to
+      // catch up
+      Uint64 now = SDL_GetPerformanceCounter();
+      Uint64 due = (now - tick_start) * CHIP8_TIMER_HZ / frequency;
+      if (due > pacing->ticks + CHIP8_SDL_MAX_CATCH_UP) {
+        tick_start += (due - pacing->ticks - CHIP8_SDL_MAX_CATCH_UP) *
+                      frequency / CHIP8_TIMER_HZ;
+        due = pacing->ticks + CHIP8_SDL_MAX_CATCH_UP;
+      }
+      while (pacing->ticks <= due) {
+        // Frame of real time this tick stands for
+        uint64_t start = tick_start + pacing->ticks * frequency / CHIP8_TIMER_HZ;
+        uint64_t end =
+            tick_start + (pacing->ticks + 1) * frequency / CHIP8_TIMER_HZ;
+        if (!emulation->cycles && SDL_AtomicGet(&chip8_sdl->rewinding) &&
+            chip8_sdl->rewind) {
+          if (now < end)
+            break; // Once it is over
+          // Go back a frame instead, keeping the keys held now
+          uint16_t keys = chip8->keys;
+          chip8_rewind_step_back(chip8_sdl->rewind, chip8, 1);
+          chip8->keys = keys;
+          chip8_sdl_key_t event;
+          while (sdl_pop_key(chip8_sdl, end, &event)) {
+            if (event.pressed)
+              chip8->keys |= (uint16_t)(1u << event.key);
+            else
+              chip8->keys &= (uint16_t)~(1u << event.key);
+          }
+          sdl_buzz(emulation, chip8->ST != 0, 0);
+          sdl_audio_frame_end(emulation);
+          pacing->ticks++;
+          continue;
+        }
+        if (!sdl_emulate_frame(emulation, start, end, now))
+          break;
+        emulation->frame++;
+        pacing->ticks++;
+      }
+    }
+    // Hand the frame over if it changed, the renderer takes the newest
+    if (chip8_display_changes(chip8, &emulation->published)) {
+      memcpy(chip8_sdl->frames[back], emulation->published,
+             sizeof(emulation->published));
+      back = SDL_AtomicSet(&chip8_sdl->middle, back | CHIP8_SDL_FRESH) &
+             ~CHIP8_SDL_FRESH;
+    }
+    if (!replaying)
+      SDL_Delay(CHIP8_SDL_SLICE_MS); // Till the next slice
+  }
+  SDL_AtomicSet(&chip8_sdl->done, 1);
+  return 0;
+}
+
+// Take the newest frame from the emulation thread and present the rows that
+// changed since the last present
+static void sdl_present(chip8_sdl_t *chip8_sdl, int *front) {
+  if (!(SDL_AtomicGet(&chip8_sdl->middle) & CHIP8_SDL_FRESH))
+    return;
+  *front = SDL_AtomicSet(&chip8_sdl->middle, *front) & ~CHIP8_SDL_FRESH;
+  const chip8_display_t *frame =
+      (const chip8_display_t *)&chip8_sdl->frames[*front];
+  uint32_t rows = 0;
+  for (uint8_t y = 0; y < CHIP8_DISPLAY_HEIGHT; y++) {
+    if (memcmp(chip8_sdl->shown[y], (*frame)[y], sizeof((*frame)[y]))) {
+      memcpy(chip8_sdl->shown[y], (*frame)[y], sizeof((*frame)[y]));
+      rows |= 1u << y;
+    }
+  }
+  if (!rows)
+    return;
+  sdl_upload_rows(chip8_sdl, (const chip8_display_t *)&chip8_sdl->shown, rows);
+  sdl_render(chip8_sdl);
+}
+
+static void sdl_pacing_add(chip8_sdl_pacing_t *pacing, double seconds,
+                           double late_seconds) {
+  if (!pacing->frames || seconds < pacing->min_frame_seconds)
+    pacing->min_frame_seconds = seconds;
+  if (seconds > pacing->max_frame_seconds)
+    pacing->max_frame_seconds = seconds;
+  pacing->frames++;
+  pacing->frame_seconds += seconds;
+  pacing->frame_seconds_sq += seconds * seconds;
+  if (late_seconds > CHIP8_SDL_LATE_MS / 1000.0)
+    pacing->late_frames++;
+}
+
+// The render thread (this one, SDL wants events and rendering on the thread
+// that made the window) presents at target_fps on a schedule counted from the
+// start, so waking up late does not push the next frames back
 void chip8_sdl_run(chip8_t *chip8, chip8_sdl_t *chip8_sdl,
                    uint32_t cycles_per_frame, uint32_t target_fps) {
   SDL_Event event;
   SDL_bool running = SDL_TRUE;
+  chip8_sdl_pacing_t *pacing = &chip8_sdl->pacing;
+  memset(pacing, 0, sizeof(*pacing));
+  pacing->target_fps = target_fps;
 
-  while (running) {
-    Uint32 start_ticks = SDL_GetTicks();
+  // Keys ignored while replaying a movie
+  const SDL_bool replaying =
+      chip8_sdl->movie && chip8_sdl->movie_replay ? SDL_TRUE : SDL_FALSE;
+  SDL_AtomicSet(&chip8_sdl->key_head, 0);
+  SDL_AtomicSet(&chip8_sdl->key_tail, 0);
+  chip8_sdl->keys_dropped = 0;
+  SDL_AtomicSet(&chip8_sdl->rewinding, 0);
+  SDL_AtomicSet(&chip8_sdl->quit, 0);
+  SDL_AtomicSet(&chip8_sdl->done, 0);
+  // Buffer 0 is the emulation thread's, 1 starts in the middle, 2 is ours
+  SDL_AtomicSet(&chip8_sdl->middle, 1);
+  int front = 2;
+
+  sdl_emulation_t emulation;
+  emulation.chip8 = chip8;
+  emulation.chip8_sdl = chip8_sdl;
+  emulation.cycles_per_frame = cycles_per_frame;
+  emulation.frame = 1;
+  emulation.cycles = 0;
+  emulation.start_cycles = 0;
+  emulation.audio_time = 0;
+  emulation.buzzing = 0;
+  memcpy(emulation.published, chip8_sdl->shown, sizeof(emulation.published));
+  SDL_Thread *thread =
+      SDL_CreateThread(sdl_emulation_thread, "chip8", &emulation);
+  if (!thread) {
+    printf("SDL_CreateThread Error: %s\n", SDL_GetError());
+    return;
+  }
+
+  const Uint64 frequency = SDL_GetPerformanceFrequency();
+  const Uint64 start = SDL_GetPerformanceCounter();
+  const Uint32 start_ticks = SDL_GetTicks();
+  Uint64 frame_start = start; // Presents are scheduled from here
+  Uint64 presents = 0;        // Presents since frame_start
+  Uint64 woke = start;
+
+  while (running && !SDL_AtomicGet(&chip8_sdl->done)) {
     while (SDL_PollEvent(&event)) {
       if (event.type == SDL_QUIT) {
         running = SDL_FALSE;
-      } else if (event.type == SDL_KEYDOWN) {
-        if (sdl_key_to_chip8_key(event.key.keysym.sym) != 0xFF) {
-          chip8_set_key(chip8, sdl_key_to_chip8_key(event.key.keysym.sym));
-        }
-      } else if (event.type == SDL_KEYUP) {
-        if (sdl_key_to_chip8_key(event.key.keysym.sym) != 0xFF) {
-          chip8_reset_key(chip8, sdl_key_to_chip8_key(event.key.keysym.sym));
-        }
+      } else if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
+        uint8_t pressed = event.type == SDL_KEYDOWN;
+        if (event.key.keysym.sym == SDLK_BACKSPACE)
+          SDL_AtomicSet(&chip8_sdl->rewinding, pressed);
+        uint8_t key = sdl_key_to_chip8_key(event.key.keysym.sym);
+        if (key == 0xFF || event.key.repeat || replaying)
+          continue;
+        // Event timestamps are SDL_GetTicks milliseconds
+        uint64_t time = start;
+        if (event.key.timestamp > start_ticks)
+          time += (uint64_t)(event.key.timestamp - start_ticks) * frequency /
+                  1000u;
+        sdl_push_key(chip8_sdl, time, key, pressed);
       } else if (event.type == SDL_WINDOWEVENT) {
         if (event.window.event == SDL_WINDOWEVENT_EXPOSED ||
             event.window.event == SDL_WINDOWEVENT_RESTORED) {
           // Redraw when it gets minimized and stuff
-          chip8_sdl_draw_display((const chip8_display_t *)&chip8->display,
-                                 chip8_sdl);
+          sdl_render(chip8_sdl);
         }
       }
     }
-    for (uint32_t i = 0; i < cycles_per_frame; i++) {
-      chip8_step(chip8);
+    sdl_present(chip8_sdl, &front);
+
+    // Wait for the next present on the schedule, starting it over if it fell
+    // more than a frame behind
+    Uint64 deadline = frame_start + (presents + 1) * frequency / target_fps;
+    sdl_wait_until(deadline, frequency);
+    Uint64 now = SDL_GetPerformanceCounter();
+    sdl_pacing_add(pacing, (double)(now - woke) / (double)frequency,
+                   (double)(now - deadline) / (double)frequency);
+    woke = now;
+    presents++;
+    if (now - deadline > frequency / target_fps) {
+      frame_start = now;
+      presents = 0;
     }
-#ifndef CHIP8_USE_DRAW_CALLBACK
-    if (chip8->interface.display_update_flag)
-      chip8_sdl_draw_display((const chip8_display_t *)&chip8->display, chip8_sdl);
-#endif /* ifdef CHIP8_USE_DRAW_CALLBACK */
-#ifdef CHIP8_WAIT_VBLANK
-    chip8->interface.vblank_ready = 1;
-#endif /* ifdef CHIP8_WAIT_VBLANK */
-#ifdef CHIP8_FX0A_RELEASE
-    chip8_save_key(chip8);
-#endif /* ifdef CHIP8_FX0A_RELEASE */
-    chip8_timer_tick(chip8);
-    Uint32 end_ticks = SDL_GetTicks();
-    SDL_Delay((1000 / target_fps) - (start_ticks - end_ticks));
   }
-
+  SDL_AtomicSet(&chip8_sdl->quit, 1);
+  SDL_WaitThread(thread, NULL);
+  sdl_present(chip8_sdl, &front); // The last frame of a replay
+  pacing->seconds = (double)(SDL_GetPerformanceCounter() - start) /
+                    (double)frequency;
+  if (chip8_sdl->movie && !replaying)
+    chip8_movie_end(chip8_sdl->movie, emulation.frame - 1, chip8);
 }
 
+void chip8_sdl_print_pacing(const chip8_sdl_t *chip8_sdl) {
+  const chip8_sdl_pacing_t *pacing = &chip8_sdl->pacing;
+  if (!pacing->frames)
+    return;
+  double frames = (double)pacing->frames;
+  double average = pacing->frame_seconds / frames;
+  double variance = pacing->frame_seconds_sq / frames - average * average;
+  printf("Pacing: %llu frames, %.3f ms avg (target %.3f ms), %.3f ms jitter, "
+         "%.3f/%.3f ms min/max, %llu late",
+         (unsigned long long)pacing->frames, average * 1e3,
+         1e3 / pacing->target_fps, variance > 0.0 ? SDL_sqrt(variance) * 1e3 : 0.0,
+         pacing->min_frame_seconds * 1e3, pacing->max_frame_seconds * 1e3,
+         (unsigned long long)pacing->late_frames);
+  if (pacing->seconds > 0.0)
+    printf(", timers at %.2f Hz", (double)pacing->ticks / pacing->seconds);
+  printf("\n");
+}
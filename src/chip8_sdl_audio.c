@@ -0,0 +1,136 @@
+#include <SDL2/SDL.h>
+#include <chip8.h>
+#include <chip8_sdl_audio.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Signed distance from a to b in emulated time (it wraps after 24 hours)
+static inline int32_t audio_distance(uint32_t a, uint32_t b) {
+  return (int32_t)(b - a);
+}
+
+static void audio_callback(void *user_data, Uint8 *stream, int length) {
+  chip8_sdl_audio_t *chip8_sdl_audio = (chip8_sdl_audio_t *)user_data;
+  int16_t *out = (int16_t *)(void *)stream;
+  const uint32_t samples = (uint32_t)length / sizeof(*out);
+  const uint32_t emulated = (uint32_t)SDL_AtomicGet(&chip8_sdl_audio->emulated);
+  chip8_sdl_audio->callbacks++;
+  if (!chip8_sdl_audio->started && !emulated) { // Nothing emulated yet
+    memset(stream, 0, (size_t)length);
+    return;
+  }
+
+  // Stay latency behind the emulation, starting over if it stalled or jumped
+  int32_t lag = audio_distance(chip8_sdl_audio->cursor, emulated);
+  if (!chip8_sdl_audio->started ||
+      lag > 4 * (int32_t)chip8_sdl_audio->latency || lag < 0) {
+    if (chip8_sdl_audio->started)
+      chip8_sdl_audio->resyncs++;
+    chip8_sdl_audio->cursor = emulated - chip8_sdl_audio->latency;
+    chip8_sdl_audio->started = 1;
+  } else if (lag < (int32_t)samples) {
+    chip8_sdl_audio->underruns++; // Plays on with the state it has
+  }
+
+  const uint32_t head = (uint32_t)SDL_AtomicGet(&chip8_sdl_audio->head);
+  uint32_t tail = (uint32_t)SDL_AtomicGet(&chip8_sdl_audio->tail);
+  const float fade =
+      1.0f / (float)(chip8_sdl_audio->frequency * CHIP8_SDL_AUDIO_FADE_MS / 1000u);
+  for (uint32_t i = 0; i < samples; i++) {
+    while (tail != head &&
+           audio_distance(chip8_sdl_audio->cursor,
+                          chip8_sdl_audio
+                              ->ring[tail % CHIP8_SDL_AUDIO_RING_SIZE]
+                              .time) <= 0) {
+      chip8_sdl_audio->on =
+          chip8_sdl_audio->ring[tail % CHIP8_SDL_AUDIO_RING_SIZE].on;
+      tail++;
+    }
+    if (chip8_sdl_audio->on) {
+      chip8_sdl_audio->gain += fade;
+      if (chip8_sdl_audio->gain > 1.0f)
+        chip8_sdl_audio->gain = 1.0f;
+    } else {
+      chip8_sdl_audio->gain -= fade;
+      if (chip8_sdl_audio->gain < 0.0f)
+        chip8_sdl_audio->gain = 0.0f;
+    }
+    float square = chip8_sdl_audio->phase < 0x80000000u ? 1.0f : -1.0f;
+    out[i] = (int16_t)(square * chip8_sdl_audio->gain * CHIP8_SDL_AUDIO_VOLUME *
+                       32767.0f);
+    // The phase keeps going while silent so the next start is not a glitch
+    chip8_sdl_audio->phase += chip8_sdl_audio->phase_step;
+    chip8_sdl_audio->cursor++;
+  }
+  SDL_AtomicSet(&chip8_sdl_audio->tail, (int)tail);
+}
+
+int chip8_sdl_audio_initialize(chip8_sdl_audio_t *chip8_sdl_audio) {
+  memset(chip8_sdl_audio, 0, sizeof(*chip8_sdl_audio));
+  if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+    printf("SDL_InitSubSystem Error: %s\n", SDL_GetError());
+    return 1;
+  }
+  SDL_AudioSpec want, have;
+  memset(&want, 0, sizeof(want));
+  want.freq = CHIP8_SDL_AUDIO_FREQUENCY;
+  want.format = AUDIO_S16SYS;
+  want.channels = 1;
+  want.samples = CHIP8_SDL_AUDIO_SAMPLES;
+  want.callback = audio_callback;
+  want.userdata = chip8_sdl_audio;
+  chip8_sdl_audio->device = SDL_OpenAudioDevice(
+      NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+  if (!chip8_sdl_audio->device) {
+    printf("SDL_OpenAudioDevice Error: %s\n", SDL_GetError());
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    return 1;
+  }
+  chip8_sdl_audio->frequency = (uint32_t)have.freq;
+  chip8_sdl_audio->samples = have.samples;
+  chip8_sdl_audio->samples_per_frame = chip8_sdl_audio->frequency / CHIP8_TIMER_HZ;
+  // The emulation moves a frame at a time, and the callback needs a buffer
+  // past where it is
+  chip8_sdl_audio->latency =
+      chip8_sdl_audio->samples_per_frame + 2u * chip8_sdl_audio->samples;
+  chip8_sdl_audio->phase_step = (uint32_t)(
+      ((uint64_t)CHIP8_SDL_AUDIO_TONE_HZ << 32) / chip8_sdl_audio->frequency);
+  SDL_PauseAudioDevice(chip8_sdl_audio->device, 0);
+  return 0;
+}
+
+void chip8_sdl_audio_destroy(chip8_sdl_audio_t *chip8_sdl_audio) {
+  SDL_CloseAudioDevice(chip8_sdl_audio->device);
+  SDL_QuitSubSystem(SDL_INIT_AUDIO);
+}
+
+void chip8_sdl_audio_push(chip8_sdl_audio_t *chip8_sdl_audio, uint32_t time,
+                          uint8_t on) {
+  uint32_t head = (uint32_t)SDL_AtomicGet(&chip8_sdl_audio->head);
+  if (head - (uint32_t)SDL_AtomicGet(&chip8_sdl_audio->tail) >=
+      CHIP8_SDL_AUDIO_RING_SIZE) {
+    chip8_sdl_audio->dropped++;
+    return;
+  }
+  chip8_sdl_audio_transition_t *transition =
+      &chip8_sdl_audio->ring[head % CHIP8_SDL_AUDIO_RING_SIZE];
+  transition->time = time;
+  transition->on = on;
+  SDL_AtomicSet(&chip8_sdl_audio->head, (int)(head + 1u)); // Publishes it
+}
+
+void chip8_sdl_audio_advance(chip8_sdl_audio_t *chip8_sdl_audio,
+                             uint32_t time) {
+  SDL_AtomicSet(&chip8_sdl_audio->emulated, (int)time);
+}
+
+void chip8_sdl_audio_print_stats(const chip8_sdl_audio_t *chip8_sdl_audio) {
+  printf("Audio: %u samples per buffer at %u Hz, %.1f ms behind the "
+         "emulation, %u underruns in %u buffers, %u resyncs, %u transitions "
+         "dropped\n",
+         chip8_sdl_audio->samples, chip8_sdl_audio->frequency,
+         (double)chip8_sdl_audio->latency * 1e3 / chip8_sdl_audio->frequency,
+         chip8_sdl_audio->underruns, chip8_sdl_audio->callbacks,
+         chip8_sdl_audio->resyncs, chip8_sdl_audio->dropped);
+}
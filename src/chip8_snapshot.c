@@ -0,0 +1,281 @@
+#include <chip8.h>
+#include <chip8_jit.h>
+#include <chip8_snapshot.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Matching bytes shorter than a run header are cheaper kept inside the run
+#define SNAPSHOT_RUN_GAP 4u
+
+void chip8_snapshot_take(const chip8_t *chip8, chip8_snapshot_t *snapshot) {
+  snapshot->PC = chip8->PC;
+  snapshot->SP = chip8->SP;
+  memcpy(snapshot->stack, chip8->stack, sizeof(snapshot->stack));
+  memcpy(snapshot->V, chip8->V, sizeof(snapshot->V));
+  snapshot->I = chip8->I;
+  snapshot->DT = chip8->DT;
+  snapshot->ST = chip8->ST;
+  memcpy(snapshot->memory, chip8->memory, sizeof(snapshot->memory));
+  memcpy(snapshot->display, chip8->display, sizeof(snapshot->display));
+  snapshot->keys = chip8->keys;
+#ifdef CHIP8_FX0A_RELEASE
+  snapshot->previous_keys = chip8->previous_keys;
+#else
+  snapshot->previous_keys = 0;
+#endif // CHIP8_FX0A_RELEASE
+  snapshot->quirks = chip8->quirks;
+  snapshot->vblank_ready = chip8->interface.vblank_ready;
+  snapshot->cycles = chip8->cycles;
+  snapshot->idle_cycles = chip8->idle_cycles;
+  snapshot->rand_state = chip8->rand_state;
+}
+
+void chip8_snapshot_restore(chip8_t *chip8, const chip8_snapshot_t *snapshot) {
+  // Predecoded ops and compiled blocks only go stale if the code did
+  int changed = memcmp(chip8->memory, snapshot->memory, CHIP8_MEM_SIZE) != 0;
+  int stale = snapshot->quirks != chip8->quirks || changed;
+  chip8->PC = snapshot->PC;
+  chip8->SP = snapshot->SP;
+  memcpy(chip8->stack, snapshot->stack, sizeof(chip8->stack));
+  memcpy(chip8->V, snapshot->V, sizeof(chip8->V));
+  chip8->I = snapshot->I;
+  chip8->DT = snapshot->DT;
+  chip8->ST = snapshot->ST;
+  if (changed) // Shared memory stays shared if nothing was written
+    memcpy(chip8_memory_writable(chip8), snapshot->memory, CHIP8_MEM_SIZE);
+  if (memcmp(chip8->display, snapshot->display, sizeof(chip8->display))) {
+    memcpy(chip8->display, snapshot->display, sizeof(chip8->display));
+    chip8_display_invalidate(chip8);
+  }
+  chip8->keys = snapshot->keys;
+#ifdef CHIP8_FX0A_RELEASE
+  chip8->previous_keys = snapshot->previous_keys;
+#endif // CHIP8_FX0A_RELEASE
+  chip8->interface.vblank_ready = snapshot->vblank_ready;
+  chip8->cycles = snapshot->cycles;
+  chip8->idle_cycles = snapshot->idle_cycles;
+  chip8->rand_state = snapshot->rand_state;
+  // Events raised after the snapshot never happened
+  chip8->pending_events = 0;
+  chip8->last_events = 0;
+  chip8->event_head = chip8->event_tail = 0;
+  if (stale) {
+    chip8_set_quirks(chip8, snapshot->quirks); // Flushes the predecoded ops
+    if (chip8->jit)
+      chip8_jit_flush(chip8->jit);
+  }
+}
+
+// Memory right after chip8_initialize and chip8_load_rom, and its hash
+static uint64_t snapshot_boot_image(uint8_t *image, const uint8_t *rom,
+                                    uint16_t rom_size) {
+  const chip8_interface_t no_interface = {0};
+  chip8_t boot;
+  chip8_initialize(&boot, no_interface);
+  memcpy(image, boot.memory, CHIP8_MEM_SIZE);
+  if (rom) {
+    if (rom_size > CHIP8_MEM_SIZE - 0x200)
+      rom_size = CHIP8_MEM_SIZE - 0x200;
+    memcpy(&image[0x200], rom, rom_size);
+  }
+  uint64_t hash = UINT64_C(0xcbf29ce484222325); // Same FNV-1a as the display
+  for (uint16_t i = 0; i < CHIP8_MEM_SIZE; i++) {
+    hash ^= image[i];
+    hash *= UINT64_C(0x100000001b3);
+  }
+  return hash;
+}
+
+uint64_t chip8_snapshot_boot_hash(const uint8_t *rom, uint16_t rom_size) {
+  uint8_t image[CHIP8_MEM_SIZE];
+  return snapshot_boot_image(image, rom, rom_size);
+}
+
+static inline void put32(uint8_t *p, uint32_t value) {
+  for (uint8_t i = 0; i < 4; i++)
+    p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static inline void put16(uint8_t *p, uint16_t value) {
+  p[0] = (uint8_t)value;
+  p[1] = (uint8_t)(value >> 8);
+}
+
+static inline void put64(uint8_t *p, uint64_t value) {
+  for (uint8_t i = 0; i < 8; i++)
+    p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline uint16_t get16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint64_t get64(const uint8_t *p) {
+  uint64_t value = 0;
+  for (uint8_t i = 0; i < 8; i++)
+    value |= (uint64_t)p[i] << (8 * i);
+  return value;
+}
+
+size_t chip8_snapshot_save(const chip8_t *chip8, const uint8_t *rom,
+                           uint16_t rom_size, uint8_t *buffer, size_t size) {
+  uint8_t image[CHIP8_MEM_SIZE];
+  chip8_snapshot_t snapshot;
+  uint64_t boot_hash = snapshot_boot_image(image, rom, rom_size);
+  chip8_snapshot_take(chip8, &snapshot);
+  if (size < CHIP8_SNAPSHOT_HEADER_SIZE)
+    return 0;
+
+  uint8_t *p = buffer;
+  memcpy(p, "CH8S", 4);
+  put16(p + 4, CHIP8_SNAPSHOT_VERSION);
+  p[6] = snapshot.quirks;
+  p[7] = snapshot.SP;
+  put16(p + 8, snapshot.PC);
+  put16(p + 10, snapshot.I);
+  memcpy(p + 12, snapshot.V, 16);
+  for (uint8_t i = 0; i < CHIP8_STACK_SIZE; i++)
+    put16(p + 28 + 2 * i, snapshot.stack[i]);
+  p[60] = snapshot.DT;
+  p[61] = snapshot.ST;
+  put16(p + 62, snapshot.keys);
+  put16(p + 64, snapshot.previous_keys);
+  p[66] = snapshot.vblank_ready;
+  put64(p + 67, snapshot.cycles);
+  put64(p + 75, snapshot.idle_cycles);
+  put64(p + 83, boot_hash);
+  memcpy(p + 91, snapshot.display, sizeof(snapshot.display));
+  put32(p + 347, snapshot.rand_state);
+
+  // Memory runs that differ from the boot image
+  size_t used = CHIP8_SNAPSHOT_HEADER_SIZE;
+  uint16_t runs = 0;
+  uint16_t addr = 0;
+  while (addr < CHIP8_MEM_SIZE) {
+    if (snapshot.memory[addr] == image[addr]) {
+      addr++;
+      continue;
+    }
+    // The run ends at a long enough stretch of matching bytes
+    uint16_t end = (uint16_t)(addr + 1);
+    uint16_t same = 0;
+    while (end < CHIP8_MEM_SIZE && same < SNAPSHOT_RUN_GAP) {
+      same = snapshot.memory[end] == image[end] ? (uint16_t)(same + 1) : 0;
+      end++;
+    }
+    end -= same;
+    uint16_t length = (uint16_t)(end - addr);
+    if (used + 4u + length > size)
+      return 0;
+    put16(buffer + used, addr);
+    put16(buffer + used + 2, length);
+    memcpy(buffer + used + 4, &snapshot.memory[addr], length);
+    used += 4u + length;
+    runs++;
+    addr = end;
+  }
+  put16(p + 351, runs);
+  return used;
+}
+
+int chip8_snapshot_load(chip8_t *chip8, const uint8_t *rom, uint16_t rom_size,
+                        const uint8_t *buffer, size_t size) {
+  chip8_snapshot_t snapshot;
+  const uint8_t *p = buffer;
+  if (size < 6 || memcmp(p, "CH8S", 4)) {
+    printf("Snapshot Error: not a snapshot\n");
+    return 1;
+  }
+  uint16_t version = get16(p + 4);
+  if (version < 1 || version > CHIP8_SNAPSHOT_VERSION) {
+    printf("Snapshot Error: version %u is not supported\n", version);
+    return 1;
+  }
+  // Version 1 had no RNG state, so its header is 4 bytes shorter
+  size_t header_size = version == 1 ? CHIP8_SNAPSHOT_HEADER_SIZE - 4u
+                                    : CHIP8_SNAPSHOT_HEADER_SIZE;
+  if (size < header_size) {
+    printf("Snapshot Error: truncated\n");
+    return 1;
+  }
+  if (get64(p + 83) != snapshot_boot_image(snapshot.memory, rom, rom_size)) {
+    printf("Snapshot Error: saved with another ROM\n");
+    return 1;
+  }
+
+  snapshot.quirks = p[6] & CHIP8_QUIRK_MASK;
+  snapshot.SP = p[7];
+  snapshot.PC = get16(p + 8);
+  snapshot.I = get16(p + 10);
+  memcpy(snapshot.V, p + 12, 16);
+  for (uint8_t i = 0; i < CHIP8_STACK_SIZE; i++)
+    snapshot.stack[i] = get16(p + 28 + 2 * i);
+  snapshot.DT = p[60];
+  snapshot.ST = p[61];
+  snapshot.keys = get16(p + 62);
+  snapshot.previous_keys = get16(p + 64);
+  snapshot.vblank_ready = p[66] ? 1 : 0;
+  snapshot.cycles = get64(p + 67);
+  snapshot.idle_cycles = get64(p + 75);
+  memcpy(snapshot.display, p + 91, sizeof(snapshot.display));
+  snapshot.rand_state = version == 1 ? chip8->rand_state : get32(p + 347);
+
+  size_t used = header_size;
+  uint16_t runs = get16(p + header_size - 2u);
+  for (uint16_t run = 0; run < runs; run++) {
+    if (used + 4u > size) {
+      printf("Snapshot Error: truncated\n");
+      return 1;
+    }
+    uint16_t addr = get16(buffer + used);
+    uint16_t length = get16(buffer + used + 2);
+    if (addr >= CHIP8_MEM_SIZE || length > CHIP8_MEM_SIZE - addr ||
+        used + 4u + length > size) {
+      printf("Snapshot Error: bad memory run\n");
+      return 1;
+    }
+    memcpy(&snapshot.memory[addr], buffer + used + 4, length);
+    used += 4u + length;
+  }
+
+  chip8_snapshot_restore(chip8, &snapshot);
+  return 0;
+}
+
+int chip8_snapshot_save_to_file(const chip8_t *chip8, const uint8_t *rom,
+                                uint16_t rom_size, const char *filename) {
+  uint8_t buffer[CHIP8_SNAPSHOT_MAX_SIZE];
+  size_t size =
+      chip8_snapshot_save(chip8, rom, rom_size, buffer, sizeof(buffer));
+  FILE *fd = fopen(filename, "wb");
+  if (fd == NULL) {
+    printf("Could not open file\n");
+    return 1;
+  }
+  size_t written = fwrite(buffer, 1, size, fd);
+  if (fclose(fd) != 0 || written != size) {
+    printf("Error: could not write %s\n", filename);
+    return 1;
+  }
+  return 0;
+}
+
+int chip8_snapshot_load_from_file(chip8_t *chip8, const uint8_t *rom,
+                                  uint16_t rom_size, const char *filename) {
+  uint8_t buffer[CHIP8_SNAPSHOT_MAX_SIZE];
+  FILE *fd = fopen(filename, "rb");
+  if (fd == NULL) {
+    printf("Could not open file\n");
+    return 1;
+  }
+  size_t size = fread(buffer, 1, sizeof(buffer), fd);
+  fclose(fd);
+  return chip8_snapshot_load(chip8, rom, rom_size, buffer, size);
+}
@@ -0,0 +1,155 @@
+#define _POSIX_C_SOURCE 200809L // nanosleep
+#include <chip8.h>
+#include <chip8_trace.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// How long the writer and a waiting emulation sleep
+#define TRACE_WRITER_SLEEP_NS 1000000L
+#define TRACE_WAIT_SLEEP_NS 100000L
+
+// Records serialized per fwrite
+#define TRACE_CHUNK_RECORDS 256u
+
+static inline void put16(uint8_t *p, uint16_t value) {
+  p[0] = (uint8_t)value;
+  p[1] = (uint8_t)(value >> 8);
+}
+
+static inline void put64(uint8_t *p, uint64_t value) {
+  for (uint8_t i = 0; i < 8; i++)
+    p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static inline uint16_t get16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint64_t get64(const uint8_t *p) {
+  uint64_t value = 0;
+  for (uint8_t i = 0; i < 8; i++)
+    value |= (uint64_t)p[i] << (8 * i);
+  return value;
+}
+
+static void trace_encode(uint8_t *data, const chip8_trace_record_t *record) {
+  put64(data, record->cycle);
+  put16(data + 8, record->PC);
+  put16(data + 10, record->opcode);
+  put16(data + 12, record->changed);
+  put16(data + 14, record->I);
+  memcpy(data + 16, record->V, sizeof(record->V));
+}
+
+void chip8_trace_decode(const uint8_t *data, chip8_trace_record_t *record) {
+  record->cycle = get64(data);
+  record->PC = get16(data + 8);
+  record->opcode = get16(data + 10);
+  record->changed = get16(data + 12);
+  record->I = get16(data + 14);
+  memcpy(record->V, data + 16, sizeof(record->V));
+}
+
+static void trace_sleep(long nanoseconds) {
+  struct timespec ts = {0, nanoseconds};
+  nanosleep(&ts, NULL);
+}
+
+// Write the records up to head, returns the number written
+static uint32_t trace_flush(chip8_trace_t *chip8_trace) {
+  uint32_t head = __atomic_load_n(&chip8_trace->head, __ATOMIC_ACQUIRE);
+  uint32_t tail = chip8_trace->tail;
+  uint32_t flushed = head - tail;
+  while (tail != head) {
+    // A chunk, up to the end of the ring at most
+    uint8_t chunk[TRACE_CHUNK_RECORDS * CHIP8_TRACE_RECORD_SIZE];
+    uint32_t index = tail % CHIP8_TRACE_RING_SIZE;
+    uint32_t count = head - tail;
+    if (count > CHIP8_TRACE_RING_SIZE - index)
+      count = CHIP8_TRACE_RING_SIZE - index;
+    if (count > TRACE_CHUNK_RECORDS)
+      count = TRACE_CHUNK_RECORDS;
+    for (uint32_t i = 0; i < count; i++)
+      trace_encode(&chunk[i * CHIP8_TRACE_RECORD_SIZE],
+                   &chip8_trace->ring[index + i]);
+    if (!chip8_trace->error &&
+        fwrite(chunk, CHIP8_TRACE_RECORD_SIZE, count, chip8_trace->fd) != count)
+      chip8_trace->error = 1;
+    if (!chip8_trace->error)
+      chip8_trace->records += count;
+    tail += count;
+    __atomic_store_n(&chip8_trace->tail, tail, __ATOMIC_RELEASE);
+  }
+  return flushed;
+}
+
+static void *trace_writer(void *user_data) {
+  chip8_trace_t *chip8_trace = (chip8_trace_t *)user_data;
+  while (!__atomic_load_n(&chip8_trace->stop, __ATOMIC_ACQUIRE)) {
+    if (!trace_flush(chip8_trace))
+      trace_sleep(TRACE_WRITER_SLEEP_NS);
+  }
+  trace_flush(chip8_trace); // What was written before stopping
+  return NULL;
+}
+
+int chip8_trace_initialize(chip8_trace_t *chip8_trace, const char *filename) {
+  memset(chip8_trace, 0, sizeof(*chip8_trace));
+  chip8_trace->ring = malloc(CHIP8_TRACE_RING_SIZE * sizeof(*chip8_trace->ring));
+  if (!chip8_trace->ring) {
+    printf("Trace Error: out of memory\n");
+    return 1;
+  }
+  chip8_trace->fd = fopen(filename, "wb");
+  if (chip8_trace->fd == NULL) {
+    printf("Could not open file\n");
+    free(chip8_trace->ring);
+    return 1;
+  }
+  uint8_t header[CHIP8_TRACE_HEADER_SIZE] = {'C', 'H', '8', 'T'};
+  header[4] = (uint8_t)CHIP8_TRACE_VERSION;
+  header[5] = (uint8_t)(CHIP8_TRACE_VERSION >> 8);
+  header[6] = (uint8_t)CHIP8_TRACE_RECORD_SIZE;
+  header[7] = (uint8_t)(CHIP8_TRACE_RECORD_SIZE >> 8);
+  if (fwrite(header, 1, sizeof(header), chip8_trace->fd) != sizeof(header) ||
+      pthread_create(&chip8_trace->writer, NULL, trace_writer, chip8_trace)) {
+    printf("Trace Error: could not start writing %s\n", filename);
+    fclose(chip8_trace->fd);
+    free(chip8_trace->ring);
+    return 1;
+  }
+  return 0;
+}
+
+void chip8_trace_destroy(chip8_trace_t *chip8_trace) {
+  __atomic_store_n(&chip8_trace->stop, 1, __ATOMIC_RELEASE);
+  pthread_join(chip8_trace->writer, NULL);
+  if (fclose(chip8_trace->fd) != 0)
+    chip8_trace->error = 1;
+  free(chip8_trace->ring);
+  chip8_trace->ring = NULL;
+}
+
+void chip8_trace_attach(chip8_t *chip8, chip8_trace_t *chip8_trace) {
+  chip8->trace = chip8_trace;
+}
+
+void chip8_trace_print_stats(const chip8_trace_t *chip8_trace) {
+  printf("Trace: %llu instructions written, waited %llu times for the "
+         "writer%s\n",
+         (unsigned long long)chip8_trace->records,
+         (unsigned long long)chip8_trace->stalls,
+         chip8_trace->error ? ", could not write all of it" : "");
+}
+
+void chip8_trace_wait(chip8_trace_t *chip8_trace) {
+  chip8_trace->stalls++;
+  while (chip8_trace->head -
+             __atomic_load_n(&chip8_trace->tail, __ATOMIC_ACQUIRE) >=
+         CHIP8_TRACE_RING_SIZE)
+    trace_sleep(TRACE_WAIT_SLEEP_NS);
+}
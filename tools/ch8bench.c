@@ -0,0 +1,517 @@
+#define _POSIX_C_SOURCE 200809L // getopt, clock_gettime
+#include <chip8.h>
+#include <chip8_arena.h>
+#include <chip8_jit.h>
+#include <chip8_lanes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+Micro-benchmark suite, runs a set of synthetic workloads (plus any ROM given)
+headless on every execution engine, with the same frame loop as the headless
+backend (including the dirty row check a frontend does once per frame), and
+reports emulated instructions per second, ns per instruction and frame time
+percentiles. Each workload runs a few times and the fastest run is kept.
+
+The lanes engine runs BENCH_LANES copies of the workload together (with the
+built-in RNG, all seeded the same so they stay in lockstep), its instructions
+count every lane, and it has no dirty rows to check.
+
+Results are written as JSON, one result object per line, so a previous run can
+be read back as the baseline (-B): every workload and engine in both is
+compared and the exit status is 1 if any got slower than the threshold.
+*/
+
+#define MAX_ENGINES 5u
+#define MAX_WORKLOADS 32u
+#define BENCH_VERSION 1u
+#define BENCH_LANES 16u // Copies run by the lanes engine
+
+typedef enum { INTERP, PREDECODE, FUSED, JIT, LANES } Engine;
+
+static const char *const engine_names[MAX_ENGINES] = {
+    "interp", "predecode", "fused", "jit", "lanes"};
+
+typedef struct {
+  char name[64];
+  uint8_t data[CHIP8_MAX_ROM_SIZE];
+  uint16_t size;
+} workload_t;
+
+// Fastest run of a workload on an engine
+typedef struct {
+  uint32_t workload;
+  Engine engine;
+  uint64_t instructions;
+  double seconds;
+  double frame_us[4]; // p50, p90, p99 and max
+  uint64_t hash;
+} result_t;
+
+// ALU-heavy: 8xyN on every operation in a tight loop
+static const uint8_t workload_alu[] = {
+    0x60, 0x01, // 200 LD V0, 01
+    0x61, 0x03, // 202 LD V1, 03
+    0x80, 0x14, // 204 ADD V0, V1
+    0x81, 0x25, // 206 SUB V1, V2
+    0x83, 0x03, // 208 XOR V3, V0
+    0x84, 0x06, // 20A SHR V4
+    0x85, 0x0E, // 20C SHL V5
+    0x80, 0x11, // 20E OR V0, V1
+    0x82, 0x37, // 210 SUBN V2, V3
+    0x86, 0x42, // 212 AND V6, V4
+    0x12, 0x04, // 214 JP 204
+};
+
+// Draw-heavy: a 15-row sprite storm moving over the whole display
+static const uint8_t workload_draw[] = {
+    0xA0, 0x50, // 200 LD I, 050 (the font, digits 0 to 2)
+    0x60, 0x00, // 202 LD V0, 00
+    0x61, 0x00, // 204 LD V1, 00
+    0xD0, 0x1F, // 206 DRW V0, V1, F
+    0x70, 0x03, // 208 ADD V0, 03
+    0x71, 0x05, // 20A ADD V1, 05
+    0x12, 0x06, // 20C JP 206
+};
+
+// Call/return-heavy: two levels of subroutines
+static const uint8_t workload_call[] = {
+    0x22, 0x04, // 200 CALL 204
+    0x12, 0x00, // 202 JP 200
+    0x70, 0x01, // 204 ADD V0, 01
+    0x22, 0x0A, // 206 CALL 20A
+    0x00, 0xEE, // 208 RET
+    0x71, 0x01, // 20A ADD V1, 01
+    0x00, 0xEE, // 20C RET
+};
+
+// Memory traffic: Fx55/Fx65 of every register, Fx33 and Fx1E
+static const uint8_t workload_mem[] = {
+    0x60, 0x10, // 200 LD V0, 10
+    0xA3, 0x00, // 202 LD I, 300
+    0xFF, 0x55, // 204 LD [I], VF
+    0xFF, 0x65, // 206 LD VF, [I]
+    0xF0, 0x33, // 208 LD B, V0
+    0xF0, 0x1E, // 20A ADD I, V0
+    0xFF, 0x55, // 20C LD [I], VF
+    0x12, 0x02, // 20E JP 202
+};
+
+// Timer-poll idle loop: wait a second on DT, again and again
+static const uint8_t workload_idle[] = {
+    0x60, 0x3C, // 200 LD V0, 3C
+    0xF0, 0x15, // 202 LD DT, V0
+    0xF1, 0x07, // 204 LD V1, DT
+    0x31, 0x00, // 206 SE V1, 00
+    0x12, 0x04, // 208 JP 204
+    0x12, 0x00, // 20A JP 200
+};
+
+void print_usage(void);
+int load_rom(const char *filename, workload_t *workload);
+int compare_baseline(const char *filename, const workload_t *workloads,
+                     const result_t *results, uint32_t result_count,
+                     double threshold);
+
+static double now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Random numbers for Cxkk, reseeded per run so every run does the same
+static uint32_t rand_state;
+
+static uint8_t bench_rand(void) {
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+  return (uint8_t)(rand_state >> 24);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double da = *(const double *)a;
+  double db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+static void add_workload(workload_t *workloads, uint32_t *count,
+                         const char *name, const uint8_t *data, size_t size) {
+  workload_t *workload = &workloads[(*count)++];
+  snprintf(workload->name, sizeof(workload->name), "%s", name);
+  memcpy(workload->data, data, size);
+  workload->size = (uint16_t)size;
+}
+
+// Run a workload once, frame times (in seconds) go to frame_times
+static void run_workload(const workload_t *workload, Engine engine,
+                         uint8_t quirks, uint32_t frames,
+                         uint32_t cycles_per_frame, chip8_t *chip8,
+                         uint8_t *ram, chip8_predecode_t *predecode,
+                         chip8_jit_t *jit, chip8_lanes_t *lanes,
+                         double *frame_times, result_t *result) {
+  static chip8_display_t shown;
+
+  rand_state = 0x2545F491u;
+  chip8_interface_t chip8_interface = {.rand = bench_rand};
+  if (engine == LANES)
+    chip8_interface.rand = NULL; // Lanes would take turns on bench_rand
+  chip8_initialize(chip8, chip8_interface);
+  chip8_seed_rand(chip8, rand_state); // The lanes' RNG
+  chip8_set_ram(chip8, ram);
+  chip8_set_quirks(chip8, quirks);
+  if (engine == PREDECODE || engine == FUSED)
+    chip8_predecode_attach(chip8, predecode);
+  if (engine == FUSED)
+    chip8_predecode_set_fusion(chip8, 1);
+  if (engine == JIT)
+    chip8_jit_attach(chip8, jit); // Flushed, every run translates from scratch
+  chip8_load_rom(chip8, workload->data, workload->size);
+  memset(&shown, 0, sizeof(shown));
+  if (engine == LANES) {
+    chip8_lanes_initialize(lanes, BENCH_LANES, quirks);
+    for (uint8_t l = 0; l < BENCH_LANES; l++)
+      chip8_lanes_load(lanes, l, chip8);
+  }
+
+  double start = now_seconds();
+  double frame_start = start;
+  for (uint32_t frame = 0; frame < frames; frame++) {
+    if (engine == LANES) {
+      chip8_lanes_run(lanes, cycles_per_frame);
+      chip8_lanes_frame_end(lanes);
+    } else {
+      for (uint32_t cycles = 0; cycles < cycles_per_frame;)
+        cycles += chip8_run(chip8, cycles_per_frame - cycles);
+      chip8_event_t event;
+      while (chip8_poll_event(chip8, &event))
+        ;
+      chip8_frame_end(chip8);
+      chip8_display_changes(chip8, &shown);
+    }
+    double frame_end = now_seconds();
+    frame_times[frame] = frame_end - frame_start;
+    frame_start = frame_end;
+  }
+
+  result->seconds = frame_start - start;
+  result->instructions = chip8->cycles;
+  if (engine == LANES) {
+    chip8_lanes_store(lanes, 0, chip8); // The hash is the first lane's
+    result->instructions = lanes->lane_steps;
+  }
+  result->hash = chip8_display_hash((const chip8_display_t *)&chip8->display);
+  qsort(frame_times, frames, sizeof(*frame_times), compare_doubles);
+  static const uint32_t percentiles[4] = {50, 90, 99, 100};
+  for (int i = 0; i < 4; i++) {
+    uint64_t rank = (uint64_t)(frames - 1u) * percentiles[i] / 100u;
+    result->frame_us[i] = frame_times[rank] * 1e6;
+  }
+}
+
+static double result_mips(const result_t *result) {
+  return result->seconds > 0.0
+             ? (double)result->instructions / result->seconds / 1e6
+             : 0.0;
+}
+
+static double result_ns(const result_t *result) {
+  return result->instructions
+             ? result->seconds * 1e9 / (double)result->instructions
+             : 0.0;
+}
+
+static int write_json(FILE *fd, const workload_t *workloads,
+                      const result_t *results, uint32_t result_count,
+                      uint32_t frames, uint32_t cycles_per_frame,
+                      uint32_t repeats, uint8_t quirks) {
+  int error = fprintf(fd,
+                      "{\n  \"version\": %u,\n  \"frames\": %u,\n"
+                      "  \"cycles_per_frame\": %u,\n  \"repeats\": %u,\n"
+                      "  \"quirks\": %u,\n  \"results\": [\n",
+                      BENCH_VERSION, frames, cycles_per_frame, repeats,
+                      quirks) < 0;
+  for (uint32_t i = 0; i < result_count; i++) {
+    const result_t *result = &results[i];
+    // One line each, compare_baseline reads them back with sscanf
+    error |= fprintf(fd,
+                     "    {\"workload\": \"%s\", \"engine\": \"%s\", "
+                     "\"mips\": %.3f, \"ns_per_instruction\": %.3f, "
+                     "\"instructions\": %llu, \"seconds\": %.6f, "
+                     "\"frame_us\": {\"p50\": %.3f, \"p90\": %.3f, "
+                     "\"p99\": %.3f, \"max\": %.3f}, \"hash\": \"%016llx\"}%s\n",
+                     workloads[result->workload].name,
+                     engine_names[result->engine], result_mips(result),
+                     result_ns(result),
+                     (unsigned long long)result->instructions, result->seconds,
+                     result->frame_us[0], result->frame_us[1],
+                     result->frame_us[2], result->frame_us[3],
+                     (unsigned long long)result->hash,
+                     i + 1u < result_count ? "," : "") < 0;
+  }
+  error |= fprintf(fd, "  ]\n}\n") < 0;
+  return error;
+}
+
+int main(int argc, char *argv[]) {
+  uint8_t quirks = CHIP8_PROFILE_MODERN; // No VBlank wait, draws are not capped
+  uint32_t frames = 2000;
+  uint32_t cycles_per_frame = 5000;
+  uint32_t repeats = 3;
+  uint8_t engines[MAX_ENGINES] = {0};
+  uint8_t engines_given = 0;
+  const char *output = NULL;
+  const char *baseline = NULL;
+  double threshold = 5.0;
+
+  // Parse options
+  int opt;
+  while ((opt = getopt(argc, argv, "hc:e:n:o:p:r:B:T:")) != -1) {
+    switch (opt) {
+    case 'h':
+      print_usage();
+      return 0;
+    case 'c':
+      if (!(cycles_per_frame = (uint32_t)atoi(optarg))) {
+        printf("Cannot be 0\n");
+        return 1;
+      }
+      break;
+    case 'e': {
+      uint32_t e;
+      for (e = 0; e < MAX_ENGINES; e++) {
+        if (strcasecmp(optarg, engine_names[e]) == 0)
+          break;
+      }
+      if (e == MAX_ENGINES) {
+        fprintf(stderr, "Unknown engine: %s\n", optarg);
+        print_usage();
+        return 1;
+      }
+      engines[e] = 1;
+      engines_given = 1;
+      break;
+    }
+    case 'n':
+      if (!(frames = (uint32_t)atoi(optarg))) {
+        printf("Cannot be 0\n");
+        return 1;
+      }
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'p':
+      if (chip8_parse_profile(optarg, &quirks)) {
+        fprintf(stderr, "Unknown profile: %s\n", optarg);
+        print_usage();
+        return 1;
+      }
+      break;
+    case 'r':
+      if (!(repeats = (uint32_t)atoi(optarg))) {
+        printf("Cannot be 0\n");
+        return 1;
+      }
+      break;
+    case 'B':
+      baseline = optarg;
+      break;
+    case 'T':
+      threshold = atof(optarg);
+      if (threshold <= 0.0) {
+        printf("Has to be more than 0\n");
+        return 1;
+      }
+      break;
+    default:
+      print_usage();
+      return 1;
+    }
+  }
+  if (!engines_given)
+    memset(engines, 1, sizeof(engines));
+  if (argc - optind > (int)(MAX_WORKLOADS - 5u)) {
+    printf("Too many ROMs\n");
+    return 1;
+  }
+
+  // Built-in workloads, then the ROMs
+  static workload_t workloads[MAX_WORKLOADS];
+  uint32_t workload_count = 0;
+  add_workload(workloads, &workload_count, "alu", workload_alu,
+               sizeof(workload_alu));
+  add_workload(workloads, &workload_count, "draw", workload_draw,
+               sizeof(workload_draw));
+  add_workload(workloads, &workload_count, "call", workload_call,
+               sizeof(workload_call));
+  add_workload(workloads, &workload_count, "mem", workload_mem,
+               sizeof(workload_mem));
+  add_workload(workloads, &workload_count, "idle", workload_idle,
+               sizeof(workload_idle));
+  for (int i = optind; i < argc; i++) {
+    if (load_rom(argv[i], &workloads[workload_count]))
+      return 1;
+    workload_count++;
+  }
+
+  chip8_arena_t arena = {0};
+  chip8_t *chip8 = chip8_arena_initialize(&arena, 1) ? NULL
+                                                     : chip8_arena_alloc(&arena, 1);
+  chip8_predecode_t *predecode = malloc(sizeof(*predecode));
+  chip8_jit_t *jit = malloc(sizeof(*jit));
+  chip8_lanes_t *lanes = malloc(sizeof(*lanes));
+  double *frame_times = malloc(frames * sizeof(*frame_times));
+  result_t *results =
+      malloc(MAX_ENGINES * workload_count * sizeof(*results));
+  if (!chip8 || !predecode || !jit || !lanes || !frame_times || !results) {
+    printf("Out of memory\n");
+    chip8_arena_destroy(&arena);
+    free(predecode);
+    free(jit);
+    free(lanes);
+    free(frame_times);
+    free(results);
+    return 1;
+  }
+  if (engines[JIT] && chip8_jit_initialize(jit)) {
+    printf("JIT not available, skipping it\n");
+    engines[JIT] = 0;
+  }
+
+  printf("%-16s %-10s %10s %8s %10s %10s %10s\n", "workload", "engine",
+         "M instr/s", "ns/instr", "p50 us", "p99 us", "max us");
+  uint32_t result_count = 0;
+  for (uint32_t w = 0; w < workload_count; w++) {
+    for (uint32_t e = 0; e < MAX_ENGINES; e++) {
+      if (!engines[e])
+        continue;
+      result_t *best = &results[result_count++];
+      for (uint32_t r = 0; r < repeats; r++) {
+        result_t result = {.workload = w, .engine = (Engine)e};
+        run_workload(&workloads[w], (Engine)e, quirks, frames,
+                     cycles_per_frame, chip8, chip8_arena_ram(&arena, chip8),
+                     predecode, jit, lanes, frame_times, &result);
+        if (!r || result.seconds < best->seconds)
+          *best = result;
+      }
+      printf("%-16s %-10s %10.1f %8.2f %10.2f %10.2f %10.2f\n",
+             workloads[w].name, engine_names[e], result_mips(best),
+             result_ns(best), best->frame_us[0], best->frame_us[2],
+             best->frame_us[3]);
+    }
+  }
+
+  int status = 0;
+  if (output) {
+    FILE *fd = fopen(output, "w");
+    if (fd == NULL) {
+      printf("Could not open file\n");
+      status = 1;
+    } else if (write_json(fd, workloads, results, result_count, frames,
+                          cycles_per_frame, repeats, quirks) |
+               (fclose(fd) != 0)) {
+      printf("Error: could not write %s\n", output);
+      status = 1;
+    }
+  }
+  if (baseline &&
+      compare_baseline(baseline, workloads, results, result_count, threshold))
+    status = 1;
+
+  if (engines[JIT])
+    chip8_jit_destroy(jit);
+  free(results);
+  free(frame_times);
+  free(lanes);
+  free(jit);
+  free(predecode);
+  chip8_arena_destroy(&arena);
+  return status;
+}
+
+// Compares the results with the ones in a previous JSON output, returns 1 if
+// any got slower by more than threshold percent (or the file is unreadable)
+int compare_baseline(const char *filename, const workload_t *workloads,
+                     const result_t *results, uint32_t result_count,
+                     double threshold) {
+  FILE *fd = fopen(filename, "r");
+  if (fd == NULL) {
+    printf("Could not open baseline %s\n", filename);
+    return 1;
+  }
+  int regressions = 0;
+  uint32_t compared = 0;
+  char line[512];
+  printf("\nAgainst %s (threshold %.1f%%)\n", filename, threshold);
+  while (fgets(line, sizeof(line), fd)) {
+    char name[64];
+    char engine[16];
+    double mips;
+    if (sscanf(line, " {\"workload\": \"%63[^\"]\", \"engine\": \"%15[^\"]\", "
+                     "\"mips\": %lf",
+               name, engine, &mips) != 3 ||
+        mips <= 0.0)
+      continue;
+    for (uint32_t i = 0; i < result_count; i++) {
+      const result_t *result = &results[i];
+      if (strcmp(workloads[result->workload].name, name) != 0 ||
+          strcmp(engine_names[result->engine], engine) != 0)
+        continue;
+      double change = (result_mips(result) / mips - 1.0) * 100.0;
+      const char *verdict = "";
+      if (change < -threshold) {
+        verdict = "  REGRESSION";
+        regressions++;
+      } else if (change > threshold) {
+        verdict = "  faster";
+      }
+      printf("%-16s %-10s %10.1f -> %10.1f %+7.1f%%%s\n", name, engine, mips,
+             result_mips(result), change, verdict);
+      compared++;
+      break;
+    }
+  }
+  fclose(fd);
+  printf("%u compared, %d regressions\n", compared, regressions);
+  return regressions != 0;
+}
+
+// Loads a ROM as a workload named after the file (without the directories)
+int load_rom(const char *filename, workload_t *workload) {
+  if (chip8_read_rom_file(filename, workload->data, &workload->size))
+    return -1;
+  const char *name = strrchr(filename, '/');
+  snprintf(workload->name, sizeof(workload->name), "%s",
+           name ? name + 1 : filename);
+  // Kept out of the JSON strings
+  for (char *c = workload->name; *c; c++) {
+    if (*c == '"' || *c == '\\' || *c == ' ')
+      *c = '_';
+  }
+  return 0;
+}
+
+void print_usage(void) {
+  printf("Usage: ch8bench [OPTION]... [ROMFILE]...\n\n");
+  printf("Runs the built-in workloads (alu, draw, call, mem, idle) and the\n");
+  printf("ROMs headless on every engine and prints the speed of each\n\n");
+  printf("Options:\n");
+  printf("  -h         display this help\n");
+  printf("  -c NUM     number of cycles per frame (default: 5000)\n");
+  printf("  -e ENGINE  execution engine (interp, predecode, fused, jit, lanes),\n");
+  printf("             can be repeated (default: all of them)\n");
+  printf("  -n NUM     number of frames per run (default: 2000)\n");
+  printf("  -o FILE    write the results as JSON to FILE\n");
+  printf("  -p PROFILE quirk profile (vip, modern, timendous or a quirk bitmask)\n");
+  printf("             (default: modern)\n");
+  printf("  -r NUM     runs per workload, the fastest is kept (default: 3)\n");
+  printf("  -B FILE    compare with a previous JSON output, exits with 1 if\n");
+  printf("             anything got slower than the threshold\n");
+  printf("  -T PERCENT regression threshold for -B (default: 5)\n");
+}
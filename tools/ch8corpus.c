@@ -0,0 +1,560 @@
+#define _POSIX_C_SOURCE 200809L // getopt, clock_gettime, sysconf
+#include <chip8.h>
+#include <chip8_arena.h>
+#include <chip8_jit.h>
+#include <chip8_pak.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+Corpus runner, runs every ROM under every quirk profile and input script
+(one job each) headless for N frames, spread over a pool of threads with work
+stealing, then prints one summary line per job.
+
+Input scripts are text files with one "FRAME KEY down|up" line per key change
+(FRAME counts from 1, KEY in hex, # starts a comment), applied before the
+frame runs.
+
+A .c8pak archive (see ch8pak) given instead of a ROM adds all of its ROMs, run
+straight from its mapping, without a -p they run under their suggested
+profile (if they have one).
+*/
+
+#define MAX_PROFILES 16u
+#define MAX_SCRIPTS 16u
+#define MAX_THREADS 256u
+
+typedef enum { INTERP, PREDECODE, FUSED, JIT } Engine;
+
+// Key change of a script
+typedef struct {
+  uint32_t frame;
+  uint8_t key;
+  uint8_t down;
+} key_change_t;
+
+typedef struct {
+  const char *name;
+  key_change_t *changes;
+  uint32_t count;
+} script_t;
+
+typedef struct {
+  const char *name;
+  const chip8_image_t *image; // Shared by every instance running it
+  chip8_image_t *loaded;      // Image of a ROM file (NULL if in an archive)
+  uint8_t has_profile;        // Suggested profile from the archive
+  uint8_t quirks;
+} rom_t;
+
+// Job and its results
+typedef struct {
+  uint32_t rom;
+  uint32_t script; // Index in scripts, or UINT32_MAX for no input
+  uint8_t quirks;
+  uint64_t cycles;
+  uint64_t unknown;
+  uint64_t hash;
+  double seconds;
+} job_t;
+
+// Work-stealing deque, the owner pops from the bottom and thieves take from
+// the top. Jobs are coarse (a whole ROM run) so a mutex is cheap enough.
+typedef struct {
+  pthread_mutex_t lock;
+  uint32_t *jobs;
+  uint32_t top;
+  uint32_t bottom;
+} deque_t;
+
+typedef struct {
+  uint32_t id;
+  chip8_t *chip8; // From the arena, one per worker
+  uint8_t *ram;   // Its RAM slot in the arena
+  deque_t deque;
+  uint32_t jobs_run;
+  uint32_t steals;
+  pthread_t thread;
+} worker_t;
+
+// Shared by every worker, read-only while running
+static struct {
+  rom_t *roms;
+  script_t scripts[MAX_SCRIPTS];
+  job_t *jobs;
+  worker_t *workers;
+  uint32_t worker_count;
+  uint32_t frames;
+  uint32_t cycles_per_frame;
+  Engine engine;
+} corpus;
+
+void print_usage(void);
+int load_script(const char *filename, script_t *script);
+int load_rom(const char *filename, rom_t *rom);
+
+// Random numbers for Cxkk, one generator per thread seeded per job so every
+// run of a job gets the same numbers
+static __thread uint32_t rand_state;
+
+static uint8_t corpus_rand(void) {
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 17;
+  rand_state ^= rand_state << 5;
+  return (uint8_t)(rand_state >> 24);
+}
+
+static double now_seconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int deque_pop(deque_t *deque, uint32_t *job) {
+  int found = 0;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom > deque->top) {
+    *job = deque->jobs[--deque->bottom];
+    found = 1;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+static int deque_steal(deque_t *deque, uint32_t *job) {
+  int found = 0;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom > deque->top) {
+    *job = deque->jobs[deque->top++];
+    found = 1;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+// Run a job headless, same frame loop as chip8_headless_run plus the script
+static void run_job(job_t *job, chip8_t *chip8, uint8_t *ram,
+                    chip8_predecode_t *predecode, chip8_jit_t *jit) {
+  const rom_t *rom = &corpus.roms[job->rom];
+  const script_t *script =
+      job->script == UINT32_MAX ? NULL : &corpus.scripts[job->script];
+  uint32_t next_change = 0;
+  double start = now_seconds();
+
+  rand_state = 0x2545F491u;
+  chip8_interface_t chip8_interface = {.rand = corpus_rand};
+  chip8_initialize(chip8, chip8_interface);
+  chip8_set_ram(chip8, ram);
+  chip8_set_quirks(chip8, job->quirks);
+  if (corpus.engine == PREDECODE || corpus.engine == FUSED)
+    chip8_predecode_attach(chip8, predecode);
+  if (corpus.engine == FUSED)
+    chip8_predecode_set_fusion(chip8, 1);
+  if (corpus.engine == JIT)
+    chip8_jit_attach(chip8, jit);
+  chip8_load_image(chip8, rom->image);
+
+  job->unknown = 0;
+  for (uint32_t frame = 1; frame <= corpus.frames; frame++) {
+    while (script && next_change < script->count &&
+           script->changes[next_change].frame == frame) {
+      const key_change_t *change = &script->changes[next_change++];
+      if (change->down)
+        chip8_set_key(chip8, change->key);
+      else
+        chip8_reset_key(chip8, change->key);
+    }
+    for (uint32_t cycles = 0; cycles < corpus.cycles_per_frame;) {
+      cycles += chip8_run(chip8, corpus.cycles_per_frame - cycles);
+      // Drained after every run so the ring never drops unknown opcodes
+      chip8_event_t event;
+      while (chip8_poll_event(chip8, &event)) {
+        if (event.type == CHIP8_EVENT_UNKNOWN_OPCODE)
+          job->unknown++;
+      }
+    }
+    chip8_frame_end(chip8);
+  }
+
+  job->cycles = chip8->cycles;
+  job->hash =
+      chip8_display_hash((const chip8_display_t *)&chip8->display);
+  job->seconds = now_seconds() - start;
+}
+
+static void *worker_run(void *arg) {
+  worker_t *worker = arg;
+  chip8_t *chip8 = worker->chip8;
+  chip8_predecode_t *predecode = NULL;
+  chip8_jit_t *jit = NULL;
+  if (corpus.engine == PREDECODE || corpus.engine == FUSED)
+    predecode = malloc(sizeof(*predecode));
+  if (corpus.engine == JIT) {
+    jit = malloc(sizeof(*jit));
+    if (jit && chip8_jit_initialize(jit)) {
+      free(jit);
+      jit = NULL;
+    }
+  }
+  if (((corpus.engine == PREDECODE || corpus.engine == FUSED) && !predecode) ||
+      (corpus.engine == JIT && !jit)) {
+    printf("Worker %u could not start\n", worker->id);
+    free(predecode);
+    free(jit);
+    return NULL; // Its jobs get stolen by the others
+  }
+
+  for (;;) {
+    uint32_t job = 0;
+    if (!deque_pop(&worker->deque, &job)) {
+      // Out of work, steal from the others starting at the next one
+      uint32_t i;
+      for (i = 1; i < corpus.worker_count; i++) {
+        worker_t *victim =
+            &corpus.workers[(worker->id + i) % corpus.worker_count];
+        if (deque_steal(&victim->deque, &job))
+          break;
+      }
+      if (i == corpus.worker_count)
+        break; // Nothing left anywhere, jobs are never added
+      worker->steals++;
+    }
+    run_job(&corpus.jobs[job], chip8, worker->ram, predecode, jit);
+    worker->jobs_run++;
+  }
+
+  if (jit) {
+    chip8_jit_destroy(jit);
+    free(jit);
+  }
+  free(predecode);
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  uint8_t profiles[MAX_PROFILES];
+  uint32_t profile_count = 0;
+  uint32_t script_count = 0;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  corpus.frames = 600;
+  corpus.cycles_per_frame = 20;
+  corpus.engine = INTERP;
+
+  // Parse options
+  int opt;
+  while ((opt = getopt(argc, argv, "hc:e:j:n:p:s:")) != -1) {
+    switch (opt) {
+    case 'h':
+      print_usage();
+      return 0;
+    case 'c':
+      if (!(corpus.cycles_per_frame = (uint32_t)atoi(optarg))) {
+        printf("Cannot be 0\n");
+        return 1;
+      }
+      break;
+    case 'e':
+      if (strcasecmp(optarg, "interp") == 0)
+        corpus.engine = INTERP;
+      else if (strcasecmp(optarg, "predecode") == 0)
+        corpus.engine = PREDECODE;
+      else if (strcasecmp(optarg, "fused") == 0)
+        corpus.engine = FUSED;
+      else if (strcasecmp(optarg, "jit") == 0)
+        corpus.engine = JIT;
+      else {
+        fprintf(stderr, "Unknown engine: %s\n", optarg);
+        print_usage();
+        return 1;
+      }
+      break;
+    case 'j':
+      if ((threads = atol(optarg)) <= 0) {
+        printf("Cannot be 0\n");
+        return 1;
+      }
+      break;
+    case 'n':
+      if (!(corpus.frames = (uint32_t)atoi(optarg))) {
+        printf("Cannot be 0\n");
+        return 1;
+      }
+      break;
+    case 'p':
+      if (profile_count == MAX_PROFILES) {
+        fprintf(stderr, "Too many profiles\n");
+        return 1;
+      }
+      if (chip8_parse_profile(optarg, &profiles[profile_count])) {
+        fprintf(stderr, "Unknown profile: %s\n", optarg);
+        print_usage();
+        return 1;
+      }
+      profile_count++;
+      break;
+    case 's':
+      if (script_count == MAX_SCRIPTS) {
+        fprintf(stderr, "Too many scripts\n");
+        return 1;
+      }
+      if (load_script(optarg, &corpus.scripts[script_count]))
+        return 1;
+      script_count++;
+      break;
+    default:
+      print_usage();
+      return 1;
+    }
+  }
+  if (optind >= argc) {
+    printf("Error: Missing ROM files\n");
+    print_usage();
+    return 1;
+  }
+  if (threads < 1)
+    threads = 1;
+  if (threads > (long)MAX_THREADS)
+    threads = MAX_THREADS;
+
+  // Map the archives, then load the ROMs
+  uint32_t file_count = (uint32_t)(argc - optind);
+  chip8_pak_t *paks = calloc(file_count, sizeof(*paks));
+  if (!paks) {
+    printf("Out of memory\n");
+    return 1;
+  }
+  uint32_t rom_count = 0;
+  for (uint32_t i = 0; i < file_count; i++) {
+    const char *filename = argv[optind + (int)i];
+    size_t length = strlen(filename);
+    if (length > 6 && strcmp(filename + length - 6, ".c8pak") == 0) {
+      if (chip8_pak_open(&paks[i], filename))
+        return 1;
+      rom_count += paks[i].count;
+    } else {
+      rom_count++;
+    }
+  }
+  corpus.roms = calloc(rom_count, sizeof(*corpus.roms));
+  if (!corpus.roms) {
+    printf("Out of memory\n");
+    return 1;
+  }
+  uint32_t rom = 0;
+  for (uint32_t i = 0; i < file_count; i++) {
+    if (!paks[i].map) {
+      if (load_rom(argv[optind + (int)i], &corpus.roms[rom++]))
+        return 1;
+      continue;
+    }
+    for (uint32_t e = 0; e < paks[i].count; e++) {
+      chip8_pak_entry_t entry;
+      chip8_pak_entry(&paks[i], e, &entry);
+      corpus.roms[rom].name = entry.name;
+      corpus.roms[rom].image = entry.image;
+      corpus.roms[rom].has_profile =
+          (entry.flags & CHIP8_PAK_HAS_PROFILE) && !profile_count;
+      corpus.roms[rom++].quirks = entry.quirks;
+    }
+  }
+
+  if (!profile_count)
+    profiles[profile_count++] = CHIP8_DEFAULT_PROFILE;
+
+  // One job per ROM, profile and script
+  uint32_t scripts_per_rom = script_count ? script_count : 1u;
+  uint32_t job_count = rom_count * profile_count * scripts_per_rom;
+  corpus.worker_count = (uint32_t)threads;
+  uint32_t deque_size = job_count / corpus.worker_count + 1u;
+  corpus.jobs = calloc(job_count, sizeof(*corpus.jobs));
+  corpus.workers = calloc(corpus.worker_count, sizeof(*corpus.workers));
+  uint32_t *deque_jobs =
+      malloc(corpus.worker_count * deque_size * sizeof(uint32_t));
+  // Instances side by side, none of them shares a cache line with another
+  chip8_arena_t arena = {0};
+  if (!corpus.jobs || !corpus.workers || !deque_jobs ||
+      chip8_arena_initialize(&arena, corpus.worker_count)) {
+    printf("Out of memory\n");
+    chip8_arena_destroy(&arena);
+    free(corpus.jobs);
+    free(corpus.workers);
+    free(deque_jobs);
+    free(corpus.roms);
+    return 1;
+  }
+  uint32_t job = 0;
+  for (uint32_t r = 0; r < rom_count; r++) {
+    for (uint32_t p = 0; p < profile_count; p++) {
+      for (uint32_t s = 0; s < scripts_per_rom; s++) {
+        corpus.jobs[job].rom = r;
+        corpus.jobs[job].quirks =
+            corpus.roms[r].has_profile ? corpus.roms[r].quirks : profiles[p];
+        corpus.jobs[job].script = script_count ? s : UINT32_MAX;
+        job++;
+      }
+    }
+  }
+
+  // Deal the jobs round robin, stealing evens out the rest
+  for (uint32_t w = 0; w < corpus.worker_count; w++) {
+    worker_t *worker = &corpus.workers[w];
+    worker->id = w;
+    worker->chip8 = chip8_arena_alloc(&arena, 1);
+    worker->ram = chip8_arena_ram(&arena, worker->chip8);
+    pthread_mutex_init(&worker->deque.lock, NULL);
+    worker->deque.jobs = &deque_jobs[w * deque_size];
+  }
+  for (uint32_t j = 0; j < job_count; j++) {
+    deque_t *deque = &corpus.workers[j % corpus.worker_count].deque;
+    deque->jobs[deque->bottom++] = j;
+  }
+
+  double start = now_seconds();
+  for (uint32_t w = 0; w < corpus.worker_count; w++) {
+    if (pthread_create(&corpus.workers[w].thread, NULL, worker_run,
+                       &corpus.workers[w])) {
+      printf("Could not create thread %u\n", w);
+      return 1;
+    }
+  }
+  for (uint32_t w = 0; w < corpus.worker_count; w++)
+    pthread_join(corpus.workers[w].thread, NULL);
+  double seconds = now_seconds() - start;
+
+  // Summary
+  uint64_t total_cycles = 0;
+  uint32_t steals = 0;
+  uint32_t jobs_run = 0;
+  printf("# rom profile script cycles unknown hash seconds\n");
+  for (uint32_t j = 0; j < job_count; j++) {
+    const job_t *result = &corpus.jobs[j];
+    printf("%s 0x%02x %s %llu %llu %016llx %.6f\n",
+           corpus.roms[result->rom].name, result->quirks,
+           result->script == UINT32_MAX ? "-"
+                                        : corpus.scripts[result->script].name,
+           (unsigned long long)result->cycles,
+           (unsigned long long)result->unknown,
+           (unsigned long long)result->hash, result->seconds);
+    total_cycles += result->cycles;
+  }
+  for (uint32_t w = 0; w < corpus.worker_count; w++) {
+    steals += corpus.workers[w].steals;
+    jobs_run += corpus.workers[w].jobs_run;
+  }
+  printf("# %u/%u jobs on %u threads (%u stolen), %llu cycles in %.3f s",
+         jobs_run, job_count, corpus.worker_count, steals,
+         (unsigned long long)total_cycles, seconds);
+  if (seconds > 0.0)
+    printf(" (%.1f M cycles/s)", (double)total_cycles / seconds / 1e6);
+  printf("\n");
+
+  for (uint32_t w = 0; w < corpus.worker_count; w++)
+    pthread_mutex_destroy(&corpus.workers[w].deque.lock);
+  free(deque_jobs);
+  chip8_arena_destroy(&arena);
+  for (uint32_t s = 0; s < script_count; s++)
+    free(corpus.scripts[s].changes);
+  free(corpus.workers);
+  free(corpus.jobs);
+  for (uint32_t r = 0; r < rom_count; r++)
+    free(corpus.roms[r].loaded);
+  free(corpus.roms);
+  for (uint32_t i = 0; i < file_count; i++)
+    chip8_pak_close(&paks[i]);
+  free(paks);
+  return jobs_run == job_count ? 0 : 1;
+}
+
+// Loads "FRAME KEY down|up" lines, frames have to be in order
+int load_script(const char *filename, script_t *script) {
+  FILE *fd = fopen(filename, "r");
+  if (fd == NULL) {
+    printf("Could not open script %s\n", filename);
+    return -1;
+  }
+  script->name = filename;
+  script->changes = NULL;
+  script->count = 0;
+  uint32_t capacity = 0;
+  char line[128];
+  uint32_t line_number = 0;
+  while (fgets(line, sizeof(line), fd)) {
+    line_number++;
+    char *comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+    unsigned long frame;
+    unsigned int key;
+    char state[8];
+    int fields = sscanf(line, "%lu %x %7s", &frame, &key, state);
+    if (fields <= 0)
+      continue; // Empty line
+    if (fields != 3 || frame == 0 || frame > UINT32_MAX || key > 0xF ||
+        (strcmp(state, "down") != 0 && strcmp(state, "up") != 0) ||
+        (script->count && frame < script->changes[script->count - 1].frame)) {
+      printf("Bad script line %s:%u\n", filename, line_number);
+      fclose(fd);
+      free(script->changes);
+      return -1;
+    }
+    if (script->count == capacity) {
+      capacity = capacity ? capacity * 2u : 64u;
+      key_change_t *changes =
+          realloc(script->changes, capacity * sizeof(*changes));
+      if (!changes) {
+        printf("Out of memory\n");
+        fclose(fd);
+        free(script->changes);
+        return -1;
+      }
+      script->changes = changes;
+    }
+    script->changes[script->count].frame = (uint32_t)frame;
+    script->changes[script->count].key = (uint8_t)key;
+    script->changes[script->count].down = strcmp(state, "down") == 0;
+    script->count++;
+  }
+  fclose(fd);
+  return 0;
+}
+
+// Loads a whole ROM file into memory, shared by every job using it
+int load_rom(const char *filename, rom_t *rom) {
+  uint8_t data[CHIP8_MAX_ROM_SIZE];
+  uint16_t size;
+  if (chip8_read_rom_file(filename, data, &size))
+    return -1;
+  rom->name = filename;
+  chip8_image_t *image = malloc(sizeof(*image));
+  if (!image) {
+    printf("Out of memory\n");
+    return -1;
+  }
+  chip8_image_initialize(image, data, size);
+  rom->image = rom->loaded = image;
+  return 0;
+}
+
+void print_usage(void) {
+  printf("Usage: ch8corpus [OPTION]... ROMFILE|ARCHIVE.c8pak...\n\n");
+  printf("Runs every ROM under every profile and script headless, spread over\n");
+  printf("all cores, and prints the final display hash of each run\n\n");
+  printf("Options:\n");
+  printf("  -h         display this help\n");
+  printf("  -c NUM     number of cycles per frame (default: 20)\n");
+  printf("  -e ENGINE  execution engine (interp, predecode, fused, jit)\n");
+  printf("             (default: interp)\n");
+  printf("  -j NUM     number of threads (default: number of cores)\n");
+  printf("  -n NUM     number of frames per run (default: 600)\n");
+  printf("  -p PROFILE quirk profile (vip, modern, timendous or a quirk bitmask),\n");
+  printf("             can be repeated (default: the build one, or the one\n");
+  printf("             suggested by the archive)\n");
+  printf("  -s SCRIPT  input script, can be repeated (default: no input)\n");
+  printf("\nScript lines: FRAME KEY down|up (KEY in hex, # comments)\n");
+}
@@ -0,0 +1,273 @@
+#define _POSIX_C_SOURCE 200809L // getopt
+#include <chip8.h>
+#include <chip8_pak.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+Archive builder, packs every ROM file of the directories (and the files) given
+into a .c8pak archive (see chip8_pak.h) named after the file names, so ch8run
+can run ARCHIVE.c8pak:NAME and ch8corpus a whole archive with a single open.
+A suggested profile can be given for every ROM (-p) and per ROM with a profile
+list (-m), a text file with one "NAME PROFILE" line per ROM (# starts a
+comment). -l lists an archive and checks every image in it.
+*/
+
+typedef struct {
+  char name[CHIP8_PAK_NAME_SIZE];
+  uint8_t quirks;
+} profile_entry_t;
+
+typedef char name_t[CHIP8_PAK_NAME_SIZE];
+
+// ROMs read so far
+static struct {
+  chip8_pak_entry_t *entries;
+  chip8_image_t *images;
+  name_t *names;
+  uint32_t count;
+  uint32_t capacity;
+} pack;
+
+// Profile list (-m)
+static struct {
+  profile_entry_t *entries;
+  uint32_t count;
+  uint32_t capacity;
+} profiles;
+
+void print_usage(void);
+int load_profiles(const char *filename);
+int add_rom(const char *path, const char *name);
+int add_path(const char *path);
+int list_archive(const char *filename);
+
+int main(int argc, char *argv[]) {
+  const char *output = NULL;
+  const char *list = NULL;
+  uint8_t has_profile = 0;
+  uint8_t quirks = 0;
+
+  // Parse options
+  int opt;
+  while ((opt = getopt(argc, argv, "hl:m:o:p:")) != -1) {
+    switch (opt) {
+    case 'h':
+      print_usage();
+      return 0;
+    case 'l':
+      list = optarg;
+      break;
+    case 'm':
+      if (load_profiles(optarg))
+        return 1;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'p':
+      if (chip8_parse_profile(optarg, &quirks)) {
+        fprintf(stderr, "Unknown profile: %s\n", optarg);
+        print_usage();
+        return 1;
+      }
+      has_profile = 1;
+      break;
+    default:
+      print_usage();
+      return 1;
+    }
+  }
+  if (list)
+    return list_archive(list);
+  if (!output || optind >= argc) {
+    printf("Error: Missing archive or ROM files\n");
+    print_usage();
+    return 1;
+  }
+
+  int status = 0;
+  for (int i = optind; i < argc && !status; i++)
+    status = add_path(argv[i]);
+  if (!status) {
+    for (uint32_t r = 0; r < pack.count; r++) {
+      chip8_pak_entry_t *entry = &pack.entries[r];
+      // Stable now that nothing is added
+      entry->name = pack.names[r];
+      entry->image = &pack.images[r];
+      entry->flags = has_profile ? CHIP8_PAK_HAS_PROFILE : 0;
+      entry->quirks = quirks;
+      for (uint32_t p = 0; p < profiles.count; p++) {
+        if (strcmp(profiles.entries[p].name, entry->name) == 0) {
+          entry->flags = CHIP8_PAK_HAS_PROFILE;
+          entry->quirks = profiles.entries[p].quirks;
+        }
+      }
+    }
+    status = chip8_pak_save(output, pack.entries, pack.count);
+  }
+  if (!status)
+    printf("%u ROMs in %s\n", pack.count, output);
+
+  free(pack.entries);
+  free(pack.images);
+  free(pack.names);
+  free(profiles.entries);
+  return status;
+}
+
+// Adds a ROM file, or every file of a directory (not recursing)
+int add_path(const char *path) {
+  struct stat st;
+  if (stat(path, &st)) {
+    printf("Could not open %s\n", path);
+    return 1;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    const char *slash = strrchr(path, '/');
+    return add_rom(path, slash ? slash + 1 : path);
+  }
+  DIR *dir = opendir(path);
+  if (!dir) {
+    printf("Could not open %s\n", path);
+    return 1;
+  }
+  int status = 0;
+  struct dirent *file;
+  while (!status && (file = readdir(dir))) {
+    if (file->d_name[0] == '.')
+      continue; // Hidden files, . and ..
+    char rom[4096];
+    if ((size_t)snprintf(rom, sizeof(rom), "%s/%s", path, file->d_name) >=
+        sizeof(rom)) {
+      printf("Path too long: %s/%s\n", path, file->d_name);
+      status = 1;
+    } else if (!stat(rom, &st) && S_ISREG(st.st_mode)) {
+      status = add_rom(rom, file->d_name);
+    }
+  }
+  closedir(dir);
+  return status;
+}
+
+// Reads a ROM file into the next image
+int add_rom(const char *path, const char *name) {
+  if (strlen(name) >= CHIP8_PAK_NAME_SIZE) {
+    printf("Name too long: %s\n", name);
+    return 1;
+  }
+  if (pack.count == pack.capacity) {
+    uint32_t capacity = pack.capacity ? pack.capacity * 2u : 256u;
+    chip8_pak_entry_t *entries =
+        realloc(pack.entries, capacity * sizeof(*entries));
+    if (entries)
+      pack.entries = entries;
+    chip8_image_t *images = realloc(pack.images, capacity * sizeof(*images));
+    if (images)
+      pack.images = images;
+    name_t *names = realloc(pack.names, capacity * sizeof(*names));
+    if (names)
+      pack.names = names;
+    if (!entries || !images || !names) {
+      printf("Out of memory\n");
+      return 1;
+    }
+    pack.capacity = capacity;
+  }
+  uint8_t data[CHIP8_PAK_MAX_ROM_SIZE];
+  uint16_t size;
+  if (chip8_read_rom_file(path, data, &size))
+    return 1;
+  chip8_pak_entry_t *entry = &pack.entries[pack.count];
+  memset(entry, 0, sizeof(*entry));
+  strcpy(pack.names[pack.count], name);
+  entry->size = size;
+  chip8_image_initialize(&pack.images[pack.count], data, entry->size);
+  pack.count++;
+  return 0;
+}
+
+// Prints every ROM of an archive, returns 1 if any image is not what its
+// index says
+int list_archive(const char *filename) {
+  chip8_pak_t pak;
+  if (chip8_pak_open(&pak, filename))
+    return 1;
+  uint32_t bad = 0;
+  printf("# name size profile hash\n");
+  for (uint32_t i = 0; i < pak.count; i++) {
+    chip8_pak_entry_t entry;
+    chip8_pak_entry(&pak, i, &entry);
+    int valid = chip8_pak_entry_valid(&entry);
+    if (entry.flags & CHIP8_PAK_HAS_PROFILE)
+      printf("%s %u 0x%02x %016llx%s\n", entry.name, entry.size, entry.quirks,
+             (unsigned long long)entry.hash, valid ? "" : " BAD");
+    else
+      printf("%s %u - %016llx%s\n", entry.name, entry.size,
+             (unsigned long long)entry.hash, valid ? "" : " BAD");
+    bad += !valid;
+  }
+  printf("# %u ROMs, %u bad\n", pak.count, bad);
+  chip8_pak_close(&pak);
+  return bad ? 1 : 0;
+}
+
+// Loads "NAME PROFILE" lines
+int load_profiles(const char *filename) {
+  FILE *fd = fopen(filename, "r");
+  if (fd == NULL) {
+    printf("Could not open profile list %s\n", filename);
+    return -1;
+  }
+  char line[128];
+  char profile[32];
+  profile_entry_t entry;
+  uint32_t line_number = 0;
+  while (fgets(line, sizeof(line), fd)) {
+    line_number++;
+    char *comment = strchr(line, '#');
+    if (comment)
+      *comment = '\0';
+    int fields = sscanf(line, "%31s %31s", entry.name, profile);
+    if (fields <= 0)
+      continue; // Empty line
+    if (fields != 2 || chip8_parse_profile(profile, &entry.quirks)) {
+      printf("Bad profile line %s:%u\n", filename, line_number);
+      fclose(fd);
+      return -1;
+    }
+    if (profiles.count == profiles.capacity) {
+      profiles.capacity = profiles.capacity ? profiles.capacity * 2u : 64u;
+      profile_entry_t *entries = realloc(
+          profiles.entries, profiles.capacity * sizeof(*entries));
+      if (!entries) {
+        printf("Out of memory\n");
+        fclose(fd);
+        return -1;
+      }
+      profiles.entries = entries;
+    }
+    profiles.entries[profiles.count++] = entry;
+  }
+  fclose(fd);
+  return 0;
+}
+
+void print_usage(void) {
+  printf("Usage: ch8pak [OPTION]... -o ARCHIVE DIR|ROMFILE...\n");
+  printf("  or:  ch8pak -l ARCHIVE\n\n");
+  printf("Packs ROM files (every file of the directories given) into an\n");
+  printf("archive, ROMs are named after their file names\n\n");
+  printf("Options:\n");
+  printf("  -h         display this help\n");
+  printf("  -l ARCHIVE list the ROMs of an archive and check their images\n");
+  printf("  -m FILE    suggested profile per ROM, from NAME PROFILE lines\n");
+  printf("  -o ARCHIVE archive to write\n");
+  printf("  -p PROFILE suggested profile of every ROM (vip, modern, timendous\n");
+  printf("             or a quirk bitmask), -m overrides it (default: none)\n");
+}
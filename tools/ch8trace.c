@@ -0,0 +1,231 @@
+#define _POSIX_C_SOURCE 200809L // getopt
+#include <chip8.h>
+#include <chip8_trace.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+Trace decoder, prints a trace written by ch8run -t one instruction per line:
+cycle, address, opcode, the instruction and what it changed (V registers and
+I). Instructions skipped because of an idle loop or a blocked instruction are
+printed as a gap.
+*/
+
+void print_usage(void);
+void disassemble(uint16_t opcode, char *text, size_t size);
+
+static inline uint16_t get16(const uint8_t *p) {
+  return (uint16_t)(p[0] | p[1] << 8);
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t first = 0;
+  uint64_t count = UINT64_MAX;
+
+  // Parse options
+  int opt;
+  while ((opt = getopt(argc, argv, "hf:n:")) != -1) {
+    switch (opt) {
+    case 'h':
+      print_usage();
+      return 0;
+    case 'f':
+      first = strtoull(optarg, NULL, 10);
+      break;
+    case 'n':
+      count = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      print_usage();
+      return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    printf("Error: Missing trace file\n");
+    print_usage();
+    return 1;
+  }
+
+  FILE *fd = fopen(argv[optind], "rb");
+  if (fd == NULL) {
+    printf("Could not open file\n");
+    return 1;
+  }
+  uint8_t header[CHIP8_TRACE_HEADER_SIZE];
+  if (fread(header, 1, sizeof(header), fd) != sizeof(header) ||
+      memcmp(header, "CH8T", 4)) {
+    printf("Trace Error: not a trace\n");
+    fclose(fd);
+    return 1;
+  }
+  if (get16(header + 4) != CHIP8_TRACE_VERSION ||
+      get16(header + 6) != CHIP8_TRACE_RECORD_SIZE) {
+    printf("Trace Error: version %u is not supported\n", get16(header + 4));
+    fclose(fd);
+    return 1;
+  }
+
+  uint8_t data[CHIP8_TRACE_RECORD_SIZE];
+  chip8_trace_record_t record;
+  uint64_t next_cycle = 0; // Cycle of the instruction after the last one
+  uint16_t I = 0;
+  int started = 0;
+  while (count && fread(data, sizeof(data), 1, fd) == 1) {
+    chip8_trace_decode(data, &record);
+    if (record.cycle < first) {
+      I = record.I;
+      next_cycle = record.cycle + 1u;
+      continue;
+    }
+    if (started && record.cycle > next_cycle)
+      printf("%12s  %llu instructions skipped (idle loop or blocked)\n", "...",
+             (unsigned long long)(record.cycle - next_cycle));
+    char text[32];
+    disassemble(record.opcode, text, sizeof(text));
+    char changes[16 * 6 + 8] = "";
+    size_t length = 0;
+    for (uint8_t i = 0; i < 16; i++) {
+      if (record.changed & (1u << i))
+        length += (size_t)snprintf(changes + length, sizeof(changes) - length,
+                                   " V%X=%02X", i, record.V[i]);
+    }
+    if (!started || record.I != I)
+      snprintf(changes + length, sizeof(changes) - length, " I=%04X", record.I);
+    if (changes[0])
+      printf("%12llu  %04X  %04X  %-16s%s\n", (unsigned long long)record.cycle,
+             record.PC, record.opcode, text, changes);
+    else
+      printf("%12llu  %04X  %04X  %s\n", (unsigned long long)record.cycle,
+             record.PC, record.opcode, text);
+    I = record.I;
+    next_cycle = record.cycle + 1u;
+    started = 1;
+    count--;
+  }
+  fclose(fd);
+  return 0;
+}
+
+// Mnemonics as in Cowgod's Chip-8 Technical Reference
+void disassemble(uint16_t opcode, char *text, size_t size) {
+  unsigned nnn = opcode & 0x0FFFu;
+  unsigned x = (opcode & 0x0F00u) >> 8;
+  unsigned y = (opcode & 0x00F0u) >> 4;
+  unsigned kk = opcode & 0x00FFu;
+  unsigned n = opcode & 0x000Fu;
+  static const char *const alu[16] = {
+      "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+      NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL};
+  switch (opcode & 0xF000u) {
+  case 0x0000:
+    if (opcode == 0x00E0)
+      snprintf(text, size, "CLS");
+    else if (opcode == 0x00EE)
+      snprintf(text, size, "RET");
+    else
+      snprintf(text, size, "SYS %03X", nnn);
+    return;
+  case 0x1000:
+    snprintf(text, size, "JP %03X", nnn);
+    return;
+  case 0x2000:
+    snprintf(text, size, "CALL %03X", nnn);
+    return;
+  case 0x3000:
+    snprintf(text, size, "SE V%X, %02X", x, kk);
+    return;
+  case 0x4000:
+    snprintf(text, size, "SNE V%X, %02X", x, kk);
+    return;
+  case 0x5000:
+    if (n)
+      break;
+    snprintf(text, size, "SE V%X, V%X", x, y);
+    return;
+  case 0x6000:
+    snprintf(text, size, "LD V%X, %02X", x, kk);
+    return;
+  case 0x7000:
+    snprintf(text, size, "ADD V%X, %02X", x, kk);
+    return;
+  case 0x8000:
+    if (!alu[n])
+      break;
+    snprintf(text, size, "%s V%X, V%X", alu[n], x, y);
+    return;
+  case 0x9000:
+    if (n)
+      break;
+    snprintf(text, size, "SNE V%X, V%X", x, y);
+    return;
+  case 0xA000:
+    snprintf(text, size, "LD I, %03X", nnn);
+    return;
+  case 0xB000:
+    snprintf(text, size, "JP V0, %03X", nnn);
+    return;
+  case 0xC000:
+    snprintf(text, size, "RND V%X, %02X", x, kk);
+    return;
+  case 0xD000:
+    snprintf(text, size, "DRW V%X, V%X, %X", x, y, n);
+    return;
+  case 0xE000:
+    if (kk == 0x9E)
+      snprintf(text, size, "SKP V%X", x);
+    else if (kk == 0xA1)
+      snprintf(text, size, "SKNP V%X", x);
+    else
+      break;
+    return;
+  case 0xF000:
+    switch (kk) {
+    case 0x07:
+      snprintf(text, size, "LD V%X, DT", x);
+      return;
+    case 0x0A:
+      snprintf(text, size, "LD V%X, K", x);
+      return;
+    case 0x15:
+      snprintf(text, size, "LD DT, V%X", x);
+      return;
+    case 0x18:
+      snprintf(text, size, "LD ST, V%X", x);
+      return;
+    case 0x1E:
+      snprintf(text, size, "ADD I, V%X", x);
+      return;
+    case 0x29:
+      snprintf(text, size, "LD F, V%X", x);
+      return;
+    case 0x33:
+      snprintf(text, size, "LD B, V%X", x);
+      return;
+    case 0x55:
+      snprintf(text, size, "LD [I], V%X", x);
+      return;
+    case 0x65:
+      snprintf(text, size, "LD V%X, [I]", x);
+      return;
+    default:
+      break;
+    }
+    break;
+  default:
+    break;
+  }
+  snprintf(text, size, "??? %04X", opcode);
+}
+
+void print_usage(void) {
+  printf("Usage: ch8trace [OPTION]... TRACEFILE\n\n");
+  printf("Prints a trace written by ch8run -t, one instruction per line with\n");
+  printf("the registers it changed\n\n");
+  printf("Options:\n");
+  printf("  -h         display this help\n");
+  printf("  -f CYCLE   start at this cycle (default: 0)\n");
+  printf("  -n NUM     number of instructions to print (default: all)\n");
+}
@@ -0,0 +1,548 @@
+#define _POSIX_C_SOURCE 200809L // getopt
+#include <chip8.h>
+#include <chip8_arena.h>
+#include <chip8_jit.h>
+#include <chip8_lanes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+/*
+Differential verifier, runs every ROM on the reference interpreter (chip8_step,
+one instruction at a time) and on an execution engine (chip8_run) in lockstep
+with the same random key presses, and compares the whole machine state after
+every batch the engine runs: PC, SP, stack, V, I, DT, ST, memory, display,
+dirty rows, keys, the RNG state and the events raised. The reference loads its
+own copy of the ROM and the engine shares an image of it, so the copy made on
+the first store gets checked too.
+A batch is what chip8_run runs before returning (the rest of the frame, or up
+to an event), -k caps it (-k 1 compares after every instruction, but fused
+idioms and JIT blocks only run when they fit in the batch) and -z makes the
+batch sizes random to also cover the idioms and blocks that do not fit.
+On the first divergence the run stops with the fields that differ and the
+last instructions of the reference. Runs are independent, a big corpus can be
+split over processes.
+The lanes engine runs VERIFY_LANES lanes of the ROM at once, each with its own
+keys and RNG seed (so they split into groups), and every lane is compared
+with its own reference after each chip8_lanes_run and chip8_lanes_frame_end.
+Lanes raise no events and keep no dirty rows, those are not compared.
+*/
+
+#define HISTORY_SIZE 16u // Reference instructions shown on a divergence
+#define MAX_DIFFS 16u    // Differing bytes shown per field
+#define VERIFY_LANES 16u // Lanes run together by the lanes engine
+
+typedef enum { PREDECODE, FUSED, JIT, LANES } Engine;
+
+static const char *const engine_names[] = {"predecode", "fused", "jit",
+                                           "lanes"};
+
+typedef struct {
+  uint64_t cycle;
+  uint16_t pc;
+  uint16_t opcode;
+  uint32_t repeats; // Times it ran again in a row (blocked or a jump to itself)
+} history_t;
+
+// A run, reference and engine side by side
+typedef struct {
+  chip8_t *reference;       // Loads a private copy of the ROM
+  chip8_t *engine;          // Shares image, copied on the first store
+  uint8_t *reference_ram;   // Their RAM slots in the arena
+  uint8_t *engine_ram;
+  chip8_image_t image;
+  history_t history[HISTORY_SIZE];
+  uint32_t history_count;
+  uint8_t reference_events; // CHIP8_EVENT_* raised since the last compare
+  uint8_t engine_events;
+  uint32_t rand_state;      // Inputs and batch sizes
+} verify_t;
+
+static struct {
+  Engine engine;
+  uint8_t quirks;
+  uint32_t frames;
+  uint32_t cycles_per_frame;
+  uint32_t max_batch;
+  uint8_t random_batches;
+  uint32_t key_percent;
+  uint8_t quiet;
+} options;
+
+void print_usage(void);
+
+static uint32_t verify_rand(verify_t *verify) {
+  verify->rand_state ^= verify->rand_state << 13;
+  verify->rand_state ^= verify->rand_state >> 17;
+  verify->rand_state ^= verify->rand_state << 5;
+  return verify->rand_state;
+}
+
+// Print the bytes of a field that differ, returns 1 if any did
+static int diff_bytes(const char *field, const uint8_t *reference,
+                      const uint8_t *engine, uint32_t size, uint32_t base) {
+  uint32_t differ = 0;
+  for (uint32_t i = 0; i < size; i++) {
+    if (reference[i] == engine[i])
+      continue;
+    if (differ < MAX_DIFFS) {
+      char name[32];
+      snprintf(name, sizeof(name), "%s[%x]", field, base + i);
+      printf("  %-18s %02x  %02x\n", name, reference[i], engine[i]);
+    }
+    differ++;
+  }
+  if (differ > MAX_DIFFS)
+    printf("  ... %u more in %s\n", differ - MAX_DIFFS, field);
+  return differ != 0;
+}
+
+static int diff_value(const char *field, unsigned long long reference,
+                      unsigned long long engine) {
+  if (reference == engine)
+    return 0;
+  printf("  %-18s %llx  %llx\n", field, reference, engine);
+  return 1;
+}
+
+// Compare the states, prints the differences (if print), returns 1 if any
+static int compare(const verify_t *verify, uint8_t engine_events, int print) {
+  const chip8_t *a = verify->reference;
+  const chip8_t *b = verify->engine;
+  const int lanes = options.engine == LANES; // No events nor dirty rows
+  if (!print) {
+    // Fast path, checked after every batch
+    return a->PC != b->PC || a->SP != b->SP || a->I != b->I ||
+           a->DT != b->DT || a->ST != b->ST || a->cycles != b->cycles ||
+           (!lanes && (a->dirty_rows != b->dirty_rows ||
+                       a->display_generation != b->display_generation ||
+                       verify->reference_events != engine_events)) ||
+           a->rand_state != b->rand_state ||
+           memcmp(a->V, b->V, sizeof(a->V)) ||
+           memcmp(a->stack, b->stack, sizeof(a->stack)) ||
+           a->keys != b->keys ||
+           memcmp(a->memory, b->memory, CHIP8_MEM_SIZE) ||
+           memcmp(a->display, b->display, sizeof(a->display));
+  }
+  printf("  %-18s %s  %s\n", "field", "reference", "engine");
+  int differ = diff_value("PC", a->PC, b->PC);
+  differ |= diff_value("SP", a->SP, b->SP);
+  differ |= diff_value("I", a->I, b->I);
+  differ |= diff_value("DT", a->DT, b->DT);
+  differ |= diff_value("ST", a->ST, b->ST);
+  differ |= diff_value("cycles", a->cycles, b->cycles);
+  if (!lanes) {
+    differ |= diff_value("dirty_rows", a->dirty_rows, b->dirty_rows);
+    differ |= diff_value("display_generation", a->display_generation,
+                         b->display_generation);
+    differ |= diff_value("events", verify->reference_events, engine_events);
+  }
+  differ |= diff_value("rand_state", a->rand_state, b->rand_state);
+  differ |= diff_bytes("V", a->V, b->V, sizeof(a->V), 0);
+  for (uint32_t i = 0; i < CHIP8_STACK_SIZE; i++) {
+    char field[16];
+    snprintf(field, sizeof(field), "stack[%x]", i);
+    differ |= diff_value(field, a->stack[i], b->stack[i]);
+  }
+  differ |= diff_value("keys", a->keys, b->keys);
+  differ |= diff_bytes("memory", a->memory, b->memory, CHIP8_MEM_SIZE, 0);
+  for (uint32_t row = 0; row < CHIP8_DISPLAY_HEIGHT; row++) {
+    char field[16];
+    snprintf(field, sizeof(field), "display%u", row);
+    differ |= diff_bytes(field, a->display[row], b->display[row],
+                         CHIP8_DISPLAY_WIDTH / 8u, 0);
+  }
+  return differ;
+}
+
+// Step the reference up to the engine's cycle count, returns 1 if it cannot
+static int catch_up(verify_t *verify) {
+  chip8_t *reference = verify->reference;
+  while (reference->cycles < verify->engine->cycles) {
+    uint16_t opcode = chip8_opcode_at(reference, reference->PC);
+    history_t *entry =
+        &verify->history[(verify->history_count - 1u) % HISTORY_SIZE];
+    if (verify->history_count && entry->pc == reference->PC &&
+        entry->opcode == opcode) {
+      entry->repeats++;
+    } else {
+      entry = &verify->history[verify->history_count++ % HISTORY_SIZE];
+      entry->cycle = reference->cycles;
+      entry->pc = reference->PC;
+      entry->opcode = opcode;
+      entry->repeats = 0;
+    }
+    verify->reference_events |= chip8_step(reference);
+  }
+  chip8_event_t event;
+  while (chip8_poll_event(reference, &event))
+    verify->reference_events |= event.type;
+  return reference->cycles != verify->engine->cycles;
+}
+
+static void print_divergence(const verify_t *verify, const char *rom,
+                             uint32_t seed, uint32_t frame, uint16_t batch_pc,
+                             uint32_t batch, uint8_t engine_events) {
+  printf("%s seed %u: DIVERGED on %s at cycle %llu (frame %u), batch of %u "
+         "from 0x%03x\n",
+         rom, seed, engine_names[options.engine],
+         (unsigned long long)verify->engine->cycles, frame, batch, batch_pc);
+  compare(verify, engine_events, 1);
+  printf("  last instructions of the reference\n");
+  uint32_t count = verify->history_count < HISTORY_SIZE ? verify->history_count
+                                                        : HISTORY_SIZE;
+  for (uint32_t i = verify->history_count - count; i < verify->history_count;
+       i++) {
+    const history_t *entry = &verify->history[i % HISTORY_SIZE];
+    if (entry->repeats)
+      printf("  %12llu  %04X  %04X  (%u more times)\n",
+             (unsigned long long)entry->cycle, entry->pc, entry->opcode,
+             entry->repeats);
+    else
+      printf("  %12llu  %04X  %04X\n", (unsigned long long)entry->cycle,
+             entry->pc, entry->opcode);
+  }
+}
+
+// Key to toggle this frame, or -1 (the same random change on both sides)
+static int verify_key_change(verify_t *verify) {
+  if (verify_rand(verify) % 100u >= options.key_percent)
+    return -1;
+  return (int)(verify_rand(verify) & 0xFu);
+}
+
+// Run a ROM with a seed, returns 1 on a divergence
+static int verify_run(verify_t *verify, const char *rom, const uint8_t *data,
+                      uint16_t size, uint32_t seed,
+                      chip8_predecode_t *predecode, chip8_jit_t *jit) {
+  chip8_interface_t chip8_interface = {0};
+  chip8_t *reference = verify->reference;
+  chip8_t *engine = verify->engine;
+  chip8_initialize(reference, chip8_interface);
+  chip8_initialize(engine, chip8_interface);
+  chip8_set_ram(reference, verify->reference_ram);
+  chip8_set_ram(engine, verify->engine_ram);
+  chip8_set_quirks(reference, options.quirks);
+  chip8_set_quirks(engine, options.quirks);
+  chip8_seed_rand(reference, seed);
+  chip8_seed_rand(engine, seed);
+  if (options.engine == JIT) {
+    chip8_jit_attach(engine, jit);
+  } else {
+    chip8_predecode_attach(engine, predecode);
+    chip8_predecode_set_fusion(engine, options.engine == FUSED);
+  }
+  chip8_load_rom(reference, data, size);
+  chip8_image_initialize(&verify->image, data, size);
+  chip8_load_image(engine, &verify->image);
+  verify->history_count = 0;
+  verify->reference_events = 0;
+  verify->engine_events = 0;
+  verify->rand_state = seed ? seed : 1u;
+
+  for (uint32_t frame = 1; frame <= options.frames; frame++) {
+    int key = verify_key_change(verify);
+    if (key >= 0 && chip8_key_pressed(engine, (uint8_t)key)) {
+      chip8_reset_key(reference, (uint8_t)key);
+      chip8_reset_key(engine, (uint8_t)key);
+    } else if (key >= 0) {
+      chip8_set_key(reference, (uint8_t)key);
+      chip8_set_key(engine, (uint8_t)key);
+    }
+
+    for (uint32_t cycles = 0; cycles < options.cycles_per_frame;) {
+      uint32_t batch = options.cycles_per_frame - cycles;
+      if (batch > options.max_batch)
+        batch = options.max_batch;
+      if (options.random_batches)
+        batch = 1u + verify_rand(verify) % batch;
+      uint16_t batch_pc = engine->PC;
+      uint32_t ran = chip8_run(engine, batch);
+      cycles += ran;
+      uint8_t engine_events = verify->engine_events;
+      chip8_event_t event;
+      while (chip8_poll_event(engine, &event))
+        engine_events |= event.type;
+      if (catch_up(verify) || compare(verify, engine_events, 0)) {
+        print_divergence(verify, rom, seed, frame, batch_pc, ran,
+                         engine_events);
+        return 1;
+      }
+      verify->reference_events = 0;
+      verify->engine_events = 0;
+    }
+
+    chip8_frame_end(reference);
+    chip8_frame_end(engine);
+    // The tick queues SOUND_STOP, compared with the next batch (the reference
+    // ring could overflow with its events before then)
+    chip8_event_t event;
+    while (chip8_poll_event(reference, &event))
+      verify->reference_events |= event.type;
+    while (chip8_poll_event(engine, &event))
+      verify->engine_events |= event.type;
+  }
+  if (!options.quiet)
+    printf("%s seed %u: ok, %llu instructions\n", rom, seed,
+           (unsigned long long)engine->cycles);
+  return 0;
+}
+
+// Run a ROM on VERIFY_LANES lanes, lane l with the seed seed + l * 0x9E3779B9,
+// returns 1 on a divergence
+static int verify_lanes_run(verify_t *verify, chip8_lanes_t *lanes,
+                            chip8_t *engine, const char *rom,
+                            const uint8_t *data, uint16_t size, uint32_t seed) {
+  chip8_interface_t chip8_interface = {0};
+  chip8_lanes_initialize(lanes, VERIFY_LANES, options.quirks);
+  for (uint8_t l = 0; l < VERIFY_LANES; l++) {
+    chip8_t *reference = verify[l].reference;
+    uint32_t lane_seed = seed + l * 0x9E3779B9u;
+    chip8_initialize(reference, chip8_interface);
+    chip8_set_ram(reference, verify[l].reference_ram);
+    chip8_set_quirks(reference, options.quirks);
+    chip8_seed_rand(reference, lane_seed);
+    chip8_load_rom(reference, data, size);
+    chip8_lanes_load(lanes, l, reference);
+    verify[l].engine = engine; // Every lane is stored into it to compare
+    verify[l].history_count = 0;
+    verify[l].reference_events = 0;
+    verify[l].rand_state = lane_seed ? lane_seed : 1u;
+  }
+  chip8_initialize(engine, chip8_interface);
+  chip8_set_ram(engine, verify[0].engine_ram);
+
+  for (uint32_t frame = 1; frame <= options.frames; frame++) {
+    for (uint8_t l = 0; l < VERIFY_LANES; l++) {
+      int key = verify_key_change(&verify[l]);
+      if (key < 0)
+        continue;
+      uint8_t pressed = chip8_key_pressed(verify[l].reference, (uint8_t)key);
+      if (pressed)
+        chip8_reset_key(verify[l].reference, (uint8_t)key);
+      else
+        chip8_set_key(verify[l].reference, (uint8_t)key);
+      chip8_lanes_set_key(lanes, l, (uint8_t)key, !pressed);
+    }
+
+    for (uint32_t cycles = 0; cycles < options.cycles_per_frame;) {
+      uint32_t batch = options.cycles_per_frame - cycles;
+      if (batch > options.max_batch)
+        batch = options.max_batch;
+      if (options.random_batches)
+        batch = 1u + verify_rand(&verify[0]) % batch;
+      chip8_lanes_run(lanes, batch);
+      cycles += batch;
+      for (uint8_t l = 0; l < VERIFY_LANES; l++) {
+        uint16_t batch_pc = verify[l].reference->PC;
+        chip8_lanes_store(lanes, l, engine);
+        if (catch_up(&verify[l]) || compare(&verify[l], 0, 0)) {
+          char name[4096];
+          snprintf(name, sizeof(name), "%s lane %u", rom, l);
+          print_divergence(&verify[l], name, seed, frame, batch_pc, batch, 0);
+          return 1;
+        }
+      }
+    }
+
+    chip8_lanes_frame_end(lanes);
+    for (uint8_t l = 0; l < VERIFY_LANES; l++) {
+      chip8_frame_end(verify[l].reference);
+      chip8_lanes_store(lanes, l, engine);
+      if (compare(&verify[l], 0, 0)) {
+        char name[4096];
+        snprintf(name, sizeof(name), "%s lane %u", rom, l);
+        print_divergence(&verify[l], name, seed, frame,
+                         verify[l].reference->PC, 0, 0);
+        return 1;
+      }
+      chip8_event_t event;
+      while (chip8_poll_event(verify[l].reference, &event))
+        ;
+    }
+  }
+  if (!options.quiet)
+    printf("%s seed %u: ok, %llu instructions on %u lanes\n", rom, seed,
+           (unsigned long long)engine->cycles, VERIFY_LANES);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t first_seed = 1;
+  uint32_t seeds = 1;
+  options.engine = JIT;
+  options.quirks = CHIP8_DEFAULT_PROFILE;
+  options.frames = 600;
+  options.cycles_per_frame = 20;
+  options.max_batch = UINT32_MAX;
+  options.key_percent = 10;
+
+  // Parse options
+  int opt;
+  while ((opt = getopt(argc, argv, "hqzc:e:i:k:n:p:r:s:")) != -1) {
+    switch (opt) {
+    case 'h':
+      print_usage();
+      return 0;
+    case 'q':
+      options.quiet = 1;
+      break;
+    case 'z':
+      options.random_batches = 1;
+      break;
+    case 'c':
+      if (!(options.cycles_per_frame = (uint32_t)atoi(optarg))) {
+        printf("Cannot be 0\n");
+        return 1;
+      }
+      break;
+    case 'e':
+      if (strcasecmp(optarg, "predecode") == 0)
+        options.engine = PREDECODE;
+      else if (strcasecmp(optarg, "fused") == 0)
+        options.engine = FUSED;
+      else if (strcasecmp(optarg, "jit") == 0)
+        options.engine = JIT;
+      else if (strcasecmp(optarg, "lanes") == 0)
+        options.engine = LANES;
+      else {
+        fprintf(stderr, "Unknown engine: %s\n", optarg);
+        print_usage();
+        return 1;
+      }
+      break;
+    case 'i':
+      options.key_percent = (uint32_t)atoi(optarg);
+      break;
+    case 'k':
+      if (!(options.max_batch = (uint32_t)atoi(optarg))) {
+        printf("Cannot be 0\n");
+        return 1;
+      }
+      break;
+    case 'n':
+      if (!(options.frames = (uint32_t)atoi(optarg))) {
+        printf("Cannot be 0\n");
+        return 1;
+      }
+      break;
+    case 'p':
+      if (chip8_parse_profile(optarg, &options.quirks)) {
+        fprintf(stderr, "Unknown profile: %s\n", optarg);
+        print_usage();
+        return 1;
+      }
+      break;
+    case 'r':
+      if (!(seeds = (uint32_t)atoi(optarg))) {
+        printf("Cannot be 0\n");
+        return 1;
+      }
+      break;
+    case 's':
+      first_seed = (uint32_t)strtoul(optarg, NULL, 10);
+      break;
+    default:
+      print_usage();
+      return 1;
+    }
+  }
+  if (optind >= argc) {
+    printf("Error: Missing ROM files\n");
+    print_usage();
+    return 1;
+  }
+
+  // A reference per lane (only the first one without lanes) and the engine
+  verify_t *verify = malloc(VERIFY_LANES * sizeof(*verify));
+  chip8_predecode_t *predecode = malloc(sizeof(*predecode));
+  chip8_jit_t *jit = malloc(sizeof(*jit));
+  chip8_lanes_t *lanes = malloc(sizeof(*lanes));
+  uint8_t *data = malloc(CHIP8_MAX_ROM_SIZE);
+  chip8_arena_t arena = {0};
+  if (!verify || !predecode || !jit || !lanes || !data ||
+      chip8_arena_initialize(&arena, VERIFY_LANES + 1u)) {
+    printf("Out of memory\n");
+    chip8_arena_destroy(&arena);
+    free(verify);
+    free(predecode);
+    free(jit);
+    free(lanes);
+    free(data);
+    return 1;
+  }
+  chip8_t *engine = chip8_arena_alloc(&arena, 1);
+  for (uint32_t l = 0; l < VERIFY_LANES; l++) {
+    verify[l].reference = chip8_arena_alloc(&arena, 1);
+    verify[l].engine = engine;
+    verify[l].reference_ram = chip8_arena_ram(&arena, verify[l].reference);
+    verify[l].engine_ram = chip8_arena_ram(&arena, engine);
+  }
+  if (options.engine == JIT && chip8_jit_initialize(jit)) {
+    printf("JIT not available\n");
+    chip8_arena_destroy(&arena);
+    free(verify);
+    free(predecode);
+    free(jit);
+    free(lanes);
+    free(data);
+    return 1;
+  }
+
+  uint32_t runs = 0;
+  uint32_t diverged = 0;
+  int status = 0;
+  for (int i = optind; i < argc; i++) {
+    uint16_t size;
+    if (chip8_read_rom_file(argv[i], data, &size)) {
+      status = 1;
+      continue;
+    }
+    for (uint32_t s = 0; s < seeds; s++) {
+      if (options.engine == LANES)
+        diverged += (uint32_t)verify_lanes_run(verify, lanes, engine, argv[i],
+                                               data, size, first_seed + s);
+      else
+        diverged += (uint32_t)verify_run(verify, argv[i], data, size,
+                                         first_seed + s, predecode, jit);
+      runs++;
+    }
+  }
+  printf("%u runs on %s, %u diverged\n", runs, engine_names[options.engine],
+         diverged);
+
+  if (options.engine == JIT)
+    chip8_jit_destroy(jit);
+  free(data);
+  free(lanes);
+  free(jit);
+  free(predecode);
+  free(verify);
+  chip8_arena_destroy(&arena);
+  return status || diverged ? 1 : 0;
+}
+
+void print_usage(void) {
+  printf("Usage: ch8verify [OPTION]... ROMFILE...\n\n");
+  printf("Runs every ROM on the reference interpreter and on an engine in\n");
+  printf("lockstep with random key presses, and stops a run at the first\n");
+  printf("difference in the machine state\n\n");
+  printf("Options:\n");
+  printf("  -h         display this help\n");
+  printf("  -c NUM     number of cycles per frame (default: 20)\n");
+  printf("  -e ENGINE  engine to verify (predecode, fused, jit, lanes)\n");
+  printf("             (default: jit)\n");
+  printf("  -i PERCENT chance of a key change every frame (default: 10)\n");
+  printf("  -k NUM     max instructions per compared batch (default: the rest\n");
+  printf("             of the frame)\n");
+  printf("  -n NUM     number of frames per run (default: 600)\n");
+  printf("  -p PROFILE quirk profile (vip, modern, timendous or a quirk bitmask)\n");
+  printf("             (default: the build one)\n");
+  printf("  -q         only print the divergences and the summary\n");
+  printf("  -r NUM     runs per ROM, with seeds SEED, SEED+1... (default: 1)\n");
+  printf("  -s SEED    first seed of the keys and the RNG (default: 1)\n");
+  printf("  -z         random batch sizes up to the max\n");
+}